@@ -128,7 +128,8 @@ void TAnaManager::UpdateTransientPlots(TDataContainer& dataContainer){
   std::vector<THistogramArrayBase*> histos = GetHistograms();
   
   for (unsigned int i = 0; i < histos.size(); i++) {
-    if (histos[i]->IsUpdateWhenPlotted()) {
+    // skip the ones on tabs that are not being shown
+    if (histos[i]->IsUpdateWhenPlotted() && histos[i]->IsVisible()) {
       histos[i]->UpdateHistograms(dataContainer);
     }
   }
@@ -60,7 +60,7 @@ void TDT724Waveform::UpdateHistograms(TDataContainer& dataContainer){
 	if(dt724){      
 		
 
-		std::vector<RawChannelMeasurement> measurements = dt724->GetMeasurements();
+		std::vector<RawChannelMeasurement>& measurements = dt724->GetMeasurements();
 
 		for(int i = 0; i < measurements.size(); i++){
 			
@@ -68,13 +68,10 @@ void TDT724Waveform::UpdateHistograms(TDataContainer& dataContainer){
 			
 			
 			// Reset the histogram...
-			for(int ib = 0; ib < GetHistogram(chan)->GetNbinsX(); ib++)
-				GetHistogram(chan)->SetBinContent(ib+1,0);
+			ClearBins(chan);
 
 			//std::cout << "Nsamples " <<  measurements[i].GetNSamples() << std::endl;
-			for(int ib = 0; ib < measurements[i].GetNSamples(); ib++){
-				GetHistogram(chan)->SetBinContent(ib+1, measurements[i].GetSample(ib));
-			}
+			SetBinContents(chan, 1, measurements[i].GetSamples());
 
 		}
   }
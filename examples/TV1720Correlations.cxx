@@ -55,18 +55,9 @@ void TV1720Correlations::UpdateHistograms(TDataContainer& dataContainer){
       TV1720RawChannel channelData = v1720->GetChannelData(i);
       if(channelData.GetNSamples() <= 0) continue;
 
-      double max_adc_value = -1.0;
-      double max_adc_time = -1;
-      
-      
-      for(int j = 0; j < channelData.GetNSamples(); j++){
-	double adc = channelData.GetADCSample(j);
-	if(adc > max_adc_value){
-	  max_adc_value = adc;
-	  max_adc_time = j * 4.0; // 4ns per bin
-	}
-	
-      }
+      TWaveformResult result = fDSP.Analyze(channelData.GetADCSamples());
+      double max_adc_value = channelData.GetADCSample(result.fPeakSample);
+      double max_adc_time = result.fPeakSample * 4.0; // 4ns per bin
 
       GetHistogram(i)->Fill(max_adc_time,max_adc_value);
 
@@ -3,6 +3,7 @@
 
 #include <string>
 #include "THistogramArrayBase.h"
+#include "TWaveformDSP.hxx"
 #include "TH2D.h"
 /// Class for making 2D histogram of correlation
 /// between V1720 pulse height and bin
@@ -10,6 +11,7 @@ class TV1720Correlations : public THistogramArrayBase {
 public:
   TV1720Correlations(){
     SetSubTabName("V1720 Correlations");
+    fDSP.SetPolarity(1); // look for the maximum sample
     CreateHistograms();
   };
   virtual ~TV1720Correlations(){};
@@ -27,6 +29,8 @@ public:
   }
 
 private:
+
+  TWaveformDSP fDSP;
 };
 
 #endif
@@ -72,18 +72,14 @@ void TV1720Waveform::UpdateHistograms(TDataContainer& dataContainer){
 			
 			int index =  i;
 			// Reset the histogram...
-			for(int ib = 0; ib < 250; ib++)
-				GetHistogram(index)->SetBinContent(ib+1,0);
+			ClearBins(index);
 			
 			TV1720RawChannel channelData = v1720->GetChannelData(i);
 			
 			// Loop over pulses, filling the histogram
 			for(int j = 0; j < channelData.GetNZlePulses(); j++){
 				TV1720RawZlePulse pulse = channelData.GetZlePulse(j);
-				for(int k = 0; k < pulse.GetNSamples(); k++){
-					int bin = pulse.GetFirstBin() + k;
-					GetHistogram(index)->SetBinContent(bin,pulse.GetSample(k));
-				}
+				SetBinContents(index, pulse.GetFirstBin(), pulse.GetSamples());
 			}
 			
 		}
@@ -96,17 +92,10 @@ void TV1720Waveform::UpdateHistograms(TDataContainer& dataContainer){
 			int index = i;
 			
 			// Reset the histogram...
-			//        for(int ib = 0; ib < 2500; ib++)
-			for(int ib = 0; ib < 250; ib++)
-				GetHistogram(index)->SetBinContent(ib+1,0);
-			
+			ClearBins(index);
 			
 			TV1720RawChannel channelData = v1720->GetChannelData(i);
-			for(int j = 0; j < channelData.GetNSamples(); j++){
-				double adc = channelData.GetADCSample(j);
-				GetHistogram(index)->SetBinContent(j+1,adc);
-				
-			}            		
+			SetBinContents(index, 1, channelData.GetADCSamples());
     }
   }
 
@@ -61,28 +61,21 @@ void TV1730DppWaveform::UpdateHistograms(TDataContainer& dataContainer){
 	if(v1730 ){      
 
 		
-		std::vector<ChannelMeasurement> measurements = v1730->GetMeasurements();
+		std::vector<ChannelMeasurement>& measurements = v1730->GetMeasurements();
 
 		for(int i = 0; i < measurements.size(); i++){
 			
 			int chan = measurements[i].GetChannel();
 			
         // Reset the histogram...
-			for(int ib = 0; ib < this->numSamples; ib++)
-				GetHistogram(chan)->SetBinContent(ib+1,0);
+			ClearBins(chan);
 
 			// Hack!
 			float offset = 0;
 			if(chan == 1)
 				offset = 35;
 			//std::cout << "Nsamples " <<  measurements[i].GetNSamples() << std::endl;
-			for(int ib = 0; ib < measurements[i].GetNSamples(); ib++){
-
-
-				GetHistogram(chan)->SetBinContent(ib+1, measurements[i].GetSample(ib)-offset);
-				//std::cout << "Setting " << chan << " " << ib << " " << measurements[i].GetSample(ib) << std::endl;
-
-			}
+			SetBinContents(chan, 1, measurements[i].GetSamples(), offset);
 
 		}
 
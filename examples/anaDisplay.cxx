@@ -74,6 +74,11 @@ public:
     // saves CPU to not update them always when not being used.
     anaManager->UpdateTransientPlots(dataContainer);
   }
+
+  void PlotCanvasHeadless(TDataContainer& dataContainer){
+    // The same for headless mode (-B), where PlotCanvas is not called.
+    anaManager->UpdateTransientPlots(dataContainer);
+  }
   
 }; 
 
@@ -0,0 +1,544 @@
+// Generic program for converting MIDAS format to columnar output.
+//
+// Unlike midas2root.exe, nothing about the banks is compiled in: a small
+// schema file maps MIDAS banks (raw typed words, or a named decoder) to typed
+// columns.  The columns are written either as a ROOT TTree (one branch per
+// column, tuned basket sizes) or as a simple memory-mappable binary format
+// (one flat little-endian array per column).
+//
+// Schema file syntax, one statement per line, '#' starts a comment:
+//
+//   event  <id>                                   only convert this event id (may repeat)
+//   column <name> <bank> <type> <count> [<first> [<stride>]]
+//
+// <type> is the type of the words in the bank: i8 u8 i16 u16 i32 u32 i64 u64 f32 f64,
+// or the name of a decoder (see gDecoders below), for instance 'v792'.
+// <count> is the number of values per event; '*' makes a variable length
+// column taking every <stride>'th word of the bank starting at word <first>.
+// A fixed length column is zero-filled when the bank is missing or short.
+//
+// Example, replacing midas2root.exe and midas2root_alt.exe:
+//
+//   column adc_value        ADC0 v792 32
+//   column current_readings BRV1 f32  9 0 2
+//   column voltage_readings BRV1 f32  9 1 2
+//
+// Every output also has the columns serialnumber, timestamp, eventid and triggermask.
+//
+// Binary output (-c) goes into the directory <prefix>NNNNNNNN.cols containing
+// <column>.dat (values, fixed length columns have <count> values per event),
+// <column>.idx (for variable length columns: uint64 offset of the first value
+// of each event, plus a final entry with the total) and columns.txt
+// describing the layout.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <string>
+#include <vector>
+
+#include "TRootanaEventLoop.hxx"
+#include "TFile.h"
+#include "TTree.h"
+
+/// Types of the words in a MIDAS bank; these are also the column types.
+struct ColumnType {
+  const char* fName;  ///< name used in the schema file
+  char fLeaf;         ///< ROOT leaf type code
+  int fSize;          ///< size in bytes
+};
+
+static const ColumnType gTypes[] = {
+  { "i8",  'B', 1 },
+  { "u8",  'b', 1 },
+  { "i16", 'S', 2 },
+  { "u16", 's', 2 },
+  { "i32", 'I', 4 },
+  { "u32", 'i', 4 },
+  { "i64", 'L', 8 },
+  { "u64", 'l', 8 },
+  { "f32", 'F', 4 },
+  { "f64", 'D', 8 },
+  { NULL,  0,   0 }
+};
+
+static int FindType(const char* name)
+{
+  for (int i=0; gTypes[i].fName; i++)
+    if (strcmp(gTypes[i].fName, name) == 0)
+      return i;
+  return -1;
+}
+
+/// Decode the CAEN V792 bank into one value per channel, indexed by channel number.
+/// Same decoding as TV792Data, without creating the measurement objects.
+static int DecodeV792(const void* pdata, int bklen, void* out, int maxn)
+{
+  const uint32_t* words = (const uint32_t*)pdata;
+  uint32_t* adc = (uint32_t*)out;
+  int n = 0;
+  for (int i=0; i<bklen; i++) {
+    uint32_t word = words[i];
+    if ((word & 0x07000000) != 0) // not a measurement
+      continue;
+    int chan = (word & 0x1f0000) >> 16;
+    if (chan < maxn) {
+      adc[chan] = word & 0xfff;
+      if (chan >= n)
+        n = chan + 1;
+    }
+  }
+  return n;
+}
+
+/// Decoders usable as column type in the schema file.
+struct ColumnDecoder {
+  const char* fName;   ///< name used in the schema file
+  const char* fType;   ///< type of the decoded values
+  /// Decode bank into at most maxn values, returns the number of values.
+  int (*fDecode)(const void* pdata, int bklen, void* out, int maxn);
+};
+
+static const ColumnDecoder gDecoders[] = {
+  { "v792", "u32", DecodeV792 },
+  { NULL, NULL, NULL }
+};
+
+static int FindDecoder(const char* name)
+{
+  for (int i=0; gDecoders[i].fName; i++)
+    if (strcmp(gDecoders[i].fName, name) == 0)
+      return i;
+  return -1;
+}
+
+/// One output column.
+struct Column {
+  std::string fName;
+  std::string fBank;
+  int fType;             ///< index into gTypes
+  int fDecoder;          ///< index into gDecoders, or -1 for raw bank words
+  int fCount;            ///< values per event, 0 for variable length
+  int fFirst;
+  int fStride;
+
+  std::vector<char> fValues; ///< values of the current event
+  int fN;                    ///< number of values in the current event
+
+  TBranch* fBranch;
+  FILE* fData;
+  FILE* fIndex;
+  uint64_t fTotal;           ///< number of values written so far
+
+  Column() : fType(-1), fDecoder(-1), fCount(0), fFirst(0), fStride(1), fN(0), fBranch(NULL), fData(NULL), fIndex(NULL), fTotal(0) {}
+
+  int Size() const { return gTypes[fType].fSize; }
+  char* Values() { return fValues.empty() ? NULL : &fValues[0]; }
+};
+
+/// Columns filled from the same bank; the bank is looked up once per event.
+struct BankColumns {
+  std::string fBank;
+  std::vector<Column*> fColumns;
+};
+
+static const int kIOBufferSize = 1024*1024;
+
+/// Size of the MIDAS TID_xxx bank types, as in TMidasEvent.cxx.
+static const int kTidSize[] = {0, 1, 1, 1, 2, 2, 4, 4, 4, 4, 8, 1, 0, 0, 0, 0, 0, 8, 8};
+
+/// Bank length in bytes from the FindBank() length and type.
+static int BankBytes(int bklen, int bktype)
+{
+  int t = bktype & 0xFF;
+  if (t >= (int)(sizeof(kTidSize)/sizeof(kTidSize[0])) || kTidSize[t] == 0)
+    return bklen;
+  return bklen*kTidSize[t];
+}
+
+class Analyzer: public TRootanaEventLoop {
+
+public:
+
+  std::string fSchemaFile;
+  std::string fPrefix;
+  bool fColumnar;
+  int fCompression;
+
+  std::vector<Column*> fColumns;
+  std::vector<BankColumns> fBanks;
+
+  // Per-event header columns
+  uint32_t fSerialNumber;
+  uint32_t fTimeStamp;
+  uint16_t fEventId;
+  uint16_t fTriggerMask;
+
+  TTree* fTree;
+  std::string fDir;
+  std::vector<FILE*> fHeaderFiles;
+  uint64_t fNumEvents;
+
+  Analyzer() {
+    UseBatchMode();
+    fPrefix = "output";
+    fColumnar = false;
+    fCompression = -1;
+    fTree = NULL;
+    fNumEvents = 0;
+  };
+
+  virtual ~Analyzer() {
+    for (unsigned i=0; i<fColumns.size(); i++)
+      delete fColumns[i];
+  };
+
+  void Usage(void){
+    printf("\t-s<file>: schema file describing the columns (required)\n");
+    printf("\t-c: write columnar binary files instead of a ROOT tree\n");
+    printf("\t-o<prefix>: output file name prefix (default \"output\")\n");
+    printf("\t-z<level>: ROOT file compression level\n");
+  }
+
+  bool CheckOption(std::string option){
+    const char* arg = option.c_str();
+    if (strncmp(arg,"-s",2)==0) {
+      fSchemaFile = arg+2;
+      return true;
+    } else if (strcmp(arg,"-c")==0) {
+      fColumnar = true;
+      return true;
+    } else if (strncmp(arg,"-o",2)==0) {
+      fPrefix = arg+2;
+      SetOutputFilename(fPrefix);
+      return true;
+    } else if (strncmp(arg,"-z",2)==0) {
+      fCompression = atoi(arg+2);
+      return true;
+    }
+    return false;
+  }
+
+  void Initialize(){
+    if (fSchemaFile.empty()) {
+      fprintf(stderr,"midas2columns: no schema file, use -s<file>\n");
+      exit(1);
+    }
+    if (!ReadSchema(fSchemaFile.c_str()))
+      exit(1);
+    if (fColumnar)
+      DisableRootOutput(true);
+  }
+
+  /// Parse the schema file, returns false on error.
+  bool ReadSchema(const char* filename){
+    FILE* fp = fopen(filename, "r");
+    if (!fp) {
+      fprintf(stderr,"midas2columns: cannot open schema file \"%s\", errno %d (%s)\n", filename, errno, strerror(errno));
+      return false;
+    }
+
+    int lineno = 0;
+    char line[1024];
+    while (fgets(line, sizeof(line), fp)) {
+      lineno++;
+      char* s = strchr(line, '#');
+      if (s)
+        *s = 0;
+
+      char* save = NULL;
+      const char* w[7];
+      int nw = 0;
+      for (char* t = strtok_r(line, " \t\r\n", &save); t && nw < 7; t = strtok_r(NULL, " \t\r\n", &save))
+        w[nw++] = t;
+
+      if (nw == 0)
+        continue;
+
+      if (strcmp(w[0], "event") == 0 && nw == 2) {
+        ProcessThisEventID(strtol(w[1], NULL, 0));
+        continue;
+      }
+
+      if (strcmp(w[0], "column") != 0 || nw < 5 || strlen(w[2]) != 4) {
+        fprintf(stderr,"midas2columns: %s:%d: cannot parse schema line\n", filename, lineno);
+        fclose(fp);
+        return false;
+      }
+
+      Column* c = new Column;
+      c->fName = w[1];
+      c->fBank = w[2];
+      c->fDecoder = FindDecoder(w[3]);
+      if (c->fDecoder >= 0)
+        c->fType = FindType(gDecoders[c->fDecoder].fType);
+      else
+        c->fType = FindType(w[3]);
+      if (strcmp(w[4], "*") != 0)
+        c->fCount = atoi(w[4]);
+      if (nw > 5)
+        c->fFirst = atoi(w[5]);
+      if (nw > 6)
+        c->fStride = atoi(w[6]);
+
+      if (c->fType < 0 || (c->fCount <= 0 && strcmp(w[4], "*") != 0) || c->fFirst < 0 || c->fStride < 1 || (c->fDecoder >= 0 && c->fCount == 0)) {
+        fprintf(stderr,"midas2columns: %s:%d: invalid column \"%s\"\n", filename, lineno, w[1]);
+        delete c;
+        fclose(fp);
+        return false;
+      }
+
+      c->fValues.resize(c->fCount ? c->fCount*c->Size() : 1024*c->Size());
+      fColumns.push_back(c);
+
+      unsigned i;
+      for (i=0; i<fBanks.size(); i++)
+        if (fBanks[i].fBank == c->fBank)
+          break;
+      if (i == fBanks.size()) {
+        fBanks.push_back(BankColumns());
+        fBanks.back().fBank = c->fBank;
+      }
+      fBanks[i].fColumns.push_back(c);
+    }
+
+    fclose(fp);
+
+    if (fColumns.empty()) {
+      fprintf(stderr,"midas2columns: no columns in schema file \"%s\"\n", filename);
+      return false;
+    }
+
+    printf("midas2columns: %d columns from %d banks\n", (int)fColumns.size(), (int)fBanks.size());
+    return true;
+  }
+
+  /// Basket size holding a few thousand entries of the column, so baskets
+  /// are neither tiny nor much bigger than the auto flush cluster.
+  static int BasketSize(int entrysize){
+    int size = entrysize*4096;
+    if (size < 32*1024)
+      size = 32*1024;
+    if (size > 4*1024*1024)
+      size = 4*1024*1024;
+    return size;
+  }
+
+  void BeginRun(int transition,int run,int time){
+    fNumEvents = 0;
+    if (fColumnar)
+      OpenColumnFiles(run);
+    else
+      CreateTree();
+  }
+
+  void CreateTree(){
+    if (fCompression >= 0 && gDirectory->GetFile())
+      gDirectory->GetFile()->SetCompressionLevel(fCompression);
+
+    // One branch per column, so the tree is fully split by construction.
+    fTree = new TTree("midas_data","MIDAS data");
+    fTree->SetAutoFlush(-32*1024*1024);
+    fTree->SetAutoSave(-1024*1024*1024);
+
+    fTree->Branch("serialnumber",&fSerialNumber,"serialnumber/i");
+    fTree->Branch("timestamp",&fTimeStamp,"timestamp/i");
+    fTree->Branch("eventid",&fEventId,"eventid/s");
+    fTree->Branch("triggermask",&fTriggerMask,"triggermask/s");
+
+    for (unsigned i=0; i<fColumns.size(); i++) {
+      Column* c = fColumns[i];
+      char leaf = gTypes[c->fType].fLeaf;
+      std::string leaflist;
+      if (c->fCount > 0) {
+        char buf[256];
+        sprintf(buf, "[%d]/%c", c->fCount, leaf);
+        leaflist = c->fName + buf;
+      } else {
+        std::string counter = c->fName + "_n";
+        fTree->Branch(counter.c_str(), &c->fN, (counter + "/I").c_str());
+        leaflist = c->fName + "[" + counter + "]/" + leaf;
+      }
+      c->fBranch = fTree->Branch(c->fName.c_str(), c->Values(), leaflist.c_str(), BasketSize(c->fValues.size()));
+    }
+  }
+
+  FILE* OpenColumnFile(const std::string& name){
+    std::string filename = fDir + "/" + name;
+    FILE* fp = fopen(filename.c_str(), "w");
+    if (!fp) {
+      fprintf(stderr,"midas2columns: cannot write \"%s\", errno %d (%s)\n", filename.c_str(), errno, strerror(errno));
+      exit(1);
+    }
+    setvbuf(fp, NULL, _IOFBF, kIOBufferSize);
+    return fp;
+  }
+
+  void OpenColumnFiles(int run){
+    CloseColumnFiles();
+
+    char buf[256];
+    sprintf(buf, "%08d.cols", run);
+    fDir = fPrefix + buf;
+    if (mkdir(fDir.c_str(), 0777) != 0 && errno != EEXIST) {
+      fprintf(stderr,"midas2columns: cannot create directory \"%s\", errno %d (%s)\n", fDir.c_str(), errno, strerror(errno));
+      exit(1);
+    }
+    printf("midas2columns: writing columns to %s\n", fDir.c_str());
+
+    fHeaderFiles.push_back(OpenColumnFile("serialnumber.dat"));
+    fHeaderFiles.push_back(OpenColumnFile("timestamp.dat"));
+    fHeaderFiles.push_back(OpenColumnFile("eventid.dat"));
+    fHeaderFiles.push_back(OpenColumnFile("triggermask.dat"));
+
+    for (unsigned i=0; i<fColumns.size(); i++) {
+      Column* c = fColumns[i];
+      c->fTotal = 0;
+      c->fData = OpenColumnFile(c->fName + ".dat");
+      if (c->fCount == 0) {
+        c->fIndex = OpenColumnFile(c->fName + ".idx");
+        fwrite(&c->fTotal, sizeof(c->fTotal), 1, c->fIndex);
+      }
+    }
+  }
+
+  void CloseColumnFiles(){
+    if (fDir.empty())
+      return;
+
+    for (unsigned i=0; i<fHeaderFiles.size(); i++)
+      fclose(fHeaderFiles[i]);
+    fHeaderFiles.clear();
+
+    FILE* fp = OpenColumnFile("columns.txt");
+    fprintf(fp, "# midas2columns: column type count (0 for variable length)\n");
+    fprintf(fp, "events %llu\n", (unsigned long long)fNumEvents);
+    fprintf(fp, "column serialnumber u32 1\n");
+    fprintf(fp, "column timestamp u32 1\n");
+    fprintf(fp, "column eventid u16 1\n");
+    fprintf(fp, "column triggermask u16 1\n");
+    for (unsigned i=0; i<fColumns.size(); i++) {
+      Column* c = fColumns[i];
+      fprintf(fp, "column %s %s %d\n", c->fName.c_str(), gTypes[c->fType].fName, c->fCount);
+      fclose(c->fData);
+      c->fData = NULL;
+      if (c->fIndex) {
+        fclose(c->fIndex);
+        c->fIndex = NULL;
+      }
+    }
+    fclose(fp);
+
+    printf("midas2columns: wrote %llu events to %s\n", (unsigned long long)fNumEvents, fDir.c_str());
+    fDir.clear();
+  }
+
+  void EndRun(int transition,int run,int time){
+    if (fColumnar)
+      CloseColumnFiles();
+    else if (fTree)
+      printf("midas2columns: wrote %llu events to tree %s\n", (unsigned long long)fNumEvents, fTree->GetName());
+    fTree = NULL; // owned and written by the output file
+  }
+
+  /// Copy every stride'th value starting at first from a bank of the same type.
+  static int CopyValues(const char* src, int bklen, int size, int first, int stride, char* dst, int maxn){
+    int n = 0;
+    if (stride == 1) {
+      n = bklen - first;
+      if (n > maxn)
+        n = maxn;
+      if (n > 0)
+        memcpy(dst, src + first*size, n*size);
+      return n < 0 ? 0 : n;
+    }
+    for (int i=first; i<bklen && n<maxn; i+=stride, n++)
+      memcpy(dst + n*size, src + i*size, size);
+    return n;
+  }
+
+  void FillColumn(Column* c, const char* pdata, int bklen){
+    int size = c->Size();
+    if (c->fCount == 0) {
+      int maxn = (bklen - c->fFirst + c->fStride - 1)/c->fStride;
+      if (maxn*size > (int)c->fValues.size()) {
+        c->fValues.resize(maxn*size);
+        if (c->fBranch)
+          c->fBranch->SetAddress(c->Values());
+      }
+    }
+    int maxn = c->fCount ? c->fCount : c->fValues.size()/size;
+    if (c->fDecoder >= 0)
+      c->fN = gDecoders[c->fDecoder].fDecode(pdata, bklen, c->Values(), maxn);
+    else
+      c->fN = CopyValues(pdata, bklen, size, c->fFirst, c->fStride, c->Values(), maxn);
+  }
+
+  void WriteColumn(Column* c){
+    if (c->fCount > 0) {
+      fwrite(c->Values(), c->Size(), c->fCount, c->fData);
+      c->fTotal += c->fCount;
+    } else {
+      if (c->fN > 0)
+        fwrite(c->Values(), c->Size(), c->fN, c->fData);
+      c->fTotal += c->fN;
+      fwrite(&c->fTotal, sizeof(c->fTotal), 1, c->fIndex);
+    }
+  }
+
+  bool ProcessMidasEvent(TDataContainer& dataContainer){
+
+    if (!fTree && fDir.empty()) // no begin of run event
+      return true;
+
+    TMidasEvent& event = dataContainer.GetMidasEvent();
+    fSerialNumber = event.GetSerialNumber();
+    fTimeStamp = event.GetTimeStamp();
+    fEventId = event.GetEventId();
+    fTriggerMask = event.GetTriggerMask();
+
+    for (unsigned i=0; i<fBanks.size(); i++) {
+      BankColumns& b = fBanks[i];
+      int bklen = 0;
+      int bktype = 0;
+      void* pdata = NULL;
+      int found = event.FindBank(b.fBank.c_str(), &bklen, &bktype, &pdata);
+      for (unsigned j=0; j<b.fColumns.size(); j++) {
+        Column* c = b.fColumns[j];
+        if (c->fCount > 0)
+          memset(c->Values(), 0, c->fValues.size());
+        if (found && pdata)
+          FillColumn(c, (const char*)pdata, BankBytes(bklen, bktype)/c->Size());
+        else
+          c->fN = 0;
+      }
+    }
+
+    if (fTree) {
+      fTree->Fill();
+    } else {
+      fwrite(&fSerialNumber, sizeof(fSerialNumber), 1, fHeaderFiles[0]);
+      fwrite(&fTimeStamp, sizeof(fTimeStamp), 1, fHeaderFiles[1]);
+      fwrite(&fEventId, sizeof(fEventId), 1, fHeaderFiles[2]);
+      fwrite(&fTriggerMask, sizeof(fTriggerMask), 1, fHeaderFiles[3]);
+      for (unsigned i=0; i<fColumns.size(); i++)
+        WriteColumn(fColumns[i]);
+    }
+
+    fNumEvents++;
+    return true;
+  };
+
+};
+
+
+int main(int argc, char *argv[])
+{
+
+  Analyzer::CreateSingleton<Analyzer>();
+  return Analyzer::Get().ExecuteLoop(argc, argv);
+
+}
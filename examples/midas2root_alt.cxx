@@ -73,10 +73,7 @@ public:
     // This particular bank is 18 floats, which pairs of float as current and voltage readings.
     TGenericData *data = dataContainer.GetEventData<TGenericData>("BRV1");
     if(data){
-      std::cout << "Found BRV1 bank" << std::endl;
-      std::cout << "Bank size: " << data->GetSize() << std::endl;
-      for(int i = 0; i < data->GetSize() ; i++){
-	std::cout << "Data["<<i<<"] is " << data->GetFloat()[i] << std::endl;
+      for(int i = 0; i < data->GetSize() && i < 18; i++){
 	int index = i/2;
 	if(i%2==0){
 	  current_readings[index] = data->GetFloat()[i];
@@ -0,0 +1,235 @@
+#include "TCoincidenceFinder.hxx"
+
+#include <stdio.h>
+#include <algorithm>
+#include <queue>
+#include <functional>
+#include <limits>
+
+static bool HitTimeLess(const TTimedHit& a, const TTimedHit& b)
+{
+  return a.fTime < b.fTime;
+}
+
+TCoincidenceFinder::TCoincidenceFinder()
+{
+  fWindow = 100.0;
+  fMinSources = 2;
+  fMaxDelay = 1e9;
+  fMergedTime = -std::numeric_limits<double>::infinity();
+  fTotalCoincidences = 0;
+}
+
+int TCoincidenceFinder::AddSource(std::string name, int tag_bits, double ns_per_tick, double offset_ns)
+{
+  Source s;
+  s.fName = name;
+  s.fBits = tag_bits;
+  s.fNsPerTick = ns_per_tick;
+  s.fOffset = offset_ns;
+  s.fLastTag = 0;
+  s.fWraps = 0;
+  s.fHaveTag = false;
+  s.fLastTime = -std::numeric_limits<double>::infinity();
+  s.fNext = 0;
+  s.fUnsorted = false;
+  s.fBehind = false;
+  s.fTotalHits = 0;
+  s.fLateHits = 0;
+  fSources.push_back(s);
+  return fSources.size() - 1;
+}
+
+void TCoincidenceFinder::AddHit(int source, uint64_t tag, int channel, double value, double fine_ns)
+{
+  Source& s = fSources[source];
+
+  double ticks = tag;
+  if (s.fBits > 0 && s.fBits < 64) {
+    uint64_t range = ((uint64_t)1) << s.fBits;
+    tag &= range - 1;
+    // a big step backwards is a rollover, a small one is a hit out of order
+    if (s.fHaveTag && tag < s.fLastTag && s.fLastTag - tag > range/2)
+      s.fWraps++;
+    else if (s.fHaveTag && tag > s.fLastTag && tag - s.fLastTag > range/2 && s.fWraps > 0)
+      s.fWraps--;  // late hit from before the last rollover
+    s.fLastTag = tag;
+    s.fHaveTag = true;
+    ticks = (double)s.fWraps*(double)range + (double)tag;
+  }
+
+  AddHitNs(source, ticks*s.fNsPerTick + fine_ns, channel, value);
+}
+
+void TCoincidenceFinder::AddHitNs(int source, double time_ns, int channel, double value)
+{
+  Source& s = fSources[source];
+
+  TTimedHit hit;
+  hit.fTime = time_ns + s.fOffset;
+  hit.fSource = source;
+  hit.fChannel = channel;
+  hit.fValue = value;
+
+  // too late, the merged stream has moved past it
+  if (hit.fTime < fMergedTime) {
+    s.fLateHits++;
+    return;
+  }
+
+  if (hit.fTime < s.fLastTime)
+    s.fUnsorted = true;
+  else
+    s.fLastTime = hit.fTime;
+
+  s.fHits.push_back(hit);
+  s.fTotalHits++;
+}
+
+int TCoincidenceFinder::Process(bool flush)
+{
+  // all sources have reached this time, no earlier hit can come, except
+  // from sources too far behind to wait for
+  double horizon = std::numeric_limits<double>::infinity();
+  if (!flush) {
+    double newest = -std::numeric_limits<double>::infinity();
+    for (unsigned i=0; i<fSources.size(); i++)
+      newest = std::max(newest, fSources[i].fLastTime);
+    double oldest = newest - fMaxDelay;
+
+    for (unsigned i=0; i<fSources.size(); i++) {
+      Source& s = fSources[i];
+      bool behind = s.fLastTime < oldest;
+      if (behind && !s.fBehind)
+        printf("TCoincidenceFinder: source %s has no hits for more than %.0f ns, not waiting for it\n",
+               s.fName.c_str(), fMaxDelay);
+      s.fBehind = behind;
+      horizon = std::min(horizon, behind ? oldest : s.fLastTime);
+    }
+  }
+
+  // k-way merge of the sources, after the hits carried over from last time
+  fMerged.swap(fCarry);
+  fCarry.clear();
+
+  typedef std::pair<double,int> HeapEntry;
+  std::priority_queue<HeapEntry, std::vector<HeapEntry>, std::greater<HeapEntry> > heap;
+  for (unsigned i=0; i<fSources.size(); i++) {
+    Source& s = fSources[i];
+    if (s.fUnsorted) {
+      std::stable_sort(s.fHits.begin() + s.fNext, s.fHits.end(), HitTimeLess);
+      s.fUnsorted = false;
+    }
+    if (s.fNext < s.fHits.size() && s.fHits[s.fNext].fTime <= horizon)
+      heap.push(HeapEntry(s.fHits[s.fNext].fTime, i));
+  }
+
+  while (!heap.empty()) {
+    Source& s = fSources[heap.top().second];
+    heap.pop();
+    fMerged.push_back(s.fHits[s.fNext++]);
+    if (s.fNext < s.fHits.size() && s.fHits[s.fNext].fTime <= horizon)
+      heap.push(HeapEntry(s.fHits[s.fNext].fTime, fMerged.back().fSource));
+  }
+
+  for (unsigned i=0; i<fSources.size(); i++) {
+    Source& s = fSources[i];
+    s.fHits.erase(s.fHits.begin(), s.fHits.begin() + s.fNext);
+    s.fNext = 0;
+  }
+
+  if (!fMerged.empty())
+    fMergedTime = fMerged.back().fTime;
+
+  // sliding window: the hits within fWindow of the first one, counting
+  // the hits of each source in it
+  fCoincidenceHits.clear();
+  fCoincidenceStart.clear();
+  fSourceCount.assign(fSources.size(), 0);
+
+  unsigned n = fMerged.size();
+  unsigned left = 0;
+  unsigned right = 0;
+  int sources = 0;
+  while (left < n) {
+
+    // the window must be complete before we decide
+    if (!flush && fMerged[left].fTime + fWindow >= horizon)
+      break;
+
+    while (right < n && fMerged[right].fTime - fMerged[left].fTime <= fWindow) {
+      if (fSourceCount[fMerged[right].fSource]++ == 0)
+        sources++;
+      right++;
+    }
+
+    if (sources >= fMinSources) {
+      fCoincidenceStart.push_back(fCoincidenceHits.size());
+      for (unsigned i=left; i<right; i++) {
+        fCoincidenceHits.push_back(fMerged[i]);
+        fSourceCount[fMerged[i].fSource]--;
+      }
+      sources = 0;
+      left = right;
+    } else {
+      if (--fSourceCount[fMerged[left].fSource] == 0)
+        sources--;
+      left++;
+    }
+  }
+
+  // the rest waits for more hits
+  fCarry.assign(fMerged.begin() + left, fMerged.end());
+  fMerged.resize(left);
+
+  fTotalCoincidences += fCoincidenceStart.size();
+  return fCoincidenceStart.size();
+}
+
+double TCoincidenceFinder::GetLateHits() const
+{
+  double late = 0;
+  for (unsigned i=0; i<fSources.size(); i++)
+    late += fSources[i].fLateHits;
+  return late;
+}
+
+int TCoincidenceFinder::GetCoincidenceSize(int i) const
+{
+  int end = (i + 1 < (int)fCoincidenceStart.size()) ? fCoincidenceStart[i+1] : fCoincidenceHits.size();
+  return end - fCoincidenceStart[i];
+}
+
+void TCoincidenceFinder::Reset()
+{
+  for (unsigned i=0; i<fSources.size(); i++) {
+    Source& s = fSources[i];
+    s.fLastTag = 0;
+    s.fWraps = 0;
+    s.fHaveTag = false;
+    s.fLastTime = -std::numeric_limits<double>::infinity();
+    s.fHits.clear();
+    s.fNext = 0;
+    s.fUnsorted = false;
+    s.fBehind = false;
+    s.fTotalHits = 0;
+    s.fLateHits = 0;
+  }
+  fMergedTime = -std::numeric_limits<double>::infinity();
+  fMerged.clear();
+  fCarry.clear();
+  fCoincidenceHits.clear();
+  fCoincidenceStart.clear();
+  fTotalCoincidences = 0;
+}
+
+void TCoincidenceFinder::Print() const
+{
+  printf("TCoincidenceFinder: window %.1f ns, at least %d sources, %.0f coincidences, %.0f late hits dropped\n",
+         fWindow, fMinSources, fTotalCoincidences, GetLateHits());
+  for (unsigned i=0; i<fSources.size(); i++) {
+    const Source& s = fSources[i];
+    printf("  source %d %s: %d bits, %g ns per tick, offset %g ns, %.0f hits, %.0f late, %.0f rollovers\n",
+           i, s.fName.c_str(), s.fBits, s.fNsPerTick, s.fOffset, s.fTotalHits, s.fLateHits, (double)s.fWraps);
+  }
+}
@@ -0,0 +1,132 @@
+#ifndef TCoincidenceFinder_hxx_seen
+#define TCoincidenceFinder_hxx_seen
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+
+/// One hit on the common time axis of TCoincidenceFinder.
+struct TTimedHit {
+  double fTime;     ///< ns
+  int    fSource;   ///< index returned by TCoincidenceFinder::AddSource()
+  int    fChannel;
+  double fValue;    ///< charge, amplitude, width... as given by the user
+};
+
+/// Merge the hits of several boards into one time ordered stream
+/// and find the coincidences between boards.
+///
+/// Each board (source) has its own time counter: a number of bits that
+/// rolls over and a clock period.  Hits are added with the raw counter
+/// value; rollovers are unwrapped and the time converted to ns on the
+/// common time axis, with an offset per source for cable delays and clock
+/// alignment.  For instance:
+///
+///   V1720 GetTriggerTag(), V1730 GetTriggerTimeTag(): 31 bits, 8 ns
+///   V1190 GetExtendedTriggerTimeTag(): 27 bits, 800 ns
+///   TRB3: GetEpochCounter() with 28 bits, 10240.026 ns, and
+///         GetSemiFinalTime()/1000 as the time within the epoch
+///
+/// Hits of one source are expected in time order, as they are read out
+/// (they are sorted if not).  The sources are merged with a k-way merge
+/// and the coincidences found with a sliding window over the merged
+/// stream, so the cost grows like the number of hits, not its square.
+///
+/// Process() only handles the hits up to the time that all sources have
+/// reached, so a coincidence is never split by data still to come; the
+/// later hits wait for the next call.  A source that has no hits for more
+/// than SetMaxDelay() behind the newest hit stops holding the others back,
+/// with a warning, so the hits waiting for it stay bounded.  Call
+/// Process(true) at the end of the run (or after each event, if each event
+/// holds all the hits of one trigger) to handle everything.
+///
+/// A hit older than hits already merged would break the time order of the
+/// merged stream: it is dropped and counted, see GetLateHits().
+class TCoincidenceFinder {
+
+public:
+
+  TCoincidenceFinder();
+
+  /// Add a source; returns its index for AddHit().
+  /// tag_bits = 0 for a counter that does not roll over.
+  int AddSource(std::string name, int tag_bits, double ns_per_tick, double offset_ns = 0);
+
+  /// Add a hit with the counter value of its source, plus a time in ns
+  /// within the tick (fine time) if the source has one.
+  void AddHit(int source, uint64_t tag, int channel = 0, double value = 0, double fine_ns = 0);
+
+  /// Add a hit with a time already in ns (no rollover, no clock conversion; the offset is added)
+  void AddHitNs(int source, double time_ns, int channel = 0, double value = 0);
+
+  /// Hits within window_ns of the first hit of a group are one coincidence (default 100 ns)
+  void SetWindow(double window_ns){ fWindow = window_ns; }
+
+  /// Minimum number of different sources in a coincidence (default 2)
+  void SetMinSources(int n){ fMinSources = n; }
+
+  /// How far, in ns, a source without hits can be behind the newest hit of
+  /// all sources before Process() stops waiting for it (default 1 s)
+  void SetMaxDelay(double delay_ns){ fMaxDelay = delay_ns; }
+
+  /// Merge the hits and find the coincidences; see the class description.
+  /// Returns the number of coincidences found.
+  int Process(bool flush = false);
+
+  /// Hits handled by the last Process(), in time order
+  const std::vector<TTimedHit>& GetMergedHits() const { return fMerged; }
+
+  /// Coincidences found by the last Process()
+  int GetNCoincidences() const { return (int)fCoincidenceStart.size(); }
+
+  /// Hits dropped because they were older than hits already merged
+  double GetLateHits() const;
+
+  /// Number of hits in coincidence i
+  int GetCoincidenceSize(int i) const;
+
+  /// Hit j of coincidence i
+  const TTimedHit& GetCoincidenceHit(int i, int j) const { return fCoincidenceHits[fCoincidenceStart[i] + j]; }
+
+  /// Forget all hits and counter rollovers, for instance at begin of run
+  void Reset();
+
+  /// Print the sources and the number of hits and coincidences so far
+  void Print() const;
+
+private:
+
+  struct Source {
+    std::string fName;
+    int      fBits;
+    double   fNsPerTick;
+    double   fOffset;
+    uint64_t fLastTag;
+    uint64_t fWraps;     ///< rollovers so far
+    bool     fHaveTag;
+    double   fLastTime;  ///< time of the last hit, ns
+    std::vector<TTimedHit> fHits;  ///< hits not merged yet
+    unsigned fNext;      ///< next hit of fHits to merge
+    bool     fUnsorted;  ///< a hit was added out of time order
+    bool     fBehind;    ///< more than fMaxDelay behind, not waited for
+    double   fTotalHits;
+    double   fLateHits;  ///< hits dropped, older than fMergedTime
+  };
+
+  std::vector<Source> fSources;
+
+  double fWindow;
+  int    fMinSources;
+  double fMaxDelay;
+  double fMergedTime;  ///< time of the last merged hit, no hit can be added before it
+
+  std::vector<TTimedHit> fMerged;
+  std::vector<TTimedHit> fCarry;   ///< merged hits that can still start a coincidence
+  std::vector<TTimedHit> fCoincidenceHits;
+  std::vector<int> fCoincidenceStart;
+  std::vector<int> fSourceCount;   ///< hits per source in the sliding window
+
+  double fTotalCoincidences;
+};
+
+#endif
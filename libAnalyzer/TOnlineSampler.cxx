@@ -0,0 +1,146 @@
+#include "TOnlineSampler.hxx"
+#include "TPeriodicClass.hxx"
+
+#include <stdio.h>
+
+TOnlineSampler::TOnlineSampler(double cpu_budget, double max_lag_sec)
+{
+  fBudget = cpu_budget;
+  fMaxLag = max_lag_sec;
+  fAccept = 1.0;
+  Reset();
+}
+
+void TOnlineSampler::SetWeight(int eventId, double weight)
+{
+  fWeights[eventId & 0xFFFF] = weight;
+}
+
+void TOnlineSampler::Reset()
+{
+  fCredit.clear();
+  fWindowStart = GetTimeSec();
+  fWindowOffered = 0;
+  fWindowAccepted = 0;
+  fWindowBusy = 0;
+  fWindowLag = 0;
+  fLastPrint = fWindowStart;
+  fBusy = 0;
+  fLag = 0;
+  fMinLag = 1e9;
+  fOffered = 0;
+  fAccepted = 0;
+  fIdOffered.clear();
+  fIdAccepted.clear();
+}
+
+double TOnlineSampler::GetPrescale(int eventId) const
+{
+  int id = eventId & 0xFFFF;
+  std::map<int,double>::const_iterator o = fIdOffered.find(id);
+  std::map<int,double>::const_iterator a = fIdAccepted.find(id);
+  if (o == fIdOffered.end() || a == fIdAccepted.end() || a->second == 0)
+    return 1.0;
+  return o->second/a->second;
+}
+
+double TOnlineSampler::GetPrescale() const
+{
+  if (fAccepted == 0)
+    return 1.0;
+  return fOffered/fAccepted;
+}
+
+void TOnlineSampler::Update(double now)
+{
+  double dt = now - fWindowStart;
+
+  fBusy = fWindowBusy/dt;
+  fLag = fWindowLag;
+
+  // scale the acceptance by how far we are from the budget,
+  // but do not jump by more than a factor 2 up or 4 down at a time
+  double ratio = 2.0;
+  if (fBusy > 0)
+    ratio = fBudget/fBusy;
+  if (ratio > 2.0)
+    ratio = 2.0;
+  if (ratio < 0.25)
+    ratio = 0.25;
+
+  // falling behind: drop more until we catch up
+  if (fMaxLag > 0 && fLag > fMaxLag && ratio > 0.5)
+    ratio = 0.5;
+
+  fAccept *= ratio;
+  if (fAccept > 1.0)
+    fAccept = 1.0;
+  if (fAccept < 1e-4)
+    fAccept = 1e-4;
+
+  fWindowStart = now;
+  fWindowOffered = 0;
+  fWindowAccepted = 0;
+  fWindowBusy = 0;
+  fWindowLag = 0;
+
+  if (now - fLastPrint > 10.0) {
+    Print();
+    fLastPrint = now;
+  }
+}
+
+bool TOnlineSampler::Accept(int eventId, uint32_t timestamp)
+{
+  double now = GetTimeSec();
+
+  if (now - fWindowStart > 0.5 && fWindowOffered > 0)
+    Update(now);
+
+  // measure the lag relative to the freshest event seen,
+  // the clocks of the frontends and of this computer may differ
+  double lag = now - timestamp;
+  if (lag < fMinLag)
+    fMinLag = lag;
+  lag -= fMinLag;
+  if (lag > fWindowLag)
+    fWindowLag = lag;
+
+  fWindowOffered++;
+  fOffered++;
+
+  int id = eventId & 0xFFFF;
+  fIdOffered[id]++;
+  double p = fAccept;
+  if (!fWeights.empty()) {
+    std::map<int,double>::const_iterator w = fWeights.find(id);
+    if (w != fWeights.end())
+      p *= w->second;
+  }
+  if (p >= 1.0)
+    p = 1.0;
+
+  double& credit = fCredit[id];
+  credit += p;
+  if (credit < 1.0)
+    return false;
+
+  credit -= 1.0;
+  fWindowAccepted++;
+  fAccepted++;
+  fIdAccepted[id]++;
+  return true;
+}
+
+void TOnlineSampler::Print() const
+{
+  printf("Online sampling: processing %.1f%% of events (prescale %.2f since begin of run), analysis busy %.0f%% (budget %.0f%%), lag %.1f sec\n",
+         100.0*fAccept, GetPrescale(), 100.0*fBusy, 100.0*fBudget, fLag);
+
+  if (fWeights.empty())
+    return;
+
+  std::map<int,double>::const_iterator it = fIdOffered.begin();
+  for (; it != fIdOffered.end(); it++)
+    printf("  event ID %d: prescale %.2f\n", it->first, GetPrescale(it->first));
+}
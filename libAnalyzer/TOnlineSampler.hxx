@@ -0,0 +1,84 @@
+#ifndef TOnlineSampler_hxx_seen
+#define TOnlineSampler_hxx_seen
+
+#include <map>
+#include <stdint.h>
+
+/// Adaptive prescaler for the online analysis.
+///
+/// Decides for each event arriving from MIDAS whether to process it, so that
+/// the time spent processing events stays within a fraction (the CPU budget)
+/// of the wall-clock time and the processed events are not older than
+/// the maximum lag. The acceptance is adjusted every half second from the
+/// measured processing time.
+///
+/// Accepted events are spread evenly over the incoming events (the fractional
+/// acceptance is carried over from event to event) instead of coming in bursts,
+/// and do not depend on the event contents, so histograms stay unbiased;
+/// scale them by GetPrescale(eventId) to get the full rate.
+///
+/// Event IDs can be given a weight: an event ID with weight 10 is accepted
+/// 10 times more often than one with weight 1 (up to all of them), so each
+/// event ID has its own prescale.
+class TOnlineSampler {
+
+public:
+
+  TOnlineSampler(double cpu_budget, double max_lag_sec);
+
+  /// Relative acceptance weight for an event ID (default 1)
+  void SetWeight(int eventId, double weight);
+
+  /// Should we process this event?
+  bool Accept(int eventId, uint32_t timestamp);
+
+  /// Time spent processing an accepted event
+  void Processed(double seconds) { fWindowBusy += seconds; }
+
+  /// Current fraction of events accepted (before weights)
+  double GetAcceptance() const { return fAccept; }
+
+  /// Effective prescale of an event ID since the last Reset(): events offered / events accepted.
+  /// Use it to scale the histograms filled from events of this ID.
+  double GetPrescale(int eventId) const;
+
+  /// Same over all event IDs; only the scale of each event ID if no weights are set
+  double GetPrescale() const;
+
+  /// Clear the counters, for instance at begin of run
+  void Reset();
+
+  /// Print the acceptance, prescale and processing time
+  void Print() const;
+
+private:
+
+  /// Adjust the acceptance from the last measurement window
+  void Update(double now);
+
+  double fBudget;      ///< allowed fraction of wall-clock time in ProcessMidasEvent()
+  double fMaxLag;      ///< maximum age of processed events, seconds, 0 = no limit
+  double fAccept;      ///< fraction of events to accept
+
+  std::map<int,double> fWeights;  ///< per event ID weight
+  std::map<int,double> fCredit;   ///< per event ID fractional acceptance carried over
+
+  double fWindowStart;
+  int    fWindowOffered;
+  int    fWindowAccepted;
+  double fWindowBusy;
+  double fWindowLag;
+
+  double fLastPrint;
+  double fBusy;        ///< busy fraction in the last window
+  double fLag;         ///< largest lag in the last window
+  double fMinLag;      ///< smallest lag seen, clock offset between frontends and us
+
+  double fOffered;
+  double fAccepted;
+
+  std::map<int,double> fIdOffered;   ///< per event ID events offered since Reset()
+  std::map<int,double> fIdAccepted;  ///< per event ID events accepted since Reset()
+};
+
+#endif
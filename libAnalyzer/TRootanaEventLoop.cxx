@@ -5,6 +5,7 @@
 #ifdef HAVE_MIDAS
 #include "TMidasOnline.h"
 #endif
+#include "TMidasReplay.h"
 //#ifdef HAVE_ROOT_XML
 //#include "XmlOdb.h"
 //#endif
@@ -13,23 +14,37 @@
 #endif
 #ifdef HAVE_LIBNETDIRECTORY
 #include "netDirectoryServer.h"
+#include "RootLock.h"
 #endif
 #ifdef HAVE_THTTP_SERVER
 #include "THttpServer.h"
 #endif
 #include "TPeriodicClass.hxx"
+#include "TShardedHistogram.hxx"
 #include "MainWindow.hxx"
 
 // ROOT includes.
 #include <TSystem.h>
 #include <TROOT.h>
 #include <TH1D.h>
+#include <TThread.h>
+#include <TParameter.h>
+#include <RVersion.h>
 
 #include <stdio.h>
 #include <sys/time.h>
 #include <iostream>
 #include <assert.h>
 #include <signal.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <deque>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 
 #include "midasio.h"
 
@@ -42,6 +57,9 @@ int raTotalEventsSkippedForAge = 0;
 // Use only recent data (less than 1 second old) when processing online
 bool gUseOnlyRecent;
 
+// Wait for the histogram checkpoint being written, see SaveCheckpoint()
+static void WaitCheckpoint();
+
 void PrintCurrentStats(){
 
   if((raTotalEventsProcessed%5000)==0){
@@ -99,11 +117,19 @@ TRootanaEventLoop::TRootanaEventLoop (){
   fODB = 0;
   fOnlineHistDir = 0;
   fMaxEvents = 0;
+  fCurrentEventIndex = 0;
   fCurrentRunNumber = 0;
   fIsOffline = true;
 
   fCreateMainWindow = true;
   fUseBatchMode = false;
+  fNetDirectorySnapshotPeriod = 0;
+  fAsyncRootOutput = false;
+  fCheckpointPeriod = 0;
+  fSampler = NULL;
+  fReplay = false;
+  fReplayRate = 0;
+  fReplaySpeedup = 0;
   fSuppressTimestampWarnings = false;    
 
   gUseOnlyRecent = false;
@@ -121,7 +147,10 @@ TRootanaEventLoop::TRootanaEventLoop (){
 TRootanaEventLoop::~TRootanaEventLoop (){
 
   if(fODB) delete fODB;
+  delete fSampler;
   CloseRootFile();
+  WaitRootOutput();
+  WaitCheckpoint();
 
 }
 
@@ -187,6 +216,8 @@ void TRootanaEventLoop::PrintHelp(){
   printf("\t-r: Start THttpServer on specified tcp port\n");
 #endif
   printf("\t-eXXX: Number of events XXX to read from input data files\n");
+  printf("\t-RXXX: Replay the data files as online data at XXX events/sec (0 = as fast as possible)\n");
+  printf("\t-RtXXX: Replay the data files as online data at the event timestamps, XXX times faster than real time\n");
   //printf("\t-m: Enable memory leak debugging\n");
   UsageRAD();  // Print description of TRootanaDisplay options.
   Usage();  // Print description of user options.
@@ -258,17 +289,6 @@ int TRootanaEventLoop::ExecuteLoop(int argc, char *argv[]){
       args.push_back(argv[i]);
     }
   
-  
-  if(fUseBatchMode){ // Disable creating extra window if batch mode requested.
-    gROOT->SetBatch();
-    fCreateMainWindow = false;
-  }
-    
-  if(gROOT->IsBatch() && !fUseBatchMode) {
-    printf("Cannot run without X-window support; this program is not setup to run in batch mode\n");
-    return 1;
-  }
-
   bool testMode = false;
   bool daemonMode = false;
   int  tcpPort = 0;
@@ -304,6 +324,13 @@ int TRootanaEventLoop::ExecuteLoop(int argc, char *argv[]){
       else if (strncmp(arg,"-E",2)==0)
 	exptname = strdup(arg+2);
 	#endif
+      else if (strncmp(arg,"-R",2)==0){ // Replay files as online data
+        fReplay = true;
+        if (arg[2] == 't')
+          fReplaySpeedup = arg[3] ? atof(arg+3) : 1.0;
+        else
+          fReplayRate = atof(arg+2);
+      }
       else if (strncmp(arg,"-b",2)==0){
 	fBufferName = std::string(arg+2);        
       }else if (strcmp(arg,"-h")==0)
@@ -313,6 +340,17 @@ int TRootanaEventLoop::ExecuteLoop(int argc, char *argv[]){
           if(!CheckOption(args[i]))
             PrintHelp(); // does not return
     }
+
+  // after the options, which can select batch mode (see TRootanaDisplay)
+  if(fUseBatchMode){ // Disable creating extra window if batch mode requested.
+    gROOT->SetBatch();
+    fCreateMainWindow = false;
+  }
+    
+  if(gROOT->IsBatch() && !fUseBatchMode) {
+    printf("Cannot run without X-window support; this program is not setup to run in batch mode\n");
+    return 1;
+  }
     
   // Do quick check if we are processing online or offline.
   // Want to know before we initialize.
@@ -325,6 +363,10 @@ int TRootanaEventLoop::ExecuteLoop(int argc, char *argv[]){
       }
   }
 
+  // Replayed files are processed as online data
+  if (fReplay)
+    fIsOffline = false;
+
   if (daemonMode) {
     printf("\nBecoming a daemon...\n");
     ss_daemon_init();
@@ -340,8 +382,11 @@ int TRootanaEventLoop::ExecuteLoop(int argc, char *argv[]){
    fOnlineHistDir = new TDirectory("rootana", "rootana online plots");
 
 #ifdef HAVE_LIBNETDIRECTORY
-   if (tcpPort)
+   if (tcpPort){
      StartNetDirectoryServer(tcpPort, fOnlineHistDir);
+     if (fNetDirectorySnapshotPeriod > 0)
+       StartNetDirectorySnapshots(fNetDirectorySnapshotPeriod);
+   }
 #else
    if (tcpPort)
      fprintf(stderr,"ERROR: No support for the TNetDirectory server!\n");
@@ -366,6 +411,9 @@ int TRootanaEventLoop::ExecuteLoop(int argc, char *argv[]){
      const char* arg = args[i].c_str();
      if (arg[0] != '-')  
        {  
+         if (fReplay)
+           ProcessMidasReplay(fApp,arg);
+         else
 	   ProcessMidasFile(fApp,arg);
        }
    }
@@ -380,13 +428,15 @@ int TRootanaEventLoop::ExecuteLoop(int argc, char *argv[]){
      
      fApp->Run(kTRUE);
      if(fCreateMainWindow) delete mainWindow;
+     WaitRootOutput();
      return 0;
    }
 
    // if we processed some data files,
    // do not go into online mode.
-   if (fIsOffline){
+   if (fIsOffline || fReplay){
      if(fCreateMainWindow) delete mainWindow;
+     WaitRootOutput();
      return 0;
    }
  
@@ -397,6 +447,8 @@ int TRootanaEventLoop::ExecuteLoop(int argc, char *argv[]){
    if(fCreateMainWindow) delete mainWindow;
    
    Finalize();
+
+   WaitRootOutput();
    
    return 0;
   
@@ -417,12 +469,16 @@ int TRootanaEventLoop::ProcessMidasFile(TApplication*app,const char*fname)
   // This parameter is irrelevant for offline processing.
   gUseOnlyRecent = false;
 
+  fCurrentFileName = fname;
+
   int i=0;
   while (1)
     {
       TMidasEvent event;
       if (!TMReadEvent(reader, &event))
 	break;
+
+      fCurrentEventIndex = i;
       
       /// Treat the begin run and end run events differently.
       int eventId = event.GetEventId();
@@ -485,6 +541,7 @@ int TRootanaEventLoop::ProcessMidasFile(TApplication*app,const char*fname)
   delete reader;
   reader = NULL;
 
+  TShardedHistogram::MergeAll();
   EndRunRAD(0,fCurrentRunNumber,0);
   EndRun(0,fCurrentRunNumber,0);
   CloseRootFile();  
@@ -495,6 +552,33 @@ int TRootanaEventLoop::ProcessMidasFile(TApplication*app,const char*fname)
   return 0;
 }
 
+void TRootanaEventLoop::UseAdaptiveSampling(double cpu_budget, double max_lag_sec){
+
+  if(!fSampler)
+    fSampler = new TOnlineSampler(cpu_budget, max_lag_sec);
+  else
+    *fSampler = TOnlineSampler(cpu_budget, max_lag_sec);
+}
+
+void TRootanaEventLoop::SetSamplingWeight(int eventId, double weight){
+
+  if(!fSampler)
+    UseAdaptiveSampling();
+  fSampler->SetWeight(eventId, weight);
+}
+
+double TRootanaEventLoop::GetEffectivePrescale(){
+
+  if(!fSampler) return 1.0;
+  return fSampler->GetPrescale();
+}
+
+double TRootanaEventLoop::GetEffectivePrescale(int eventId){
+
+  if(!fSampler) return 1.0;
+  return fSampler->GetPrescale(eventId);
+}
+
 void TRootanaEventLoop::UseOnlyRecent(bool setting){ 
 
   gUseOnlyRecent = setting;
@@ -506,9 +590,13 @@ void TRootanaEventLoop::OpenRootFile(int run, std::string midasFilename){
   if(fDisableRootOutput) return;
 
   if(fOutputFile) {
-    fOutputFile->Write();
-    fOutputFile->Close();
-    fOutputFile=0;
+    if(fAsyncRootOutput){
+      CloseRootFile();
+    }else{
+      fOutputFile->Write();
+      fOutputFile->Close();
+      fOutputFile=0;
+    }
   }  
 
   char filename[1024];
@@ -537,6 +625,28 @@ void TRootanaEventLoop::OpenRootFile(int run, std::string midasFilename){
 
 void TRootanaEventLoop::CloseRootFile(){
 
+  if(fOutputFile && fAsyncRootOutput) {
+    std::cout << "Closing ROOT file "
+              << fOutputFile->GetName() << " in background" << std::endl;
+
+    if(gDirectory && gDirectory->GetFile() == fOutputFile)
+      gROOT->cd();
+#ifdef HAVE_LIBNETDIRECTORY
+    if(fOnlineHistDir)
+      NetDirectoryExport(fOnlineHistDir, "outputFile");
+#endif
+
+    // The objects of the file belong to the user code, which may delete
+    // them or make new ones in the next BeginRun(): write them here and
+    // delete them as Close() would, so the writer thread only finishes
+    // the file (keys, streamer infos, header) and closes it.
+    fOutputFile->Write();
+    fOutputFile->GetList()->Delete("slow");
+
+    QueueRootFile(fOutputFile);
+    fOutputFile=0;
+  }
+
   if(fOutputFile) {
     std::cout << "Closing ROOT file "
               << fOutputFile->GetName() << std::endl;
@@ -547,14 +657,334 @@ void TRootanaEventLoop::CloseRootFile(){
 
 }
 
+/// _________________________________________________________________________
+/// Background writer for the output files of finished runs.
+
+static std::mutex gWriterMutex;
+static std::condition_variable gWriterCond;
+static std::deque<TFile*> gWriterQueue;
+static bool gWriterBusy = false;
+static bool gWriterStarted = false;
+
+static void WriteRootFile(TFile* file)
+{
+  // The objects were written by CloseRootFile() and the file's
+  // object list is empty: nothing here touches the user's objects.
+
+  double start = GetTimeSec();
+
+  TDirectory::TContext ctx(file);
+
+  std::string name = file->GetName();
+  double mbytes = file->GetBytesWritten()/1e6;
+
+  file->Close();
+  delete file;
+
+  printf("Closed ROOT file %s, %.1f MB in %.1f sec\n", name.c_str(), mbytes, GetTimeSec() - start);
+}
+
+static void RootWriterThread()
+{
+  while (1) {
+    TFile* file = NULL;
+
+    {
+      std::unique_lock<std::mutex> lock(gWriterMutex);
+      while (gWriterQueue.empty())
+        gWriterCond.wait(lock);
+      file = gWriterQueue.front();
+      gWriterQueue.pop_front();
+      gWriterBusy = true;
+    }
+
+    WriteRootFile(file);
+
+    {
+      std::lock_guard<std::mutex> lock(gWriterMutex);
+      gWriterBusy = false;
+      gWriterCond.notify_all();
+    }
+  }
+}
+
+void TRootanaEventLoop::QueueRootFile(TFile* file){
+
+  std::lock_guard<std::mutex> lock(gWriterMutex);
+
+  if(!gWriterStarted){
+    std::thread(RootWriterThread).detach();
+    gWriterStarted = true;
+  }
+
+  gWriterQueue.push_back(file);
+  gWriterCond.notify_all();
+}
+
+void TRootanaEventLoop::WaitRootOutput(){
+
+  std::unique_lock<std::mutex> lock(gWriterMutex);
+
+  if(gWriterBusy || !gWriterQueue.empty())
+    std::cout << "Waiting for ROOT output files to be written..." << std::endl;
+
+  while(gWriterBusy || !gWriterQueue.empty())
+    gWriterCond.wait(lock);
+}
+
+void TRootanaEventLoop::EnableRootThreads()
+{
+  // ROOT I/O on two threads needs the ROOT global locks
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,0,0)
+  ROOT::EnableThreadSafety();
+#else
+  TThread::Initialize();
+#endif
+}
+
+void TRootanaEventLoop::UseAsyncRootOutput(bool setting, int compression_threads){
+
+  fAsyncRootOutput = setting;
+  if(!setting) return;
+
+  EnableRootThreads();
+
+  if(compression_threads > 0){
+#ifdef R__USE_IMT
+    ROOT::EnableImplicitMT(compression_threads);
+    std::cout << "Compressing TTree baskets with " << compression_threads << " threads" << std::endl;
+#else
+    std::cout << "ROOT was built without implicit multithreading, TTree baskets are compressed on the analysis thread" << std::endl;
+#endif
+  }
+}
+
+/// _________________________________________________________________________
+/// Checkpoints of the histograms, so a restarted online analyzer can
+/// continue filling where the previous one stopped.
+
+static std::mutex gCheckpointMutex;
+static std::condition_variable gCheckpointCond;
+static bool gCheckpointBusy = false;
+
+/// Find all histograms in a directory and its subdirectories.
+static void CollectHistograms(TDirectory* dir, const std::string& prefix, std::vector<std::pair<std::string,TH1*> >& hists)
+{
+  TIter next(dir->GetList());
+  while (1) {
+    TObject* obj = next();
+    if (!obj)
+      break;
+
+    std::string path = prefix + obj->GetName();
+    if (obj->InheritsFrom(TH1::Class()))
+      hists.push_back(std::make_pair(path, (TH1*)obj));
+    else if (obj->InheritsFrom(TDirectory::Class()))
+      CollectHistograms((TDirectory*)obj, path + "/", hists);
+  }
+}
+
+static void WriteCheckpoint(TList* list, int run, std::string filename)
+{
+  double start = GetTimeSec();
+
+  // write a temporary file and rename it, so a crash
+  // never leaves us with a truncated checkpoint
+  std::string tmpname = filename + ".tmp";
+
+  {
+    TDirectory::TContext ctx(gDirectory);
+    TFile* file = new TFile(tmpname.c_str(), "RECREATE", "rootana histogram checkpoint", 1);
+    if (file->IsZombie()) {
+      printf("Cannot write histogram checkpoint %s\n", tmpname.c_str());
+    } else {
+      TParameter<int> prun("run", run);
+      prun.Write();
+      list->Write("histograms", TObject::kSingleKey);
+      file->Close();
+    }
+    delete file;
+  }
+
+  if (rename(tmpname.c_str(), filename.c_str()) != 0)
+    printf("Cannot rename %s to %s, errno %d (%s)\n", tmpname.c_str(), filename.c_str(), errno, strerror(errno));
+  else
+    printf("Wrote histogram checkpoint %s, run %d, %d histograms in %.1f sec\n",
+           filename.c_str(), run, list->GetSize(), GetTimeSec() - start);
+
+  list->Delete();
+  delete list;
+
+  std::lock_guard<std::mutex> lock(gCheckpointMutex);
+  gCheckpointBusy = false;
+  gCheckpointCond.notify_all();
+}
+
+static void WaitCheckpoint()
+{
+  std::unique_lock<std::mutex> lock(gCheckpointMutex);
+  while(gCheckpointBusy)
+    gCheckpointCond.wait(lock);
+}
+
+void TRootanaEventLoop::UseHistogramCheckpoints(int period_sec, std::string filename){
+
+  fCheckpointPeriod = period_sec;
+  fCheckpointFilename = filename;
+  if(period_sec > 0)
+    EnableRootThreads();
+}
+
+/// All histograms known to the event loop, with the path used in the checkpoint.
+static std::vector<std::pair<std::string,TH1*> > CheckpointHistograms(TDirectory* online, TFile* output)
+{
+  std::vector<std::pair<std::string,TH1*> > hists;
+  if(online)
+    CollectHistograms(online, "online/", hists);
+  if(output)
+    CollectHistograms(output, "output/", hists);
+  return hists;
+}
+
+bool TRootanaEventLoop::SaveCheckpoint(){
+
+  {
+    std::lock_guard<std::mutex> lock(gCheckpointMutex);
+    if(gCheckpointBusy)
+      return false;
+    gCheckpointBusy = true;
+  }
+
+  std::string filename = fCheckpointFilename;
+  if(filename.empty())
+    filename = fOutputFilename + "checkpoint.root";
+
+  TShardedHistogram::MergeAll();
+
+  // Copying the histograms is the only work done on the analysis thread;
+  // the slow part (streaming, compression, disk) is on the background thread.
+  std::vector<std::pair<std::string,TH1*> > hists = CheckpointHistograms(fOnlineHistDir, fOutputFile);
+
+  Bool_t addDirectory = TH1::AddDirectoryStatus();
+  TH1::AddDirectory(kFALSE);
+
+  TList* list = new TList();
+  for(unsigned i = 0; i < hists.size(); i++){
+    TH1* h = (TH1*)hists[i].second->Clone(hists[i].first.c_str());
+    h->SetDirectory(0);
+    list->Add(h);
+  }
+
+  TH1::AddDirectory(addDirectory);
+
+  std::thread(WriteCheckpoint, list, fCurrentRunNumber, filename).detach();
+  return true;
+}
+
+int TRootanaEventLoop::RestoreCheckpoint(int run){
+
+  std::string filename = fCheckpointFilename;
+  if(filename.empty())
+    filename = fOutputFilename + "checkpoint.root";
+
+  WaitCheckpoint();
+
+  if(access(filename.c_str(), R_OK) != 0)
+    return 0;
+
+  TDirectory::TContext ctx(gDirectory);
+  TFile* file = new TFile(filename.c_str(), "READ");
+  if(file->IsZombie()){
+    printf("Cannot read histogram checkpoint %s\n", filename.c_str());
+    delete file;
+    return 0;
+  }
+
+  int count = 0;
+  TParameter<int>* prun = (TParameter<int>*)file->Get("run");
+  TList* list = (TList*)file->Get("histograms");
+
+  if(!prun || !list){
+    printf("Histogram checkpoint %s is not valid\n", filename.c_str());
+  }else if(prun->GetVal() != run){
+    printf("Histogram checkpoint %s is from run %d, not restoring it into run %d\n", filename.c_str(), prun->GetVal(), run);
+  }else{
+    std::map<std::string,TH1*> hists;
+    std::vector<std::pair<std::string,TH1*> > v = CheckpointHistograms(fOnlineHistDir, fOutputFile);
+    for(unsigned i = 0; i < v.size(); i++)
+      hists[v[i].first] = v[i].second;
+
+    int mismatch = 0;
+    TIter next(list);
+    while(1){
+      TH1* saved = (TH1*)next();
+      if(!saved)
+        break;
+
+      TH1* h = hists[saved->GetName()];
+      if(!h)
+        continue;
+
+      if(h->IsA() != saved->IsA() || h->GetNcells() != saved->GetNcells()){
+        mismatch++;
+        continue;
+      }
+
+      // Add() also merges the errors, statistics and number of entries
+      h->Reset();
+      h->Add(saved);
+      count++;
+    }
+
+    printf("Restored %d of %d histograms of run %d from checkpoint %s", count, list->GetSize(), run, filename.c_str());
+    if(mismatch)
+      printf(", %d histograms have changed binning", mismatch);
+    printf("\n");
+  }
+
+  if(list){
+    list->SetOwner(kTRUE);
+    delete list;
+  }
+  delete prun;
+  file->Close();
+  delete file;
+  return count;
+}
+
 
 
 /// _________________________________________________________________________
 /// _________________________________________________________________________
 /// _________________________________________________________________________
-/// The following code is only applicable for online MIDAS programs
+/// The following code is only applicable for online MIDAS programs,
+/// or for replaying a file as if it was online (TMidasReplay)
 
+// Replaying a file instead of connecting to MIDAS?
+static TMidasReplay* gReplay = NULL;
+static bool gRunEnded = false; // the end of run transition was handled
+
+static int OnlineBufferLevel()
+{
+  if (gReplay)
+    return gReplay->getBufferLevel();
+#ifdef HAVE_MIDAS
+  return TMidasOnline::instance()->getBufferLevel();
+#else
+  return 0;
+#endif
+}
+
+static int OnlineBufferSize()
+{
+  if (gReplay)
+    return gReplay->getBufferSize();
 #ifdef HAVE_MIDAS
+  return TMidasOnline::instance()->getBufferSize();
+#else
+  return 0;
+#endif
+}
 
 // This global variable allows us to keep track of whether we are already in the process
 // of analyzing a particular event. 
@@ -649,6 +1079,14 @@ void onlineEventHandler(const void*pheader,const void*pdata,int size)
     return;
   }
 
+  // With adaptive sampling, skip the events we have no time for.
+  TOnlineSampler* sampler = TRootanaEventLoop::Get().GetOnlineSampler();
+  if(sampler && !sampler->Accept(event.GetEventId(), event.GetTimeStamp())){
+    onlineEventLock = false;
+    return;
+  }
+  double start = sampler ? GetTimeSec() : 0;
+
   /// Set the midas event pointer in the physics event.
   TRootanaEventLoop::Get().GetDataContainer()->SetMidasEventPointer(event);
 
@@ -657,6 +1095,9 @@ void onlineEventHandler(const void*pheader,const void*pdata,int size)
     TRootanaEventLoop::Get().ProcessMidasEvent(*TRootanaEventLoop::Get().GetDataContainer());
   }
 
+  if(sampler)
+    sampler->Processed(GetTimeSec() - start);
+
   gettimeofday(&lastTimeProcessed,NULL);
   PrintCurrentStats();
 
@@ -675,8 +1116,8 @@ void onlineEventHandler(const void*pheader,const void*pdata,int size)
                event.GetTimeStamp(),(int) now.tv_sec,numberOldTimestamps);
         printf("Either the analyzer is falling behind the data taking \n(try modifying the fraction of events plotted) or times on different computers are not synchronized.\n");  
         
-        int buffer_level = TMidasOnline::instance()->getBufferLevel();
-        int buffer_size = TMidasOnline::instance()->getBufferSize();
+        int buffer_level = OnlineBufferLevel();
+        int buffer_size = OnlineBufferSize();
         printf("Buffer level = %i bytes out of %i bytes maximum \n\n",buffer_level,buffer_size);        
         nextWarnTimestamps *= 3.16227;
       }      
@@ -684,6 +1125,11 @@ void onlineEventHandler(const void*pheader,const void*pdata,int size)
   }
 
   onlineEventLock = false;
+
+#ifdef HAVE_LIBNETDIRECTORY
+  // Hand ROOT to waiting network requests between events.
+  YieldRoot();
+#endif
 }
 
 
@@ -699,22 +1145,117 @@ void onlineBeginRunHandler(int transition,int run,int time)
   nextWarnTimestamps = 1.0;
   gettimeofday(&raLastTime, NULL);
   disableOnlyRecentMode = false;
+  gRunEnded = false;
+  if(TRootanaEventLoop::Get().GetOnlineSampler())
+    TRootanaEventLoop::Get().GetOnlineSampler()->Reset();
 }
 
 void onlineEndRunHandler(int transition,int run,int time)
 {
   TRootanaEventLoop::Get().SetCurrentRunNumber(run);
+  TShardedHistogram::MergeAll();
   TRootanaEventLoop::Get().EndRunRAD(transition,run,time);
   TRootanaEventLoop::Get().EndRun(transition,run,time);
   TRootanaEventLoop::Get().CloseRootFile();
+  gRunEnded = true;
+  if(TRootanaEventLoop::Get().GetOnlineSampler())
+    TRootanaEventLoop::Get().GetOnlineSampler()->Print();
+#ifdef HAVE_LIBNETDIRECTORY
+  PrintRootLockStats();
+#endif
+}
+
+void CheckpointHandlerLocal()
+{
+  TRootanaEventLoop::Get().SaveCheckpoint();
+}
+
+void ShardMergeHandlerLocal()
+{
+  TShardedHistogram::MergeAll();
+}
+
+void ReplayPollHandlerLocal()
+{
+  if (!gReplay->poll(0))
+    gSystem->ExitLoop();
+#ifdef HAVE_LIBNETDIRECTORY
+  YieldRoot();
+#endif
 }
 
+int TRootanaEventLoop::ProcessMidasReplay(TApplication*app, const char* fname)
+{
+   TMidasReplay *replay = TMidasReplay::instance();
+
+   if (fReplaySpeedup > 0)
+     replay->setRealTime(fReplaySpeedup);
+   else
+     replay->setRate(fReplayRate);
+
+   if (replay->connect(fname) != 0)
+     return -1;
+
+   gReplay = replay;
+
+   // ODB and run number as seen by an analyzer connecting to this run
+   if (fODB) delete fODB;
+   fODB = MakeFileDumpOdb(replay->fOdbEvent.GetData(),replay->fOdbEvent.GetDataSize());
+   fCurrentRunNumber = replay->fRunNumber;
+
+   OpenRootFile(fCurrentRunNumber);
+   BeginRun(0,fCurrentRunNumber,0);
+   BeginRunRAD(0,fCurrentRunNumber,0);
+
+   if(fCheckpointPeriod > 0)
+     RestoreCheckpoint(fCurrentRunNumber);
+
+   gRunEnded = false;
+   replay->setTransitionHandlers(onlineBeginRunHandler,onlineEndRunHandler);
+   replay->setEventHandler(onlineEventHandler);
+
+   if(gUseOnlyRecent){
+     std::cout << "Using 'Only Recent Data' mode; all events more than 1 second old will be discarded." << std::endl;
+   }
+
+   TPeriodicClass tm(100,ReplayPollHandlerLocal);
+
+   // Publish what other threads filled into sharded histograms
+   TPeriodicClass mergeTimer(1000,ShardMergeHandlerLocal);
+
+   TPeriodicClass* checkpointTimer = NULL;
+   if(fCheckpointPeriod > 0)
+     checkpointTimer = new TPeriodicClass(fCheckpointPeriod*1000,CheckpointHandlerLocal);
+
+   app->Run(kTRUE);
+
+   delete checkpointTimer;
+
+   // Call user-defined EndRun and close the ROOT file, unless the
+   // end of run transition of the replay already did.
+   if(!gRunEnded){
+     TShardedHistogram::MergeAll();
+     EndRunRAD(0,fCurrentRunNumber,0);
+     EndRun(0,fCurrentRunNumber,0);
+     CloseRootFile();
+   }
+
+   replay->disconnect();
+   gReplay = NULL;
+
+   return 0;
+}
+
+#ifdef HAVE_MIDAS
 
 void MidasPollHandlerLocal()
 {
 
   if (!(TMidasOnline::instance()->poll(0)))
     gSystem->ExitLoop();
+#ifdef HAVE_LIBNETDIRECTORY
+  YieldRoot();
+#endif
 }
 
 int TRootanaEventLoop::ProcessMidasOnline(TApplication*app, const char* hostname, const char* exptname)
@@ -739,6 +1280,10 @@ int TRootanaEventLoop::ProcessMidasOnline(TApplication*app, const char* hostname
    BeginRun(0,fCurrentRunNumber,0);
    BeginRunRAD(0,fCurrentRunNumber,0);
 
+   // Pick up the histograms of a previous analyzer of this run
+   if(fCheckpointPeriod > 0)
+     RestoreCheckpoint(fCurrentRunNumber);
+
    // Register begin and end run handlers.
    midas->setTransitionHandlers(onlineBeginRunHandler,onlineEndRunHandler,NULL,NULL);
    midas->registerTransitions();
@@ -764,12 +1309,22 @@ int TRootanaEventLoop::ProcessMidasOnline(TApplication*app, const char* hostname
    
    TPeriodicClass tm(100,MidasPollHandlerLocal);
 
+   // Publish what other threads filled into sharded histograms
+   TPeriodicClass mergeTimer(1000,ShardMergeHandlerLocal);
+
+   TPeriodicClass* checkpointTimer = NULL;
+   if(fCheckpointPeriod > 0)
+     checkpointTimer = new TPeriodicClass(fCheckpointPeriod*1000,CheckpointHandlerLocal);
+
    /*---- start main loop ----*/
 
    //loop_online();
    app->Run(kTRUE); // kTRUE means return to here after finished with online processing... this ensures that we can disconnect.
+
+   delete checkpointTimer;
    
    // Call user-defined EndRun and close the ROOT file.
+   TShardedHistogram::MergeAll();
    EndRunRAD(0,fCurrentRunNumber,0);
    EndRun(0,fCurrentRunNumber,0);
    CloseRootFile();  
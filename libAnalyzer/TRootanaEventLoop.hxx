@@ -15,6 +15,7 @@
 //#include "VirtualOdb.h"
 #include "mvodb.h"
 #include "TDataContainer.hxx"
+#include "TOnlineSampler.hxx"
 
 // ROOT includes
 #include "TApplication.h"
@@ -126,10 +127,20 @@ public:
 
   int ProcessMidasFile(TApplication*app,const char*fname);
 
+  /// Name of the file being processed offline
+  const std::string& GetCurrentFileName() const {return fCurrentFileName;};
+
+  /// Position of the current event in the file being processed offline;
+  /// all the events of the file are counted, from 0.
+  int GetCurrentEventIndex() const {return fCurrentEventIndex;};
+
 #ifdef HAVE_MIDAS
   int ProcessMidasOnline(TApplication*app, const char* hostname, const char* exptname);
 #endif
 
+  /// Process a file as if it was online data, see TMidasReplay.
+  int ProcessMidasReplay(TApplication*app, const char* fname);
+
 
   /// This static templated function will make it a little easier
   /// for users to create the singleton instance.
@@ -158,6 +169,34 @@ public:
 
   /// Cloe output ROOT file
   void CloseRootFile();
+
+  /// Close the output ROOT file of a finished run on a background thread,
+  /// so the next run can start sooner. The objects are written and deleted
+  /// on the analysis thread at end of run, as they belong to the user code;
+  /// the background thread writes the file keys, streamer infos and
+  /// header and closes the file.
+  /// If compression_threads > 0, also enable ROOT implicit multithreading
+  /// so TTree baskets are compressed in parallel (ROOT 6 with IMT only).
+  void UseAsyncRootOutput(bool setting = true, int compression_threads = 0);
+
+  /// Wait until all output ROOT files are written and closed.
+  void WaitRootOutput();
+
+  /// Every period_sec, save the histograms of the online directory and of
+  /// the output file to a checkpoint file; the file is written by a background
+  /// thread. When the online analyzer starts in the middle of a run, and the
+  /// checkpoint is from this same run, the histograms are restored from it.
+  /// Only histograms that exist after BeginRun() are restored.
+  /// Default file name is $(fOutputFilename)checkpoint.root. Set 0 to disable.
+  void UseHistogramCheckpoints(int period_sec = 60, std::string filename = "");
+
+  /// Save a checkpoint of the histograms now; returns false if the previous
+  /// checkpoint is still being written.
+  bool SaveCheckpoint();
+
+  /// Restore the histograms from the checkpoint file, if it was written for this run.
+  /// Returns the number of restored histograms.
+  int RestoreCheckpoint(int run);
   
   /// Check if output ROOT file is valid and open
   bool IsRootFileValid(){    
@@ -205,11 +244,41 @@ public:
   /// Setting true will use this option.
   void UseOnlyRecent(bool setting = true);//{ fUseOnlyRecent = setting;};
 
+  /// Online, process only as many events as fit into cpu_budget (fraction of
+  /// the wall-clock time spent in ProcessMidasEvent) without falling more than
+  /// max_lag_sec behind (0 = no limit; timestamps have 1 sec resolution).
+  /// The processed events are spread evenly; see TOnlineSampler.
+  void UseAdaptiveSampling(double cpu_budget = 0.8, double max_lag_sec = 2.0);
+
+  /// With adaptive sampling, process events with this ID weight times
+  /// more often than other events (default weight is 1).
+  void SetSamplingWeight(int eventId, double weight);
+
+  /// Adaptive sampler, NULL if not used.
+  TOnlineSampler* GetOnlineSampler(){ return fSampler;};
+
+  /// Events offered / events processed since begin of run, 1 without adaptive sampling.
+  double GetEffectivePrescale();
+
+  /// Same for one event ID; with SetSamplingWeight() each event ID has its own prescale.
+  double GetEffectivePrescale(int eventId);
+
   // Set ReadWrite mode fot THttpServer (to allow operation on histograms through web; like histogram reset).
   void SetTHttpServerReadWrite(bool readwrite = true);
 
+  /// Serve TNetDirectory read requests from snapshots of the online histograms,
+  /// refreshed every period_msec; network clients then do not stall the analysis
+  /// to take the ROOT lock. Set 0 to disable (default).
+  void UseNetDirectorySnapshots(int period_msec = 1000){ fNetDirectorySnapshotPeriod = period_msec;};
+
 protected:
 
+  /// Hand an output file, with its objects already written and deleted, over to the background writer thread.
+  void QueueRootFile(TFile* file);
+
+  /// Enable the ROOT global locks, for using ROOT on a second thread.
+  static void EnableRootThreads();
+
   bool CreateOutputFile(std::string name, std::string options = "RECREATE"){
     
     fOutputFile = new TFile(name.c_str(),options.c_str());
@@ -291,6 +360,10 @@ private:
   // Variables for offline analysis
   int fMaxEvents;
 
+  /// File being processed and position of the current event in it
+  std::string fCurrentFileName;
+  int fCurrentEventIndex;
+
   // The TApplication...
   TApplication *fApp;
 
@@ -300,6 +373,30 @@ private:
   // Use a batch mode.
   bool fUseBatchMode;
 
+  // Period (ms) for TNetDirectory snapshots; 0 = disabled
+  int fNetDirectorySnapshotPeriod;
+
+  // Close output files on a background thread
+  bool fAsyncRootOutput;
+
+  // Replay files as online data (-R option)
+  bool fReplay;
+
+  // Replay rate (events/sec, 0 = as fast as possible)
+  double fReplayRate;
+
+  // Replay at the event timestamps, this many times faster than real time
+  double fReplaySpeedup;
+
+  // Adaptive online sampling
+  TOnlineSampler* fSampler;
+
+  // Period (sec) for histogram checkpoints; 0 = disabled
+  int fCheckpointPeriod;
+
+  // Checkpoint file name
+  std::string fCheckpointFilename;
+
   
 
 
@@ -0,0 +1,174 @@
+#include "TShardedHistogram.hxx"
+
+#include "TH1.h"
+#include "TProfile.h"
+#include "TProfile2D.h"
+#include "TArrayD.h"
+
+#include <stdio.h>
+#include <algorithm>
+
+// All the sharded histograms, for MergeAll()
+static std::mutex gShardedMutex;
+static std::vector<TShardedHistogram*> gShardedHistograms;
+
+// Small index of the calling thread, used to pick its shard
+static std::atomic<int> gNextThreadIndex(0);
+
+static int GetThreadIndex()
+{
+  static thread_local int index = -1;
+  if (index < 0)
+    index = gNextThreadIndex++;
+  return index;
+}
+
+TShardedHistogram::TShardedHistogram(TH1* h, int max_threads)
+  : fShards(max_threads > 0 ? max_threads : 1)
+{
+  fHist = h;
+  fNcells = h->GetNcells();
+  fSumw2 = h->GetSumw2N() > 0;
+
+  // profile bins are means, they cannot be filled by adding counts
+  if (h->InheritsFrom(TProfile::Class()) || h->InheritsFrom(TProfile2D::Class())) {
+    fprintf(stderr, "TShardedHistogram: cannot shard profile histogram \"%s\", fills are ignored\n", h->GetName());
+    fNcells = 0;
+  }
+  for (unsigned i=0; i<fShards.size(); i++)
+    fShards[i] = NULL;
+
+  std::lock_guard<std::mutex> lock(gShardedMutex);
+  gShardedHistograms.push_back(this);
+}
+
+TShardedHistogram::~TShardedHistogram()
+{
+  {
+    std::lock_guard<std::mutex> lock(gShardedMutex);
+    gShardedHistograms.erase(std::remove(gShardedHistograms.begin(), gShardedHistograms.end(), this),
+                             gShardedHistograms.end());
+  }
+
+  for (unsigned i=0; i<fShards.size(); i++)
+    delete fShards[i].load();
+}
+
+TShardedHistogram::Shard* TShardedHistogram::GetShard()
+{
+  std::atomic<Shard*>& slot = fShards[GetThreadIndex() % fShards.size()];
+  Shard* s = slot.load(std::memory_order_acquire);
+  if (s)
+    return s;
+
+  std::lock_guard<std::mutex> lock(fMutex);
+  s = slot.load(std::memory_order_relaxed);
+  if (!s) {
+    s = new Shard;
+    s->fBins.assign(fNcells, 0);
+    if (fSumw2)
+      s->fSumw2.assign(fNcells, 0);
+    s->fEntries = 0;
+    slot.store(s, std::memory_order_release);
+  }
+  return s;
+}
+
+void TShardedHistogram::FillBin(int bin, double w)
+{
+  if (bin < 0 || bin >= fNcells)
+    return;
+
+  Shard* s = GetShard();
+  std::lock_guard<std::mutex> lock(s->fMutex);
+  s->fBins[bin] += w;
+  if (fSumw2)
+    s->fSumw2[bin] += w*w;
+  s->fEntries++;
+}
+
+void TShardedHistogram::Fill(double x, double w)
+{
+  // FindFixBin() only reads the axes, it is safe from any thread
+  FillBin(fHist->FindFixBin(x), w);
+}
+
+void TShardedHistogram::Fill(double x, double y, double w)
+{
+  FillBin(fHist->FindFixBin(x, y), w);
+}
+
+void TShardedHistogram::Merge()
+{
+  double entries = 0;
+  TArrayD* sumw2 = fSumw2 ? fHist->GetSumw2() : NULL;
+
+  for (unsigned i=0; i<fShards.size(); i++) {
+    Shard* s = fShards[i].load(std::memory_order_acquire);
+    if (!s)
+      continue;
+
+    if (fSpareBins.size() != (unsigned)fNcells)
+      fSpareBins.assign(fNcells, 0);
+    if (fSumw2 && fSpareSumw2.size() != (unsigned)fNcells)
+      fSpareSumw2.assign(fNcells, 0);
+
+    // take the contents of the shard, leave it an empty array to fill
+    double n;
+    {
+      std::lock_guard<std::mutex> lock(s->fMutex);
+      n = s->fEntries;
+      if (n == 0)
+        continue;
+      s->fBins.swap(fSpareBins);
+      if (fSumw2)
+        s->fSumw2.swap(fSpareSumw2);
+      s->fEntries = 0;
+    }
+
+    for (int bin=0; bin<fNcells; bin++) {
+      if (fSpareBins[bin] != 0) {
+        fHist->AddBinContent(bin, fSpareBins[bin]);
+        fSpareBins[bin] = 0;
+      }
+    }
+    if (sumw2) {
+      for (int bin=0; bin<fNcells; bin++) {
+        sumw2->fArray[bin] += fSpareSumw2[bin];
+        fSpareSumw2[bin] = 0;
+      }
+    }
+
+    entries += n;
+  }
+
+  if (entries == 0)
+    return;
+
+  // recompute the statistics from the bins, as after SetBinContent()
+  Double_t stats[TH1::kNstat];
+  for (int k=0; k<TH1::kNstat; k++)
+    stats[k] = 0;
+  fHist->PutStats(stats);
+  fHist->SetEntries(fHist->GetEntries() + entries);
+}
+
+void TShardedHistogram::Reset()
+{
+  for (unsigned i=0; i<fShards.size(); i++) {
+    Shard* s = fShards[i].load(std::memory_order_acquire);
+    if (!s)
+      continue;
+    std::lock_guard<std::mutex> lock(s->fMutex);
+    std::fill(s->fBins.begin(), s->fBins.end(), 0);
+    std::fill(s->fSumw2.begin(), s->fSumw2.end(), 0);
+    s->fEntries = 0;
+  }
+}
+
+void TShardedHistogram::MergeAll()
+{
+  std::lock_guard<std::mutex> lock(gShardedMutex);
+  for (unsigned i=0; i<gShardedHistograms.size(); i++)
+    gShardedHistograms[i]->Merge();
+}
@@ -0,0 +1,79 @@
+#ifndef TShardedHistogram_hxx_seen
+#define TShardedHistogram_hxx_seen
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+
+class TH1;
+
+/// Fill a ROOT histogram from several threads.
+///
+/// Each thread that calls Fill() gets its own shard: a plain array of
+/// float bin contents with the binning of the published histogram, filled
+/// without touching the TH1. Merge() adds the shards into the published
+/// histogram and clears them; it must be called from the thread that owns
+/// ROOT (the analysis/GUI thread), so the display, the network servers and
+/// EndRun() always see a consistent histogram. TRootanaEventLoop and
+/// TRootanaDisplay call MergeAll() periodically online, before drawing,
+/// and before EndRun().
+///
+/// The statistics (mean, RMS) of the published histogram are recomputed
+/// from the bin contents after a merge, as after SetBinContent().
+/// Shard bins are floats: counts are exact up to 16 million entries per bin
+/// between two merges.
+///
+/// Profiles (TProfile, TProfile2D) cannot be sharded: their bins hold
+/// means, not counts. The constructor refuses them and Fill() ignores
+/// their entries.
+class TShardedHistogram {
+
+public:
+
+  /// Shards for filling h; h stays owned by the caller and must
+  /// keep its binning while this object exists.
+  /// Threads beyond max_threads share shards.
+  TShardedHistogram(TH1* h, int max_threads = 64);
+  ~TShardedHistogram();
+
+  /// Fill the shard of the calling thread
+  void Fill(double x, double w = 1.0);
+  void Fill(double x, double y, double w);
+  void FillBin(int bin, double w = 1.0);
+
+  /// Add the shards into the published histogram and clear them
+  void Merge();
+
+  /// Discard the contents of the shards
+  void Reset();
+
+  /// The published histogram
+  TH1* GetHistogram() const { return fHist; }
+
+  /// Merge all the sharded histograms of this program
+  static void MergeAll();
+
+private:
+
+  struct Shard {
+    std::mutex fMutex;
+    std::vector<float> fBins;
+    std::vector<float> fSumw2;  ///< only if the published histogram has errors
+    double fEntries;
+  };
+
+  /// Shard of the calling thread, created on first use
+  Shard* GetShard();
+
+  TH1* fHist;
+  int  fNcells;
+  bool fSumw2;
+
+  std::vector<std::atomic<Shard*> > fShards;
+  std::mutex fMutex;  ///< held while creating shards
+
+  std::vector<float> fSpareBins;   ///< swapped with the bins of a shard in Merge()
+  std::vector<float> fSpareSumw2;
+};
+
+#endif
@@ -36,6 +36,11 @@ class TV1720RawZlePulse {
     return -1;
   }
 
+  /// Get all the samples of this pulse.
+  const std::vector<uint32_t>& GetSamples() const {
+    return fSamples;
+  }
+
  private:
   
   /// The first bin for this ZLE pulse.
@@ -79,6 +84,9 @@ class TV1720RawChannel {
     return -1;
   }
 
+  /// Get all the ADC samples (for uncompressed data).
+  const std::vector<uint32_t>& GetADCSamples() const {return fWaveform;};
+
   /// Get the number of ZLE pulses (for compressed data)
   int GetNZlePulses() const {return fZlePulses.size();};
   
@@ -36,6 +36,11 @@ public:
 		return 9999999;
 	}
 
+	/// Get all the samples
+	const std::vector<uint32_t>& GetSamples() const {
+		return fSamples;
+	}
+
 	void AddSamples(std::vector<uint32_t> Samples){
 		fSamples = Samples;
 	}
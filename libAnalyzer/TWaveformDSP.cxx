@@ -0,0 +1,135 @@
+#include "TWaveformDSP.hxx"
+
+#include <math.h>
+
+TWaveformDSP::TWaveformDSP()
+{
+  fBaselineSamples = 16;
+  fPolarity = -1;
+  fThreshold = 20;
+  fCFDFraction = 0.5;
+  fIntegralBefore = 10;
+  fIntegralAfter = 30;
+}
+
+TWaveformResult TWaveformDSP::Analyze(const std::vector<uint32_t>& samples) const
+{
+  TWaveformResult result;
+  Analyze(samples.empty() ? 0 : &samples[0], samples.size(), result);
+  return result;
+}
+
+void TWaveformDSP::Analyze(const uint32_t* samples, int nwaveforms, int nsamples, TWaveformResult* results) const
+{
+  for (int i=0; i<nwaveforms; i++)
+    Analyze(samples + (size_t)i*nsamples, nsamples, results[i]);
+}
+
+void TWaveformDSP::Analyze(const uint32_t* s, int n, TWaveformResult& r) const
+{
+  r.fBaseline = 0;
+  r.fBaselineRMS = 0;
+  r.fAmplitude = 0;
+  r.fPeakSample = -1;
+  r.fTime = -1;
+  r.fIntegral = 0;
+  r.fNPulses = 0;
+  r.fPileUp = false;
+
+  if (n <= 0)
+    return;
+
+  // baseline from the first samples
+  int nb = fBaselineSamples < n ? fBaselineSamples : n;
+  uint64_t sum = 0;
+  uint64_t sum2 = 0;
+  for (int i=0; i<nb; i++) {
+    sum += s[i];
+    sum2 += (uint64_t)s[i]*s[i];
+  }
+  double base = (double)sum/nb;
+  double var = (double)sum2/nb - base*base;
+  r.fBaseline = base;
+  r.fBaselineRMS = var > 0 ? sqrt(var) : 0;
+
+  // largest pulse: the extreme sample in the direction of the pulses
+  uint32_t ext = s[0];
+  if (fPolarity < 0) {
+    for (int i=1; i<n; i++)
+      ext = s[i] < ext ? s[i] : ext;
+  } else {
+    for (int i=1; i<n; i++)
+      ext = s[i] > ext ? s[i] : ext;
+  }
+  int peak = 0;
+  while (s[peak] != ext)
+    peak++;
+  r.fPeakSample = peak;
+  r.fAmplitude = fPolarity*((double)ext - base);
+
+  // count the pulses: samples over the threshold that follow one that is not
+  int pulses = 0;
+  if (fPolarity < 0) {
+    int64_t level = (int64_t)ceil(base - fThreshold);
+    pulses = (int64_t)s[0] < level;
+    for (int i=1; i<n; i++)
+      pulses += ((int64_t)s[i] < level) & ((int64_t)s[i-1] >= level);
+  } else {
+    int64_t level = (int64_t)floor(base + fThreshold);
+    pulses = (int64_t)s[0] > level;
+    for (int i=1; i<n; i++)
+      pulses += ((int64_t)s[i] > level) & ((int64_t)s[i-1] <= level);
+  }
+  r.fNPulses = pulses;
+  r.fPileUp = pulses > 1;
+
+  // charge in the window around the peak
+  int lo = peak - fIntegralBefore;
+  int hi = peak + fIntegralAfter + 1;
+  if (lo < 0)
+    lo = 0;
+  if (hi > n)
+    hi = n;
+  uint64_t charge = 0;
+  for (int i=lo; i<hi; i++)
+    charge += s[i];
+  r.fIntegral = fPolarity*((double)charge - base*(hi - lo));
+
+  if (pulses == 0)
+    return;
+
+  // constant fraction time: go back from the peak to the first sample below
+  // the fraction of the amplitude, and interpolate to the next sample
+  double cfd = fCFDFraction*r.fAmplitude;
+  int i = peak;
+  while (i > 0 && fPolarity*((double)s[i-1] - base) >= cfd)
+    i--;
+  if (i == 0) {
+    r.fTime = 0;
+    return;
+  }
+  double before = fPolarity*((double)s[i-1] - base);
+  double after = fPolarity*((double)s[i] - base);
+  r.fTime = (i - 1) + (cfd - before)/(after - before);
+}
+
+void TWaveformDSP::RunningBaseline(const uint32_t* samples, int n, int window, float* baseline)
+{
+  if (n <= 0)
+    return;
+  if (window < 1)
+    window = 1;
+
+  // window samples from i-half, one more before i than after for an even window
+  int half = window/2;
+  uint64_t sum = 0;
+  int lo = 0;
+  int hi = 0;  // the average is over samples lo..hi-1
+  for (int i=0; i<n; i++) {
+    while (hi < n && hi < i - half + window)
+      sum += samples[hi++];
+    while (lo < i - half)
+      sum -= samples[lo++];
+    baseline[i] = (double)sum/(hi - lo);
+  }
+}
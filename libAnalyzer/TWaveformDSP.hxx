@@ -0,0 +1,92 @@
+#ifndef TWaveformDSP_hxx_seen
+#define TWaveformDSP_hxx_seen
+
+#include <vector>
+#include <stdint.h>
+
+/// Quantities extracted from one digitizer waveform by TWaveformDSP.
+/// Amplitudes and integrals are measured from the baseline in the direction
+/// of the pulses, so they are positive for both polarities; times are in samples.
+struct TWaveformResult {
+  double fBaseline;     ///< mean of the baseline samples, ADC counts
+  double fBaselineRMS;  ///< RMS of the baseline samples
+  double fAmplitude;    ///< height of the largest pulse
+  int    fPeakSample;   ///< sample of the largest pulse, -1 for an empty waveform
+  double fTime;         ///< constant fraction time of the largest pulse, interpolated; -1 if below threshold
+  double fIntegral;     ///< baseline subtracted sum of the samples in the integration window
+  int    fNPulses;      ///< number of times the waveform goes over the threshold
+  bool   fPileUp;       ///< more than one pulse in the waveform
+};
+
+/// Standard analysis of digitizer waveforms: baseline, peak search,
+/// constant fraction timing, charge integration and pile-up flag.
+///
+/// Works directly on the samples of the decoders (GetSamples() of the
+/// V1730, DT724 and V1730 DPP channels, GetADCSamples() of the V1720),
+/// without copying them.  The loops over the samples are written without
+/// branches so that the compiler can vectorize them; this file is compiled
+/// with -O3 for that.
+///
+/// One TWaveformDSP holds the settings and no state, so it can be shared by
+/// several threads.
+class TWaveformDSP {
+
+public:
+
+  TWaveformDSP();
+
+  /// Number of samples at the start of the waveform used for the baseline (default 16)
+  void SetBaselineSamples(int n){ fBaselineSamples = n > 0 ? n : 1; }
+
+  /// +1 for positive going pulses, -1 for negative going pulses (default)
+  void SetPolarity(int polarity){ fPolarity = polarity < 0 ? -1 : 1; }
+
+  /// Pulse threshold from the baseline, ADC counts (default 20)
+  void SetThreshold(double threshold){ fThreshold = threshold; }
+
+  /// Fraction of the amplitude for the constant fraction time (default 0.5)
+  void SetCFDFraction(double fraction){ fCFDFraction = fraction; }
+
+  /// Integration window: samples before and after the peak (default 10 and 30)
+  void SetIntegrationWindow(int before, int after){
+    fIntegralBefore = before;
+    fIntegralAfter = after;
+  }
+
+  /// Analyse one waveform
+  void Analyze(const uint32_t* samples, int n, TWaveformResult& result) const;
+  TWaveformResult Analyze(const std::vector<uint32_t>& samples) const;
+
+  /// Analyse nwaveforms waveforms of nsamples each, stored one after the other
+  void Analyze(const uint32_t* samples, int nwaveforms, int nsamples, TWaveformResult* results) const;
+
+  /// Analyse all the channels of a bank, given as the vector of channel
+  /// measurements of TV1730RawData, TDT724RawData or TV1730DppData
+  /// (anything with GetSamples()); results[i] is for channels[i].
+  template<typename T>
+  void AnalyzeChannels(const std::vector<T>& channels, std::vector<TWaveformResult>& results) const {
+    results.resize(channels.size());
+    for(unsigned int i = 0; i < channels.size(); i++){
+      const std::vector<uint32_t>& samples = channels[i].GetSamples();
+      Analyze(samples.empty() ? 0 : &samples[0], samples.size(), results[i]);
+    }
+  }
+
+  /// Running average of the samples over window samples, for baselines that
+  /// drift along long waveforms; baseline must have n entries. baseline[i] is
+  /// the average of samples i-window/2 to i-window/2+window-1: centred for an
+  /// odd window, with one sample more before i for an even one. The window is
+  /// cut at the ends of the waveform.
+  static void RunningBaseline(const uint32_t* samples, int n, int window, float* baseline);
+
+private:
+
+  int    fBaselineSamples;
+  int    fPolarity;
+  double fThreshold;
+  double fCFDFraction;
+  int    fIntegralBefore;
+  int    fIntegralAfter;
+};
+
+#endif
@@ -0,0 +1,174 @@
+//
+// test_coincidence.cxx --- check and benchmark of TCoincidenceFinder
+//
+// Checks counter rollovers, hits carried over between Process() calls,
+// Process(true), late hits and sources without hits, then reports how
+// many hits per second are merged and searched for coincidences.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <sys/time.h>
+
+#include "TCoincidenceFinder.hxx"
+
+static double GetTimeSec()
+{
+   struct timeval tv;
+   gettimeofday(&tv, NULL);
+   return tv.tv_sec + 0.000001*tv.tv_usec;
+}
+
+static int gCountFail = 0;
+
+static void report_fail(const char* text)
+{
+   printf("FAIL: %s\n", text);
+   gCountFail++;
+}
+
+static void check(const char* what, double value, double expected)
+{
+   printf("%s: %g, expected %g\n", what, value, expected);
+   if (fabs(value - expected) > 1e-6)
+      report_fail(what);
+}
+
+static void TestRollover()
+{
+   TCoincidenceFinder f;
+   int a = f.AddSource("a", 8, 10.0);  // rolls over every 2560 ns
+   int b = f.AddSource("b", 0, 1.0);
+
+   f.AddHit(a, 250);
+   f.AddHitNs(b, 2505);
+   f.AddHit(a, 5);  // after the rollover: 2610 ns
+   f.AddHitNs(b, 2615);
+   f.AddHit(a, 256 + 10);  // bits above the counter are ignored: 2660 ns
+
+   check("rollover coincidences", f.Process(true), 2);
+   check("rollover time", f.GetCoincidenceHit(1, 0).fTime, 2610);
+   check("rollover coincidence size", f.GetCoincidenceSize(1), 3);
+   check("rollover last hit", f.GetCoincidenceHit(1, 2).fTime, 2660);
+}
+
+static void TestCarryOver()
+{
+   TCoincidenceFinder f;
+   int a = f.AddSource("a", 0, 1.0);
+   int b = f.AddSource("b", 0, 1.0);
+
+   // b has only reached 990: the coincidence of 990 is not complete yet
+   f.AddHitNs(a, 1000);
+   f.AddHitNs(b, 990);
+   check("carry-over first Process()", f.Process(), 0);
+   check("carry-over first merged hits", f.GetMergedHits().size(), 0);
+
+   f.AddHitNs(a, 2000);
+   f.AddHitNs(b, 1990);
+   check("carry-over second Process()", f.Process(), 1);
+   check("carry-over coincidence size", f.GetCoincidenceSize(0), 2);
+   check("carry-over first hit", f.GetCoincidenceHit(0, 0).fTime, 990);
+   check("carry-over second hit", f.GetCoincidenceHit(0, 1).fTime, 1000);
+
+   check("flush", f.Process(true), 1);
+   check("flush first hit", f.GetCoincidenceHit(0, 0).fTime, 1990);
+   check("flush merged hits", f.GetMergedHits().size(), 2);
+   check("nothing left after flush", f.Process(true), 0);
+
+   // older than what was merged: dropped, not emitted out of order
+   f.AddHitNs(a, 1500);
+   f.AddHitNs(b, 1505);
+   f.AddHitNs(a, 3000);
+   f.AddHitNs(b, 3010);
+   check("late hits", f.GetLateHits(), 2);
+   check("after late hits", f.Process(true), 1);
+   check("after late hits first hit", f.GetCoincidenceHit(0, 0).fTime, 3000);
+}
+
+static void TestSilentSource()
+{
+   TCoincidenceFinder f;
+   int a = f.AddSource("a", 0, 1.0);
+   int b = f.AddSource("b", 0, 1.0);
+   f.AddSource("silent", 0, 1.0);
+   f.SetMaxDelay(10000);
+
+   for (int i=0; i<1000; i++) {
+      f.AddHitNs(a, i*1000.0);
+      f.AddHitNs(b, i*1000.0 + 10);
+   }
+
+   // the newest hit is at 999010, so everything up to 989010 is handled
+   check("coincidences without the silent source", f.Process(), 989);
+   check("merged hits without the silent source", f.GetMergedHits().size(), 2*989);
+
+   f.AddHitNs(2, 500);
+   check("late hit of the silent source", f.GetLateHits(), 1);
+
+   check("flush without the silent source", f.Process(true), 11);
+}
+
+static void Benchmark(int ntriggers)
+{
+   const int    nsources = 3;
+   const double period   = 1000;  // ns between triggers
+   const int    nbatch   = 10000; // triggers between Process() calls
+
+   TCoincidenceFinder f;
+   for (int i=0; i<nsources; i++) {
+      char name[16];
+      sprintf(name, "board%d", i);
+      f.AddSource(name, 24, 8.0, -i*40.0);  // rolls over every 134 ms
+   }
+
+   srand(1);
+
+   double coincidences = 0;
+   double merged = 0;
+   double t0 = GetTimeSec();
+   for (int k=0; k<ntriggers; k++) {
+      for (int i=0; i<nsources; i++) {
+         double t = k*period + i*40.0 + rand()%5*8.0;
+         f.AddHit(i, (uint64_t)(t/8.0), i, 0, 0);
+      }
+      if ((k+1)%nbatch == 0) {
+         coincidences += f.Process();
+         merged += f.GetMergedHits().size();
+      }
+   }
+   coincidences += f.Process(true);
+   merged += f.GetMergedHits().size();
+   double t1 = GetTimeSec();
+
+   printf("%d triggers of %d sources: %.0f coincidences, %.3f sec, %.2f M hits/sec\n",
+          ntriggers, nsources, coincidences, t1 - t0, nsources*ntriggers/(t1 - t0)/1e6);
+   f.Print();
+
+   check("benchmark coincidences", coincidences, ntriggers);
+   check("benchmark merged hits", merged, (double)nsources*ntriggers);
+   check("benchmark late hits", f.GetLateHits(), 0);
+}
+
+int main(int argc, char* argv[])
+{
+   int ntriggers = 1000000;
+   if (argc > 1)
+      ntriggers = atoi(argv[1]);
+
+   TestRollover();
+   TestCarryOver();
+   TestSilentSource();
+   Benchmark(ntriggers);
+
+   if (gCountFail) {
+      printf("test_coincidence: %d failures\n", gCountFail);
+      return 1;
+   }
+
+   printf("test_coincidence: PASS\n");
+   return 0;
+}
+
+// end
@@ -0,0 +1,87 @@
+//
+// test_onlinesampler.cxx --- check the TOnlineSampler acceptance and prescales
+//
+
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "TOnlineSampler.hxx"
+
+static int gCountFail = 0;
+
+static void report_fail(const char* text)
+{
+   printf("FAIL: %s\n", text);
+   gCountFail++;
+}
+
+static void check(const char* what, double value, double expected, double tolerance)
+{
+   printf("%s: %g, expected %g\n", what, value, expected);
+   if (fabs(value - expected) > tolerance)
+      report_fail(what);
+}
+
+int main(int argc, char* argv[])
+{
+   TOnlineSampler s(0.5, 0);
+
+   // within the budget everything is accepted
+
+   int accepted = 0;
+   for (int i=0; i<1000; i++)
+      accepted += s.Accept(1, time(NULL));
+   check("accepted without load", accepted, 1000, 0);
+   check("prescale without load", s.GetPrescale(), 1.0, 0);
+
+   // a busy analysis: the acceptance goes down by the largest step, 4
+
+   s.Processed(10.0);
+   sleep(1);
+   s.Accept(1, time(NULL));
+   check("acceptance after overload", s.GetAcceptance(), 0.25, 1e-9);
+
+   // event ID 2 has weight 4, all of it is accepted, event ID 1 one in 4,
+   // evenly spread
+
+   s.SetWeight(2, 4.0);
+   s.Reset();
+
+   int accepted1 = 0;
+   int accepted2 = 0;
+   int longest_gap = 0;
+   int gap = 0;
+   for (int i=0; i<10000; i++) {
+      if (s.Accept(1, time(NULL))) {
+         accepted1++;
+         if (gap > longest_gap)
+            longest_gap = gap;
+         gap = 0;
+      } else
+         gap++;
+      accepted2 += s.Accept(2, time(NULL));
+   }
+
+   check("accepted event ID 1", accepted1, 2500, 0);
+   check("accepted event ID 2", accepted2, 10000, 0);
+   check("longest run of rejected event ID 1", longest_gap, 3, 0);
+   check("prescale of event ID 1", s.GetPrescale(1), 4.0, 1e-9);
+   check("prescale of event ID 2", s.GetPrescale(2), 1.0, 1e-9);
+   check("prescale of all events", s.GetPrescale(), 20000.0/12500.0, 1e-9);
+   check("prescale of an event ID never seen", s.GetPrescale(3), 1.0, 0);
+
+   s.Reset();
+   check("prescale of event ID 1 after Reset()", s.GetPrescale(1), 1.0, 0);
+
+   if (gCountFail) {
+      printf("test_onlinesampler: %d failures\n", gCountFail);
+      return 1;
+   }
+
+   printf("test_onlinesampler: PASS\n");
+   return 0;
+}
+
+// end
@@ -0,0 +1,201 @@
+//
+// test_waveformdsp.cxx --- known answers and benchmark of TWaveformDSP
+//
+// Checks baseline, peak, constant fraction time, integral and pile-up of
+// waveforms with known answers, and the running baseline against a direct
+// average, then reports how many waveforms per second Analyze() does.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <sys/time.h>
+#include <vector>
+
+#include "TWaveformDSP.hxx"
+
+static double GetTimeSec()
+{
+   struct timeval tv;
+   gettimeofday(&tv, NULL);
+   return tv.tv_sec + 0.000001*tv.tv_usec;
+}
+
+static int gCountFail = 0;
+
+static void report_fail(const char* text)
+{
+   printf("FAIL: %s\n", text);
+   gCountFail++;
+}
+
+static void check(const char* what, double value, double expected)
+{
+   printf("%s: %g, expected %g\n", what, value, expected);
+   if (fabs(value - expected) > 1e-6)
+      report_fail(what);
+}
+
+// negative pulse on a baseline of 1000 with noise of +-1 in the baseline samples
+static std::vector<uint32_t> NegativePulse()
+{
+   std::vector<uint32_t> s(100, 1000);
+   for (int i=0; i<16; i++)
+      s[i] = (i%2) ? 1001 : 999;
+   s[48] = 980;
+   s[49] = 960;
+   s[50] = 900;
+   s[51] = 940;
+   s[52] = 970;
+   return s;
+}
+
+static void TestNegativePulse()
+{
+   TWaveformDSP dsp;
+   TWaveformResult r = dsp.Analyze(NegativePulse());
+
+   check("baseline", r.fBaseline, 1000);
+   check("baseline RMS", r.fBaselineRMS, 1);
+   check("amplitude", r.fAmplitude, 100);
+   check("peak sample", r.fPeakSample, 50);
+   // 50% of 100 between samples 49 (40) and 50 (100)
+   check("CFD time", r.fTime, 49 + 10.0/60.0);
+   check("integral", r.fIntegral, 20 + 40 + 100 + 60 + 30);
+   check("pulses", r.fNPulses, 1);
+   check("pile-up", r.fPileUp, 0);
+}
+
+static void TestPositivePileUp()
+{
+   std::vector<uint32_t> s(200, 100);
+   s[60] = 150;
+   s[61] = 300;
+   s[62] = 200;
+   s[120] = 250;
+
+   TWaveformDSP dsp;
+   dsp.SetPolarity(+1);
+   dsp.SetCFDFraction(0.25);
+   dsp.SetIntegrationWindow(2, 2);
+   TWaveformResult r = dsp.Analyze(s);
+
+   check("positive baseline", r.fBaseline, 100);
+   check("positive amplitude", r.fAmplitude, 200);
+   check("positive peak sample", r.fPeakSample, 61);
+   // 25% of 200 is sample 60 (50): the interpolation ends on it
+   check("positive CFD time", r.fTime, 60);
+   check("positive integral", r.fIntegral, 50 + 200 + 100);
+   check("positive pulses", r.fNPulses, 2);
+   check("positive pile-up", r.fPileUp, 1);
+}
+
+static void TestEmpty()
+{
+   TWaveformDSP dsp;
+   TWaveformResult r = dsp.Analyze(std::vector<uint32_t>());
+   check("empty peak sample", r.fPeakSample, -1);
+
+   // no pulse over the threshold: no time
+   std::vector<uint32_t> s(50, 500);
+   s[25] = 490;
+   r = dsp.Analyze(s);
+   check("below threshold pulses", r.fNPulses, 0);
+   check("below threshold CFD time", r.fTime, -1);
+}
+
+static void TestRunningBaseline()
+{
+   const int n = 50;
+   std::vector<uint32_t> s(n);
+   for (int i=0; i<n; i++)
+      s[i] = 1000 + (i*7919)%13;
+
+   std::vector<float> b(n);
+   for (int window=1; window<=8; window++) {
+      TWaveformDSP::RunningBaseline(&s[0], n, window, &b[0]);
+      int bad = 0;
+      for (int i=0; i<n; i++) {
+         int lo = i - window/2;
+         int hi = lo + window;
+         if (lo < 0)
+            lo = 0;
+         if (hi > n)
+            hi = n;
+         double sum = 0;
+         for (int j=lo; j<hi; j++)
+            sum += s[j];
+         if (fabs(b[i] - sum/(hi - lo)) > 1e-3)
+            bad++;
+         // away from the ends the average is over exactly window samples
+         if (i >= window && i < n - window && hi - lo != window)
+            bad++;
+      }
+      if (bad) {
+         printf("running baseline with window %d: %d wrong samples\n", window, bad);
+         report_fail("running baseline");
+      }
+   }
+
+   // a ramp: the centred average of an odd window is the sample itself
+   for (int i=0; i<n; i++)
+      s[i] = 100 + i;
+   TWaveformDSP::RunningBaseline(&s[0], n, 5, &b[0]);
+   check("running baseline of a ramp, window 5", b[20], 120);
+   TWaveformDSP::RunningBaseline(&s[0], n, 4, &b[0]);
+   check("running baseline of a ramp, window 4", b[20], 119.5);
+}
+
+static void Benchmark(int nwaveforms, int nsamples)
+{
+   std::vector<uint32_t> s((size_t)nwaveforms*nsamples);
+   srand(1);
+   for (int w=0; w<nwaveforms; w++) {
+      uint32_t* p = &s[(size_t)w*nsamples];
+      for (int i=0; i<nsamples; i++)
+         p[i] = 8000 + rand()%8;
+      int t = 100 + rand()%(nsamples - 200);
+      for (int i=0; i<50; i++)
+         p[t + i] -= (uint32_t)(2000*exp(-i/10.0)*(1 - exp(-i/2.0)));
+   }
+
+   std::vector<TWaveformResult> r(nwaveforms);
+   TWaveformDSP dsp;
+
+   double t0 = GetTimeSec();
+   dsp.Analyze(&s[0], nwaveforms, nsamples, &r[0]);
+   double t1 = GetTimeSec();
+
+   int npulses = 0;
+   for (int w=0; w<nwaveforms; w++)
+      npulses += r[w].fNPulses;
+
+   printf("%d waveforms of %d samples, %d pulses: %.3f sec, %.0f waveforms/sec, %.0f M samples/sec\n",
+          nwaveforms, nsamples, npulses, t1 - t0, nwaveforms/(t1 - t0), (double)nwaveforms*nsamples/(t1 - t0)/1e6);
+
+   if (npulses < nwaveforms)
+      report_fail("benchmark waveforms without a pulse");
+}
+
+int main(int argc, char* argv[])
+{
+   int nwaveforms = 100000;
+   if (argc > 1)
+      nwaveforms = atoi(argv[1]);
+
+   TestNegativePulse();
+   TestPositivePileUp();
+   TestEmpty();
+   TestRunningBaseline();
+   Benchmark(nwaveforms, 1000);
+
+   if (gCountFail) {
+      printf("test_waveformdsp: %d failures\n", gCountFail);
+      return 1;
+   }
+
+   printf("test_waveformdsp: PASS\n");
+   return 0;
+}
+
+// end
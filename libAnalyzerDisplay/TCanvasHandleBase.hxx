@@ -6,17 +6,19 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
 #include <stdlib.h>
 
 #include "TRootEmbeddedCanvas.h"
 #include "TCanvas.h"
+#include "TH1.h"
 #include "TRootanaDisplay.hxx"
 
 class TRootanaDisplay;
 
 class TCanvasHandleBase{
  public:
-  TCanvasHandleBase(std::string tabName){fTabName=tabName;}
+  TCanvasHandleBase(std::string tabName){fTabName=tabName; fVisible=true;}
   virtual ~TCanvasHandleBase(){}
 
   /// Reset the histograms for this canvas
@@ -28,6 +30,16 @@ class TCanvasHandleBase{
   /// Plot the histograms for this canvas
   virtual void PlotCanvas(TDataContainer& dataContainer, TRootEmbeddedCanvas *embedCanvas) = 0;
 
+  /// Plot the histograms on an offscreen canvas, for the headless mode of TRootanaDisplay.
+  /// Returns false if nothing changed since the last call, or if this canvas
+  /// cannot be drawn without its GUI (the default).
+  virtual bool PlotCanvasHeadless(TDataContainer& dataContainer, TCanvas* canvas){ return false; }
+
+  /// Called when the display goes back to an event of its history: plots of a
+  /// single event that were filled by UpdateCanvasHistograms() show a newer
+  /// event and should be refilled from the data container given to PlotCanvas().
+  virtual void ShowingHistoryEvent(){}
+
   /// Take actions at begin run
   virtual void BeginRun(int transition,int run,int time){};
 
@@ -46,12 +58,48 @@ class TCanvasHandleBase{
   ///
   virtual void SetUpCompositeFrame(TGCompositeFrame*, TRootanaDisplay *display){}
 
+  /// Set by TRootanaDisplay: is this canvas on the tab being shown?
+  virtual void SetVisible(bool visible){ fVisible = visible; }
+  bool IsVisible(){ return fVisible; }
+
+protected:
+
+  /// For skipping redraws: returns false if key (whatever determines what
+  /// the canvas shows, e.g. histogram entries and button states) is the same
+  /// as at the previous call, ie. Draw()/Update() can be skipped.
+  bool IsChanged(const std::vector<double>& key){
+    if(key == fDrawnKey) return false;
+    fDrawnKey = key;
+    return true;
+  }
+
+  /// Make the next IsChanged() return true, e.g. after resetting the histograms
+  void ForceRedraw(){ fDrawnKey.clear(); }
+
+  /// Add what histogram h looks like to a key for IsChanged(): the entries
+  /// alone miss SetBinContent(), Scale() or a refill with the same number of entries.
+  static void AddHistogramKey(std::vector<double>& key, TH1* h){
+    if(!h){
+      key.push_back(0);
+      return;
+    }
+    Double_t stats[TH1::kNstat];
+    for(int i = 0; i < TH1::kNstat; i++) stats[i] = 0;
+    h->GetStats(stats);
+    key.push_back(h->GetEntries());
+    key.push_back(h->GetSumOfWeights());
+    key.insert(key.end(), stats, stats + TH1::kNstat);
+  }
+
 private:
   // Don't allow the user to use default constructor
   TCanvasHandleBase(){};
 
   std::string fTabName;
 
+  bool fVisible;
+  std::vector<double> fDrawnKey;
+
 };
 
 #endif
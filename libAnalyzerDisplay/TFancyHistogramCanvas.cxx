@@ -3,6 +3,8 @@
 #include "TMesytecData.hxx"
 #include "TH2.h"
 
+#include <math.h>
+
 ClassImp(TFancyHistogramCanvas)
 
 TFancyHistogramCanvas::TFancyHistogramCanvas(THistogramArrayBase* histoArray, 
@@ -49,6 +51,8 @@ TFancyHistogramCanvas::TFancyHistogramCanvas(THistogramArrayBase* histoArray,
   if(histoArray->HasAutoUpdate())
     fDisableAutoUpdate = histoArray->GetDisableAutoUpdate();
 
+  fSkippedUpdate = false;
+
 }
 
 TFancyHistogramCanvas::~TFancyHistogramCanvas(){
@@ -178,6 +182,7 @@ void TFancyHistogramCanvas::SetUpCompositeFrame(TGCompositeFrame *compFrame, TRo
 void TFancyHistogramCanvas::ResetCanvasHistograms(){
   for(unsigned int i = 0; i < fHistoArray->size(); i++)
     (*fHistoArray)[i]->Reset();
+  ForceRedraw();
 }
   
 /// Update the histograms for this canvas.
@@ -187,7 +192,29 @@ void TFancyHistogramCanvas::UpdateCanvasHistograms(TDataContainer& dataContainer
   // histogram updating will happen elsewhere.
   if(fDisableAutoUpdate) return;
 
+  // Histograms of a single event are not worth filling while they are not shown;
+  // PlotCanvas() fills them when the tab is selected.
+  if(fHistoArray->IsUpdateWhenPlotted() && !IsVisible()){
+    fSkippedUpdate = true;
+    return;
+  }
+
   fHistoArray->UpdateHistograms(dataContainer);
+  fSkippedUpdate = false;
+}
+
+void TFancyHistogramCanvas::ShowingHistoryEvent(){
+
+  // Only histograms of a single event can be refilled from another event;
+  // the others add up all events.
+  if(fDisableAutoUpdate) return;
+  if(fHistoArray->IsUpdateWhenPlotted())
+    fSkippedUpdate = true;
+}
+
+void TFancyHistogramCanvas::SetVisible(bool visible){
+  TCanvasHandleBase::SetVisible(visible);
+  fHistoArray->SetVisible(visible);
 }
 
 
@@ -203,17 +230,78 @@ void DrawHistogram(TH1* histo, std::string option = std::string("")){
   
 }
 
-/// Plot the histograms for this canvas
-void TFancyHistogramCanvas::PlotCanvas(TDataContainer& dataContainer, TRootEmbeddedCanvas *embedCanvas){
+/// What the histograms look like, for IsChanged()
+void TFancyHistogramCanvas::AddHistogramsKey(std::vector<double>& key){
+  key.push_back(fHistoArray->GetChangeCount());
+  for(unsigned int i = 0; i < fHistoArray->size(); i++){
+    TH1* h = (*fHistoArray)[i];
+    key.push_back((double)(size_t)h);
+    AddHistogramKey(key, h);
+  }
+}
 
+/// Without the GUI there are no buttons: draw the first 16 histograms together.
+bool TFancyHistogramCanvas::PlotCanvasHeadless(TDataContainer& dataContainer, TCanvas* c1){
+
+  if(fSkippedUpdate){
+    fHistoArray->UpdateHistograms(dataContainer);
+    fSkippedUpdate = false;
+  }
+
+  std::vector<double> key;
+  AddHistogramsKey(key);
+  if(!IsChanged(key))
+    return false;
 
-  TCanvas* c1 = embedCanvas->GetCanvas();
   c1->Clear();
 
+  int nhisto = fHistoArray->size();
+  if(nhisto > 16)
+    nhisto = 16;
+  if(nhisto > 1){
+    int nx = (int)ceil(sqrt((double)nhisto));
+    c1->Divide(nx, (nhisto + nx - 1)/nx);
+  }
+
+  for(int i = 0; i < nhisto; i++){
+    c1->cd(i+1);
+    if((*fHistoArray)[i]){
+      DrawHistogram((*fHistoArray)[i]);
+      (*fHistoArray)[i]->SetLineColor(1);
+    }
+  }
+
+  c1->Modified();
+  return true;
+}
+
+/// Plot the histograms for this canvas
+void TFancyHistogramCanvas::PlotCanvas(TDataContainer& dataContainer, TRootEmbeddedCanvas *embedCanvas){
+
+  if(fSkippedUpdate){
+    fHistoArray->UpdateHistograms(dataContainer);
+    fSkippedUpdate = false;
+  }
+
   int channel = fChannelCounterButton->GetNumberEntry()->GetIntNumber();
   if(fNumberChannelsInGroups > 1)
     channel = fGroupCounterButton->GetNumberEntry()->GetIntNumber() * fNumberChannelsInGroups
       + fChannelCounterButton->GetNumberEntry()->GetIntNumber();
+
+  // Skip drawing if neither the buttons nor the histograms changed since last time.
+  std::vector<double> key;
+  key.push_back(channel);
+  key.push_back(fMultiCanvasButton->IsOn());
+  for(int i = 0; i < 4; i++)
+    key.push_back(fNCanvasButtons[i]->IsOn());
+  key.push_back(fOverlayHistoButton->IsOn());
+  key.push_back(fNHistoButton->GetNumberEntry()->GetIntNumber());
+  AddHistogramsKey(key);
+  if(!IsChanged(key))
+    return;
+
+  TCanvas* c1 = embedCanvas->GetCanvas();
+  c1->Clear();
   
   // Choose the display pattern based on which buttons have been pushed.
 
@@ -307,6 +395,7 @@ void TFancyHistogramCanvas::PlotCanvas(TDataContainer& dataContainer, TRootEmbed
 /// Take actions at begin run
 void TFancyHistogramCanvas::BeginRun(int transition,int run,int time){
   fHistoArray->BeginRun(transition, run, time);
+  ForceRedraw();
 };
 
 /// Take actions at end run  
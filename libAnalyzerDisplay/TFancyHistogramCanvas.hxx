@@ -58,6 +58,12 @@ public:
   /// Plot the histograms for this canvas
   void PlotCanvas(TDataContainer& dataContainer, TRootEmbeddedCanvas *embedCanvas);
 
+  /// Plot the histograms without GUI, see TRootanaDisplay::UseHeadlessRendering()
+  bool PlotCanvasHeadless(TDataContainer& dataContainer, TCanvas* canvas);
+
+  /// Refill histograms updated when plotted from the history event at the next PlotCanvas()
+  void ShowingHistoryEvent();
+
   /// Take actions at begin run
   void BeginRun(int transition,int run,int time);
 
@@ -66,6 +72,9 @@ public:
 
 
   void SetUpCompositeFrame(TGCompositeFrame *compFrame, TRootanaDisplay *display);
+
+  /// Also tells the histogram array whether it is shown
+  void SetVisible(bool visible);
   
   /// These methods are callbacks to ensure that multi-canvas and overlay-histo modes 
   /// are used exclusively.
@@ -79,6 +88,9 @@ public:
 
 private:
 
+  /// Add what the histograms look like to the key for IsChanged()
+  void AddHistogramsKey(std::vector<double>& key);
+
   /// Pointer to the THistogramArrayBase class; memory is not owned by TFancyHistogramCanvas.
   THistogramArrayBase* fHistoArray;
 
@@ -86,6 +98,10 @@ private:
   ///   -> the assumption is that the user will take care of calling this function.  
   bool fDisableAutoUpdate;
 
+  /// Set if the histograms do not show the current event: UpdateCanvasHistograms()
+  /// skipped updating histograms that are not shown, or ShowingHistoryEvent()
+  bool fSkippedUpdate;
+
   /// 'fNumberChannelsInGroups': if this value is greater than 1, then the fancy canvas
   /// will have an additional button allowing the user to specify particular groups;
   /// the histograms will be organized into size/fNumberChannelsInGroups of groups,
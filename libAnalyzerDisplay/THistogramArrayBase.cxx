@@ -1,8 +1,19 @@
 #include "THistogramArrayBase.h"
 #include "TFancyHistogramCanvas.hxx"
+#include "TShardedHistogram.hxx"
+
+#include "TProfile.h"
+#include "TProfile2D.h"
+#include "TArrayD.h"
+#include "TArrayF.h"
+#include "TArrayI.h"
+#include "TArrayS.h"
+#include "TArrayC.h"
 
 
 THistogramArrayBase::~THistogramArrayBase(){
+  for(unsigned i = 0; i < fShards.size(); i++)
+    delete fShards[i];
   for(int i = size()-1; i >= 0 ; i--){
     delete (*this)[i];
     //delete tmp;
@@ -23,6 +34,219 @@ TCanvasHandleBase* THistogramArrayBase::CreateCanvas() {
   return new TFancyHistogramCanvas(this, fSubTabName);
 }
 
-  
-  
 
+
+// Simple loops over the bin array, which the compiler can vectorize.
+
+template <typename T>
+static void CopySamples(T* bins, const uint32_t* samples, int n, double offset)
+{
+  for(int k = 0; k < n; k++)
+    bins[k] = (T)(samples[k] - offset);
+}
+
+template <typename T>
+static void AddSamples(T* bins, const uint32_t* samples, int n, double offset)
+{
+  for(int k = 0; k < n; k++)
+    bins[k] += (T)(samples[k] - offset);
+}
+
+template <typename T>
+static void SetOrAdd(T* bins, const uint32_t* samples, int n, double offset, bool add)
+{
+  if(add)
+    AddSamples(bins, samples, n, offset);
+  else
+    CopySamples(bins, samples, n, offset);
+}
+
+/// Write samples straight into the bin array of a 1D histogram.
+/// Returns false if this is not a histogram we know the bin array of.
+static bool FastBins(TH1* h, int first_bin, const uint32_t* samples, int n, double offset, bool add)
+{
+  if(h->GetDimension() != 1 || h->InheritsFrom(TProfile::Class()))
+    return false;
+
+  // clip to the bins of the histogram, including underflow and overflow
+  int ncells = h->GetNcells();
+  int kmin = first_bin < 0 ? -first_bin : 0;
+  int kmax = ncells - first_bin < n ? ncells - first_bin : n;
+  int count = kmax - kmin;
+  if(count <= 0)
+    return true;
+
+  int bin = first_bin + kmin;
+  samples += kmin;
+
+  if(TArrayD* a = dynamic_cast<TArrayD*>(h))
+    SetOrAdd(a->fArray + bin, samples, count, offset, add);
+  else if(TArrayF* a = dynamic_cast<TArrayF*>(h))
+    SetOrAdd(a->fArray + bin, samples, count, offset, add);
+  else if(TArrayI* a = dynamic_cast<TArrayI*>(h))
+    SetOrAdd(a->fArray + bin, samples, count, offset, add);
+  else if(TArrayS* a = dynamic_cast<TArrayS*>(h))
+    SetOrAdd(a->fArray + bin, samples, count, offset, add);
+  else if(TArrayC* a = dynamic_cast<TArrayC*>(h))
+    SetOrAdd(a->fArray + bin, samples, count, offset, add);
+  else
+    return false;
+
+  // Same bookkeeping as SetBinContent(): count the entries, and
+  // zero the statistics so they are recomputed from the bins.
+  Double_t stats[TH1::kNstat];
+  for(int k = 0; k < TH1::kNstat; k++)
+    stats[k] = 0;
+  h->PutStats(stats);
+  h->SetEntries(h->GetEntries() + count);
+  return true;
+}
+
+void THistogramArrayBase::ClearBins(unsigned i){
+  TH1* h = GetHistogram(i);
+  if(!h) return;
+  MarkChanged();
+  h->Reset("ICES");
+}
+
+void THistogramArrayBase::SetBinContents(unsigned i, int first_bin, const uint32_t* samples, int n, double offset){
+  TH1* h = GetHistogram(i);
+  if(!h) return;
+  MarkChanged();
+
+  if(FastBins(h, first_bin, samples, n, offset, false))
+    return;
+
+  for(int k = 0; k < n; k++)
+    h->SetBinContent(first_bin + k, samples[k] - offset);
+}
+
+void THistogramArrayBase::AddBinContents(unsigned i, int first_bin, const uint32_t* samples, int n, double offset){
+  TH1* h = GetHistogram(i);
+  if(!h) return;
+  MarkChanged();
+
+  if(FastBins(h, first_bin, samples, n, offset, true))
+    return;
+
+  for(int k = 0; k < n; k++)
+    h->AddBinContent(first_bin + k, samples[k] - offset);
+}
+
+/// Find the bin of x on an axis with fixed size bins
+static inline int FixedBin(double x, double xmin, double scale, int nbins)
+{
+  double t = (x - xmin)*scale;
+  if(t < 0)
+    return 0;
+  // check the range before the cast, large values would overflow the int (NaN goes to the overflow bin)
+  if(!(t < nbins))
+    return nbins + 1;
+  return 1 + (int)t;
+}
+
+template <typename T>
+static void FillPersistenceBins(T* bins, const uint32_t* samples, int n, double x0, double dx, double offset,
+                                const TAxis* xaxis, const TAxis* yaxis)
+{
+  int nx = xaxis->GetNbins();
+  int ny = yaxis->GetNbins();
+  double xmin = xaxis->GetXmin();
+  double ymin = yaxis->GetXmin();
+  double xscale = nx/(xaxis->GetXmax() - xmin);
+  double yscale = ny/(yaxis->GetXmax() - ymin);
+
+  for(int k = 0; k < n; k++){
+    int binx = FixedBin(x0 + (k + 0.5)*dx, xmin, xscale, nx);
+    int biny = FixedBin(samples[k] - offset, ymin, yscale, ny);
+    bins[binx + (nx + 2)*biny] += 1;
+  }
+}
+
+void THistogramArrayBase::FillPersistence(unsigned i, const uint32_t* samples, int n, double x0, double dx, double offset){
+  TH1* h = GetHistogram(i);
+  if(!h || n <= 0) return;
+  MarkChanged();
+
+  const TAxis* xaxis = h->GetXaxis();
+  const TAxis* yaxis = h->GetYaxis();
+
+  // The fast path needs fixed size bins and no per-bin errors.
+  bool fast = h->GetDimension() == 2 && !h->InheritsFrom(TProfile2D::Class())
+    && xaxis->GetXbins()->GetSize() == 0 && yaxis->GetXbins()->GetSize() == 0
+    && h->GetSumw2N() == 0;
+
+  if(fast){
+    if(TArrayD* a = dynamic_cast<TArrayD*>(h))
+      FillPersistenceBins(a->fArray, samples, n, x0, dx, offset, xaxis, yaxis);
+    else if(TArrayF* a = dynamic_cast<TArrayF*>(h))
+      FillPersistenceBins(a->fArray, samples, n, x0, dx, offset, xaxis, yaxis);
+    else if(TArrayI* a = dynamic_cast<TArrayI*>(h))
+      FillPersistenceBins(a->fArray, samples, n, x0, dx, offset, xaxis, yaxis);
+    else if(TArrayS* a = dynamic_cast<TArrayS*>(h))
+      FillPersistenceBins(a->fArray, samples, n, x0, dx, offset, xaxis, yaxis);
+    else if(TArrayC* a = dynamic_cast<TArrayC*>(h))
+      FillPersistenceBins(a->fArray, samples, n, x0, dx, offset, xaxis, yaxis);
+    else
+      fast = false;
+  }
+
+  if(fast){
+    // statistics are recomputed from the bins when needed
+    Double_t stats[TH1::kNstat];
+    for(int k = 0; k < TH1::kNstat; k++)
+      stats[k] = 0;
+    h->PutStats(stats);
+    h->SetEntries(h->GetEntries() + n);
+    return;
+  }
+
+  for(int k = 0; k < n; k++)
+    h->Fill(x0 + (k + 0.5)*dx, samples[k] - offset);
+}
+
+void THistogramArrayBase::CreateShards(int max_threads){
+  // the previous histograms may be gone, anything not merged yet is dropped
+  for(unsigned i = 0; i < fShards.size(); i++)
+    delete fShards[i];
+  fShards.clear();
+
+  for(unsigned i = 0; i < size(); i++){
+    TH1* h = (*this)[i];
+    // profiles cannot be sharded, FillShard() fills them directly
+    if(h->InheritsFrom(TProfile::Class()) || h->InheritsFrom(TProfile2D::Class()))
+      fShards.push_back(0);
+    else
+      fShards.push_back(new TShardedHistogram(h, max_threads));
+  }
+}
+
+void THistogramArrayBase::FillShard(unsigned i, double x, double w){
+  if(i >= fShards.size()){
+    std::cerr << "Invalid index (=" << i
+              << ") requested in THistogramArrayBase::FillShard(), was CreateShards() called?" << std::endl;
+    return;
+  }
+  if(fShards[i])
+    fShards[i]->Fill(x, w);
+  else
+    GetHistogram(i)->Fill(x, w);
+}
+
+void THistogramArrayBase::FillShard(unsigned i, double x, double y, double w){
+  if(i >= fShards.size()){
+    std::cerr << "Invalid index (=" << i
+              << ") requested in THistogramArrayBase::FillShard(), was CreateShards() called?" << std::endl;
+    return;
+  }
+  if(fShards[i])
+    fShards[i]->Fill(x, y, w);
+  else
+    GetHistogram(i)->Fill(x, y, w);
+}
+
+void THistogramArrayBase::MergeShards(){
+  for(unsigned i = 0; i < fShards.size(); i++)
+    if(fShards[i])
+      fShards[i]->Merge();
+}
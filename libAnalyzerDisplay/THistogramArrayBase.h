@@ -5,12 +5,15 @@
 #include <iostream>
 #include <string>
 #include <stdlib.h>
+#include <stdint.h>
 
 #include "TCanvasHandleBase.hxx"
 #include "TDataContainer.hxx"
 #include "TH1F.h"
 #include <vector>
 
+class TShardedHistogram;
+
 /// Base class for user to create an array of histograms.
 /// Features of the histogram array
 /// i) Histograms are all defined together.
@@ -35,7 +38,7 @@ class THistogramArrayBase : public std::vector<TH1*> {
  public:
   THistogramArrayBase():fNumberChannelsInGroups(-1),fGroupName(""),fChannelName(""),
     fDisableAutoUpdate(false),fHasAutoUpdate(false),fSubTabName("DEFAULT"),fTabName(""),
-    fUpdateWhenPlotted(false){};
+    fUpdateWhenPlotted(false),fChangeCount(0),fVisible(true){};
 
   virtual ~THistogramArrayBase();
 
@@ -93,6 +96,61 @@ class THistogramArrayBase : public std::vector<TH1*> {
     return fUpdateWhenPlotted;
   }
   
+  /// Change counter, used by the display to skip redrawing histograms that did
+  /// not change. Fill() changes the number of entries, which is checked as well;
+  /// call MarkChanged() if you change the contents in some other way.
+  /// The fast filling methods below call it.
+  void MarkChanged(){ fChangeCount++; }
+  unsigned int GetChangeCount(){ return fChangeCount; }
+
+  /// Whether these histograms are on the tab being shown by the display
+  /// (always true without display). Histograms that are IsUpdateWhenPlotted()
+  /// need not be updated while they are not visible.
+  void SetVisible(bool visible){ fVisible = visible; }
+  bool IsVisible(){ return fVisible; }
+
+  /// Fast filling of waveforms, for plots of a single event or sums of waveforms.
+  /// These write the bin array of the histogram directly, instead of one
+  /// virtual SetBinContent() call per sample; histograms other than plain
+  /// TH1D/F/I/S/C (and TH2 for FillPersistence) fall back to SetBinContent()/Fill().
+
+  /// Set all bins of histogram i to zero.
+  void ClearBins(unsigned i);
+
+  /// Set n consecutive bins of histogram i, starting at bin first_bin (1 = first bin),
+  /// to samples[k] - offset. Samples outside the histogram are ignored.
+  void SetBinContents(unsigned i, int first_bin, const uint32_t* samples, int n, double offset = 0);
+  void SetBinContents(unsigned i, int first_bin, const std::vector<uint32_t>& samples, double offset = 0){
+    if(!samples.empty()) SetBinContents(i, first_bin, &samples[0], samples.size(), offset);
+  }
+
+  /// Add samples[k] - offset to n consecutive bins of histogram i, for "sum of waveforms" plots.
+  void AddBinContents(unsigned i, int first_bin, const uint32_t* samples, int n, double offset = 0);
+  void AddBinContents(unsigned i, int first_bin, const std::vector<uint32_t>& samples, double offset = 0){
+    if(!samples.empty()) AddBinContents(i, first_bin, &samples[0], samples.size(), offset);
+  }
+
+  /// Fill 2D persistence histogram i with a whole waveform, one entry per sample
+  /// at x = x0 + (k+0.5)*dx, y = samples[k] - offset.
+  void FillPersistence(unsigned i, const uint32_t* samples, int n, double x0, double dx, double offset = 0);
+  void FillPersistence(unsigned i, const std::vector<uint32_t>& samples, double x0, double dx, double offset = 0){
+    if(!samples.empty()) FillPersistence(i, &samples[0], samples.size(), x0, dx, offset);
+  }
+
+  /// Filling from several threads: call CreateShards() at the end of CreateHistograms()
+  /// and use FillShard() instead of GetHistogram(i)->Fill(). Each thread fills
+  /// its own copy of the bins; they are added into the histograms by
+  /// MergeShards() or TShardedHistogram::MergeAll(), from the main thread.
+  /// Profiles cannot be sharded: FillShard() fills them directly, so only
+  /// fill them from the main thread.
+  void CreateShards(int max_threads = 64);
+  void FillShard(unsigned i, double x, double w = 1.0);
+  void FillShard(unsigned i, double x, double y, double w);
+  void MergeShards();
+
+  /// The shards of histogram i, NULL if CreateShards() was not called or for a profile
+  TShardedHistogram* GetShards(unsigned i){ return i < fShards.size() ? fShards[i] : 0; }
+
   /// If you are creating a specialized canvas (for example, showing several
   /// different plots in the same canvas) you should implement this function.
   /// If you are just creating a standard histogram canvas, you do not need
@@ -144,6 +202,12 @@ private:
   // Some histograms should only get updated when they are being plotted
   // This is mainly for histograms that show a single event (as opposed to cumulative histograms)
   bool fUpdateWhenPlotted;
+
+  unsigned int fChangeCount;
+  bool fVisible;
+
+  // Per-thread filling of the histograms, see CreateShards()
+  std::vector<TShardedHistogram*> fShards;
   
 };
 
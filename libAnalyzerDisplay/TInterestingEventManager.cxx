@@ -1,5 +1,78 @@
 #include "TInterestingEventManager.hxx"
 
+#include "TDataContainer.hxx"
+#include "TMidasEvent.h"
+#include "midasio.h"
+
+#include <stdio.h>
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/// State of the background scan of a file, shared with the scanning thread.
+class TInterestingEventScan {
+public:
+  std::string fFilename;
+  int fFirst;                 ///< index of the first event scanned
+  std::thread fThread;
+  std::mutex fMutex;
+  std::condition_variable fCond;
+  std::deque<int> fFound;     ///< indices of the interesting events not yet shown, in file order
+  int fScanned;               ///< index of the next event to scan
+  bool fStop;
+};
+
+/// Do not run further ahead of the display than this many interesting events
+static const unsigned kMaxFound = 100000;
+
+static void ScanFile(TInterestingEventScan* scan, TInterestingEventManager::Predicate predicate)
+{
+  TMReaderInterface* reader = TMNewReader(scan->fFilename.c_str());
+
+  if (reader->fError) {
+    printf("TInterestingEventManager: cannot open input file \"%s\" for scanning\n",scan->fFilename.c_str());
+    delete reader;
+    return;
+  }
+
+  TDataContainer dataContainer;
+  int i=0;
+  int found=0;
+  while (1) {
+    TMidasEvent event;
+    if (!TMReadEvent(reader, &event))
+      break;
+
+    // same events as TRootanaEventLoop::ProcessMidasFile passes to the analysis
+    bool interesting = false;
+    int id = event.GetEventId() & 0xFFFF;
+    if (i >= scan->fFirst && id != 0x8000 && id != 0x8001 && id != 0x8002) {
+      event.SetBankList();
+      dataContainer.SetMidasEventPointer(event);
+      interesting = predicate(dataContainer);
+      dataContainer.CleanupEvent();
+    }
+
+    std::unique_lock<std::mutex> lock(scan->fMutex);
+    while (!scan->fStop && scan->fFound.size() >= kMaxFound)
+      scan->fCond.wait(lock);
+    if (scan->fStop)
+      break;
+    if (interesting) {
+      scan->fFound.push_back(i);
+      found++;
+    }
+    i++;
+    scan->fScanned = i;
+  }
+
+  reader->Close();
+  delete reader;
+
+  printf("TInterestingEventManager: scanned %d events of \"%s\", %d interesting\n",i,scan->fFilename.c_str(),found);
+}
 
 // Allocating and initializing GlobalClass's
 // static data member.  
@@ -9,6 +82,8 @@ TInterestingEventManager::TInterestingEventManager(){
 
   fEnabled = false;
   fInterestingEvent = false;
+  fPredicate = 0;
+  fScan = 0;
  
 };
 
@@ -19,3 +94,62 @@ TInterestingEventManager* TInterestingEventManager::instance()
     s_instance = new TInterestingEventManager();
   return s_instance;
 }
+
+bool TInterestingEventManager::CheckPredicate(TDataContainer& dataContainer){
+
+  if(fPredicate && fPredicate(dataContainer))
+    fInterestingEvent = true;
+  return fInterestingEvent;
+}
+
+void TInterestingEventManager::StartScan(const char* filename, int first){
+
+  if(!fPredicate) return;
+  if(fScan && fScan->fFilename == filename) return;
+
+  StopScan();
+
+  fScan = new TInterestingEventScan;
+  fScan->fFilename = filename;
+  fScan->fFirst = first;
+  fScan->fScanned = 0;
+  fScan->fStop = false;
+  fScan->fThread = std::thread(ScanFile, fScan, fPredicate);
+}
+
+void TInterestingEventManager::StopScan(){
+
+  if(!fScan) return;
+
+  {
+    std::lock_guard<std::mutex> lock(fScan->fMutex);
+    fScan->fStop = true;
+  }
+  fScan->fCond.notify_all();
+  fScan->fThread.join();
+
+  delete fScan;
+  fScan = 0;
+}
+
+int TInterestingEventManager::GetScanResult(int index){
+
+  if(!fScan) return -1;
+
+  std::lock_guard<std::mutex> lock(fScan->fMutex);
+
+  // forget the interesting events we have gone past
+  bool popped = false;
+  while(!fScan->fFound.empty() && fScan->fFound.front() < index){
+    fScan->fFound.pop_front();
+    popped = true;
+  }
+  if(popped)
+    fScan->fCond.notify_all();
+
+  if(index < fScan->fFirst || index >= fScan->fScanned)
+    return -1;
+  if(!fScan->fFound.empty() && fScan->fFound.front() == index)
+    return 1;
+  return 0;
+}
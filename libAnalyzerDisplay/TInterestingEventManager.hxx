@@ -1,6 +1,9 @@
 #ifndef TInterestingEventManager_hxx_seen
 #define TInterestingEventManager_hxx_seen
 
+class TDataContainer;
+class TInterestingEventScan;
+
 /// Singleton class for defining which events are interesting (and should be plotted).
 /// User needs to enable use of  TInterestingEventManager in program constructor
 ///  
@@ -27,6 +30,34 @@ public:
   /// Reset state of manager = set to not interesting event.
   void Reset(){ fInterestingEvent = false;}
 
+  /// Test of whether an event is interesting, using only the event data.
+  typedef bool (*Predicate)(TDataContainer& dataContainer);
+
+  /// Set a test for interesting events.  Events passing the test are
+  /// interesting, as if SetInteresting() was called.  Offline, TRootanaDisplay
+  /// also runs the test on a background thread reading ahead through the file,
+  /// so "Next Interesting" skips the events in between without processing them
+  /// (they are not added to the histograms).  The test must therefore not
+  /// use the histograms or any other state of the analysis.
+  void SetPredicate(Predicate predicate){fPredicate = predicate;}
+  Predicate GetPredicate(){return fPredicate;}
+
+  /// Run the test on this event; returns IsInteresting().
+  bool CheckPredicate(TDataContainer& dataContainer);
+
+  /// Start the background scan of a file, from the event at index first
+  /// (events counted from 0, see TRootanaEventLoop::GetCurrentEventIndex()).
+  /// Does nothing if this file is already being scanned.
+  void StartScan(const char* filename, int first = 0);
+
+  /// Stop the background scan.
+  void StopScan();
+
+  /// What the background scan found for the event at this index:
+  /// 1 = interesting, 0 = not interesting, -1 = not scanned (yet).
+  /// Indices must be asked in increasing order.
+  int GetScanResult(int index);
+
 private:
   
   // pointer to global object
@@ -40,6 +71,12 @@ private:
 
   // interesting event bool
   bool fInterestingEvent;   
+
+  // test for interesting events
+  Predicate fPredicate;
+
+  // background scan, if running
+  TInterestingEventScan* fScan;
   
 };
 
@@ -21,6 +21,9 @@ TMainDisplayWindow::TMainDisplayWindow(const TGWindow *p,UInt_t w,UInt_t h, bool
   fNumberSkipEventButton = 0;
   fTBrowser = 0;
   fNextInterestingButton = 0;
+  fPrevButton = 0;
+  fGotoButton = 0;
+  fGotoEventEntry = 0;
   fMainDisplayDefaultWidth = w;
   fMainDisplayDefaultHeight = h;
 
@@ -42,6 +45,9 @@ TMainDisplayWindow::TMainDisplayWindow(const TGWindow *p,UInt_t w,UInt_t h, bool
   // Set different options for bottom, depending on if using offline or online.
   if(fIsOffline){
 
+    fPrevButton = new TGTextButton(fHframe,"&Prev");
+    fHframe->AddFrame(fPrevButton, new TGLayoutHints(kLHintsCenterX,5,5,3,4));
+
     fNextButton = new TGTextButton(fHframe,"&Next");
     fHframe->AddFrame(fNextButton, new TGLayoutHints(kLHintsCenterX,5,5,3,4));
       
@@ -50,6 +56,13 @@ TMainDisplayWindow::TMainDisplayWindow(const TGWindow *p,UInt_t w,UInt_t h, bool
       fHframe->AddFrame(fNextInterestingButton, new TGLayoutHints(kLHintsCenterX,5,5,3,4));    
     }
 
+    fGotoEventEntry = new TGNumberEntry(fHframe, 0, 9,999, TGNumberFormat::kNESInteger,
+				  TGNumberFormat::kNEANonNegative);
+    fHframe->AddFrame(fGotoEventEntry, new TGLayoutHints(kLHintsTop | kLHintsLeft, 5, 5, 5, 5));
+
+    fGotoButton = new TGTextButton(fHframe,"&Goto event");
+    fHframe->AddFrame(fGotoButton, new TGLayoutHints(kLHintsCenterX,5,5,3,4));
+
   }else{
 
     fNumberSkipEventButton = new TGNumberEntry(fHframe, 0, 9,999, TGNumberFormat::kNESInteger,
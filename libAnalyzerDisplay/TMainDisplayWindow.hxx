@@ -42,6 +42,9 @@ class TMainDisplayWindow {
   TGTextButton  *fSaveCanvasButton;
   TGTextButton  *fOpenNewTBrowser;
 
+  // Button to go back to the previous event (offline)
+  TGTextButton  *fPrevButton;
+
   // Button to go to next event
   TGTextButton  *fNextButton;
 
@@ -63,6 +66,10 @@ class TMainDisplayWindow {
   // Button to set how many events to skip before plotting
   TGNumberEntry *fNumberSkipEventButton;
 
+  // Button and serial number entry to go to a particular event (offline)
+  TGTextButton  *fGotoButton;
+  TGNumberEntry *fGotoEventEntry;
+
   // save tbrowser to be able to delete.
   TBrowser* fTBrowser;
 
@@ -91,6 +98,12 @@ class TMainDisplayWindow {
   TGTextButton* GetResetButton(){ return fResetButton;}
   
   TGTextButton* GetNextButton(){ return fNextButton;}
+
+  TGTextButton* GetPrevButton(){ return fPrevButton;}
+
+  TGTextButton* GetGotoButton(){ return fGotoButton;}
+
+  TGNumberEntry* GetGotoEventEntry(){ return fGotoEventEntry;}
   
   TGTextButton* GetNextInterestingButton(){ return fNextInterestingButton;}
   
@@ -1,19 +1,79 @@
 #include "TRootanaDisplay.hxx"
+#include "TShardedHistogram.hxx"
 #include "TPad.h"
 #include "TSystem.h"
+#include "TTimer.h"
+#include "TROOT.h"
+#include "TCanvas.h"
+#include "TH1.h"
+#include "TImage.h"
+#include "RVersion.h"
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,0,0)
+#include "TBufferJSON.h"
+#endif
+#include "TPeriodicClass.hxx"
 #include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <ctype.h>
 #include "math.h"
 
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
 #ifndef NO_CINT
 ClassImp(TRootanaDisplay)
 #endif
 
+/// Timer that redraws the plots online, see TRootanaDisplay::RedrawTimerAction()
+class TDisplayRedrawTimer : public TTimer
+{
+public:
+  TRootanaDisplay* fDisplay;
+
+  TDisplayRedrawTimer(TRootanaDisplay* display) : fDisplay(display)
+  {
+    Start(100, kTRUE);
+  }
+
+  Bool_t Notify()
+  {
+    // run again after the time the display asks for
+    Start(fDisplay->RedrawTimerAction(), kTRUE);
+    return kTRUE;
+  }
+
+  ~TDisplayRedrawTimer()
+  {
+    TurnOff();
+  }
+};
+
 TRootanaDisplay::TRootanaDisplay() 
 {
   fNumberSkipEventsOnline = 5; 
+  fEventsSinceUpdate = 0;
+  fMaxFrameRate = 10.0;
+  fRenderBudget = 0.25;
+  fRenderCost = 0.0;
+  fRedrawTimer = 0;
+  fMainWindow = 0;
+
+  fHeadless = false;
+  fHeadlessPeriod = 10.0;
+  fHeadlessPng = true;
+  fHeadlessJson = false;
+  fLastRenderTime = 0.0;
   fNumberSkipEventsOffline = 0;
   fNumberProcessed = 0;
   fCachedDataContainer = 0;
+  fEventHistorySize = 100;
+  fHistoryPos = -1;
+  fGotoSerial = -1;
+  fGotoEventId = -1;
   fSecondsBeforeUpdating = 2.0;
   fLastUpdateTime = 0.0;
 
@@ -33,11 +93,24 @@ TRootanaDisplay::TRootanaDisplay()
 
 }
 
+static void WaitHeadlessWriter();
+
 TRootanaDisplay::~TRootanaDisplay() {
 
+  delete fRedrawTimer;
+
+  iem_t::instance()->StopScan();
+
+  WaitHeadlessWriter();
+  for(unsigned int i = 0; i < fHeadlessCanvases.size(); i++)
+    delete fHeadlessCanvases[i];
+
   for(unsigned int i = 0; i < fCanvasHandlers.size(); i++)
     delete fCanvasHandlers[i].second;
 
+  for(unsigned int i = 0; i < fEventHistory.size(); i++)
+    delete fEventHistory[i];
+
 };
 
 
@@ -70,6 +143,13 @@ void TRootanaDisplay::InitializeMainWindow(){
   // The next button
   fMainWindow->GetNextButton()->Connect("Clicked()", "TRootanaDisplay", this, "NextButtonPushed()");
 
+  // The prev and goto buttons
+  if(!IsOnline()){
+    fMainWindow->GetPrevButton()->Connect("Clicked()", "TRootanaDisplay", this, "PrevButtonPushed()");
+    fMainWindow->GetGotoButton()->Connect("Clicked()", "TRootanaDisplay", this, "GotoButtonPushed()");
+    fMainWindow->GetGotoEventEntry()->GetNumberEntry()->Connect("ReturnPressed()", "TRootanaDisplay", this, "GotoButtonPushed()");
+  }
+
   // The next interesting button
   if(iem_t::instance()->IsEnabled())
     fMainWindow->GetNextInterestingButton()->Connect("Clicked()", "TRootanaDisplay", this, "NextInterestingButtonPushed()");
@@ -99,11 +179,30 @@ void TRootanaDisplay::InitializeMainWindow(){
   // Now map out window.
   GetDisplayWindow()->BuildWindow();
 
+  // Online the plots are redrawn at a limited rate, separately from event processing.
+  if(IsOnline())
+    fRedrawTimer = new TDisplayRedrawTimer(this);
 
 }
  
 
 void TRootanaDisplay::AddSingleCanvas(TCanvasHandleBase* handleClass, std::string subtab_name){
+
+  if(fHeadless){
+    // No tabs: an offscreen canvas named after the tab
+    std::string name = handleClass->GetTabName();
+    if(subtab_name != "")
+      name = subtab_name + "_" + name;
+    for(unsigned int i = 0; i < name.size(); i++)
+      if(!isalnum(name[i]) && name[i] != '-')
+        name[i] = '_';
+
+    TCanvas* canvas = new TCanvas(name.c_str(), handleClass->GetTabName().c_str(), 1200, 800);
+    fHeadlessCanvases.push_back(canvas);
+    fHeadlessNames.push_back(name);
+    fCanvasHandlers.push_back(std::make_pair(std::make_pair(-1,(int)fCanvasHandlers.size()), handleClass));
+    return;
+  }
   
   std::pair<int,int> index = GetDisplayWindow()->AddCanvas(handleClass->GetTabName(),subtab_name);
 
@@ -132,7 +231,9 @@ bool TRootanaDisplay::ProcessMidasEvent(TDataContainer& dataContainer){
 
   iem_t::instance()->Reset(); // Reset the interesting event manager each event.
 
-  if(IsOnline()){
+  if(fHeadless){
+    return ProcessMidasEventHeadless(dataContainer);
+  }else if(IsOnline()){
     return ProcessMidasEventOnline(dataContainer);
   }else{
     return ProcessMidasEventOffline(dataContainer);
@@ -156,29 +257,10 @@ bool TRootanaDisplay::ProcessMidasEventOnline(TDataContainer& dataContainer){
 
   }
 
-  // If processing is not paused, then just update plot and return
+  // If processing is not paused, then just return; the plots are
+  // redrawn from the redraw timer, see RedrawTimerAction().
   if(!fMainWindow->IsDisplayPaused()){
-    SetCachedDataContainer(dataContainer);
-    // Do canvas updating from user code; 
-    // we have two modes; we can either update after X seconds or X events
-    if(fUpdatingBasedSeconds){
-      struct timeval nowTime;  
-      gettimeofday(&nowTime, NULL);
-      
-      double dnowtime = nowTime.tv_sec  + (nowTime.tv_usec)/1000000.0;
-      double diffTime = dnowtime - fLastUpdateTime;
-      if(diffTime > fSecondsBeforeUpdating){
-        UpdatePlotsAction();
-        fLastUpdateTime = dnowtime;
-      }
-
-    }else{      
-      // only do plot if we have processed enough events
-      if(fNumberSkipEventsOnline == 1 || fNumberProcessed % fNumberSkipEventsOnline  == 1){      
-        UpdatePlotsAction();
-      }
-    }
-    
+    fEventsSinceUpdate++;
     return true;
   }
 
@@ -189,7 +271,7 @@ bool TRootanaDisplay::ProcessMidasEventOnline(TDataContainer& dataContainer){
   // interesting; if yes, then update plot and let user look at it.
   // If no, then just return (and check again for next event).
   if(!waitingForNextInterestingButton){
-    if(iem_t::instance()->IsInteresting()){
+    if(iem_t::instance()->CheckPredicate(*fCachedDataContainer)){
       std::cout << "Found next interesting event " << std::endl;
       UpdatePlotsAction();
     }else{
@@ -197,31 +279,12 @@ bool TRootanaDisplay::ProcessMidasEventOnline(TDataContainer& dataContainer){
     }
   }
 
-  // If online and paused, then keep looping till the free-flowing button or
-  // next button is pushed.
+  // If online and paused, then keep showing this event till the free-flowing
+  // button or next button is pushed. We do not wait here: the ROOT event loop
+  // keeps handling the GUI and draining MIDAS events, which are ignored
+  // (see above) while we are paused.
   waitingForNextButton = true;
   waitingForNextInterestingButton = true;
-  while(1){
-    
-    // Add some sleeps; otherwise program takes 100% of CPU...
-    usleep(10000);
-
-    // Break out if no longer in paused state.
-    if(!fMainWindow->IsDisplayPaused()) break;    
-
-    // Break out if next button or next interesting button pressed.
-    if(!waitingForNextButton || !waitingForNextInterestingButton) break;
-     
-    // Check if quit button has been pushed.  See QuitButtonAction() for details
-    if(fQuitPushed) break;
-    
-    // Resize windows, if needed.
-    fMainWindow->ResetSize();
-    
-    // handle GUI events
-    gSystem->ProcessEvents(); 
-    
-  }
   return true;
 
 }
@@ -230,6 +293,23 @@ bool TRootanaDisplay::ProcessMidasEventOnline(TDataContainer& dataContainer){
 
 bool TRootanaDisplay::ProcessMidasEventOffline(TDataContainer& dataContainer){
 
+  // With a test for interesting events, scan the rest of the file in the
+  // background; when looking for the next interesting event, skip the events
+  // found not interesting without processing them.
+  iem_t* iem = iem_t::instance();
+  if(iem->IsEnabled() && iem->GetPredicate()
+     && fNumberSkipEventsOffline < fNumberProcessed && fNumberSkipEventsOffline != -1){
+    int index = GetCurrentEventIndex();
+    if(iem->GetScanResult(index) == -1){
+      EnableRootThreads();
+      iem->StartScan(GetCurrentFileName().c_str(), index);
+    }
+    if(!waitingForNextInterestingButton && iem->GetScanResult(index) == 0){
+      // keep the GUI alive while skipping
+      if(fNumberProcessed % 1000 == 0) gSystem->ProcessEvents();
+      return true;
+    }
+  }
 
   SetCachedDataContainer(dataContainer);
   
@@ -243,11 +323,21 @@ bool TRootanaDisplay::ProcessMidasEventOffline(TDataContainer& dataContainer){
     return true;
   }
 
+  // Keep reading until we reach the event asked for with the goto button
+  if(fGotoSerial >= 0){
+    TMidasEvent& event = fCachedDataContainer->GetMidasData();
+    if(fGotoEventId >= 0 && event.GetEventId() != fGotoEventId)
+      return true;
+    if((int)event.GetSerialNumber() < fGotoSerial)
+      return true;
+    fGotoSerial = -1;
+  }
+
   // If we pressed the next interesting button, then check if this event was
   // interesting; if yes, then update plot and let user look at it.
   // If no, then just return (and check again for next event).
   if(!waitingForNextInterestingButton){
-    if(!iem_t::instance()->IsInteresting()){
+    if(!iem_t::instance()->CheckPredicate(*fCachedDataContainer)){
       return true;
     }else{
       std::cout << "Found next interesting event " << std::endl;
@@ -259,53 +349,139 @@ bool TRootanaDisplay::ProcessMidasEventOffline(TDataContainer& dataContainer){
   // Reset clock for next time 'FreeRunning' is pushed.
   double firstFreeRunningTime = 0.0;
   
-  // If offline, then keep looping till the next event button is pushed.
+  // If offline, then wait till the next event button is pushed.
   waitingForNextButton = true;
   waitingForNextInterestingButton = true;
   while(1){
     
-    // Add some sleeps; otherwise program takes 100% of CPU...
-    usleep(10000);
-
     // Break out if next button or next interesting button pressed.
     if(!waitingForNextButton || !waitingForNextInterestingButton) break;
 
+    // Check if quit button has been pushed.  See QuitButtonAction() for details
+    if(fQuitPushed) break;
+
     // In offline free-running mode, go to next event after a couple seconds.
+    double timeout = -1;
     if(fMainWindow->IsDisplayFreeRunning()){
-      struct timeval nowTime;  
-      gettimeofday(&nowTime, NULL);
-      
-      double dnowtime = nowTime.tv_sec  + (nowTime.tv_usec)/1000000.0;
-      if(fabs(firstFreeRunningTime) < 0.00000001){ // first event of free-running...
-	firstFreeRunningTime = dnowtime; // ... so, start the clock
-      }else{ // otherwise, check if enough seconds elapsed.
-	double diffTime = dnowtime - firstFreeRunningTime;
-	if(diffTime > fSecondsBeforeUpdating){
-	  firstFreeRunningTime = 0.0;
-	  break;
-	}
-      }
+      double dnowtime = GetTimeSec();
+      if(firstFreeRunningTime == 0.0) // first event of free-running...
+        firstFreeRunningTime = dnowtime; // ... so, start the clock
+      timeout = firstFreeRunningTime + fSecondsBeforeUpdating - dnowtime;
+      if(timeout <= 0)
+        break;
     }else{
       firstFreeRunningTime = 0.0;
     }
 
-    
+    // handle GUI events
+    WaitForGuiEvent(timeout);
+
     // Resize windows, if needed.
     fMainWindow->ResetSize();
     
-    // handle GUI events
-    gSystem->ProcessEvents(); 
-    
   }
   return true;
 
 }
 
+void TRootanaDisplay::NextButtonPushed(){
+
+  // Going back through the history: move forward in it first
+  if(fHistoryPos >= 0 && fHistoryPos + 1 < (int)fEventHistory.size()){
+    ShowHistoryEvent(fHistoryPos + 1);
+    return;
+  }
+
+  waitingForNextButton = false;
+  waitingForNextInterestingButton = true;
+}
+
+void TRootanaDisplay::PrevButtonPushed(){
+
+  if(fHistoryPos <= 0){
+    printf("No earlier event in the history of the last %u events\n",fEventHistorySize);
+    return;
+  }
+  ShowHistoryEvent(fHistoryPos - 1);
+}
+
+void TRootanaDisplay::GotoButtonPushed(){
+
+  int serial = fMainWindow->GetGotoEventEntry()->GetNumberEntry()->GetIntNumber();
+
+  // Serial numbers are counted per event ID: look for the ID of the event shown
+  int eventId = fCachedDataContainer ? fCachedDataContainer->GetMidasData().GetEventId() : -1;
+
+  // Look in the history, newest first
+  for(int i = (int)fEventHistory.size() - 1; i >= 0; i--){
+    if(IsGotoEvent(fEventHistory[i], serial, eventId)){
+      ShowHistoryEvent(i);
+      return;
+    }
+  }
+
+  // Oldest event of the history with this event ID
+  for(unsigned int i = 0; i < fEventHistory.size(); i++){
+    TMidasEvent& event = fEventHistory[i]->GetMidasData();
+    if(eventId >= 0 && event.GetEventId() != eventId)
+      continue;
+    if(serial < (int)event.GetSerialNumber()){
+      printf("Event %i is older than the history of the last %u events; cannot go back to it\n",
+             serial,fEventHistorySize);
+      return;
+    }
+    break;
+  }
+
+  // Not read yet: read forward till we get there
+  printf("Looking for event %i with event ID %i\n",serial,eventId);
+  fGotoSerial = serial;
+  fGotoEventId = eventId;
+  waitingForNextButton = false;
+  waitingForNextInterestingButton = true;
+}
+
+bool TRootanaDisplay::IsGotoEvent(TDataContainer* event, int serial, int eventId){
+
+  TMidasEvent& midas = event->GetMidasData();
+  if(eventId >= 0 && midas.GetEventId() != eventId)
+    return false;
+  return (int)midas.GetSerialNumber() == serial;
+}
+
+void TRootanaDisplay::ShowHistoryEvent(int pos){
+
+  fHistoryPos = pos;
+  fCachedDataContainer = fEventHistory[pos];
+  for(unsigned int i = 0; i < fCanvasHandlers.size(); i++)
+    fCanvasHandlers[i].second->ShowingHistoryEvent();
+  UpdatePlotsAction();
+}
+
+void TRootanaDisplay::SetCachedDataContainer(TDataContainer& dataContainer){
+
+  if(IsOnline() || fHeadless){
+    if(fCachedDataContainer) delete fCachedDataContainer;
+    fCachedDataContainer = new TDataContainer(dataContainer);
+    return;
+  }
+
+  // Offline, the copy goes into the event history, which owns it
+  fCachedDataContainer = new TDataContainer(dataContainer);
+  fEventHistory.push_back(fCachedDataContainer);
+  while(fEventHistory.size() > fEventHistorySize){
+    delete fEventHistory.front();
+    fEventHistory.pop_front();
+  }
+  fHistoryPos = fEventHistory.size() - 1;
+}
+
 void TRootanaDisplay::BeginRunRAD(int transition,int run,int time){
   
   std::cout << "Begin of run " << run << " at time " << time << std::endl;
   for(unsigned int i = 0; i < fCanvasHandlers.size(); i++)    
     fCanvasHandlers[i].second->BeginRun(transition,run,time);
+  if(fHeadless) return;
   UpdatePlotsAction();
 }
 
@@ -314,29 +490,59 @@ void TRootanaDisplay::EndRunRAD(int transition,int run,int time){
   std::cout << "End of run " << run << " at time " << time << std::endl;
   for(unsigned int i = 0; i < fCanvasHandlers.size(); i++)
     fCanvasHandlers[i].second->EndRun(transition,run,time);
+
+  iem_t::instance()->StopScan();
+
+  // a goto that did not find its event stops at the end of the run or file
+  fGotoSerial = -1;
+  fGotoEventId = -1;
+
+  if(fHeadless){
+    // the final plots of the run
+    RenderHeadless();
+    WaitHeadlessWriter();
+    return;
+  }
+
   UpdatePlotsAction();
 
   if(fNumberSkipEventsOffline == -1){
     // Pause the display
     while(1){
-      usleep(10000);
 
       // Break out if next button or next interesting button pressed.
       if(!waitingForNextButton || !waitingForNextInterestingButton) break;
 
-      // Resize windows, if needed.
-      fMainWindow->ResetSize();
+      if(fQuitPushed) break;
 
       // handle GUI events
-      gSystem->ProcessEvents();
+      WaitForGuiEvent(-1);
+
+      // Resize windows, if needed.
+      fMainWindow->ResetSize();
     }
   }
 }
 
 
+void TRootanaDisplay::WaitForGuiEvent(double timeout_sec){
+
+  // A single-shot timer wakes us up at the timeout;
+  // without one we block until there is something to do.
+  TTimer wakeup(0, kTRUE);
+  if(timeout_sec >= 0)
+    wakeup.Start((Long_t)(timeout_sec*1000) + 1, kTRUE);
+
+  gSystem->InnerLoop();
+}
+
+
 
 void TRootanaDisplay::UpdatePlotsAction(){
 
+  // Nothing to show in headless mode
+  if(!fMainWindow) return;
+
   if(!fCachedDataContainer){
     char displayTitle[200];
     sprintf(displayTitle,"%s (): run %i (no events yet)",
@@ -345,11 +551,21 @@ void TRootanaDisplay::UpdatePlotsAction(){
     return;
   }
     
+  double renderStart = GetTimeSec();
+
+  // Show what other threads filled into sharded histograms
+  TShardedHistogram::MergeAll();
+
+  // Only the canvas of the current tab is drawn; the others
+  // can skip work for plots that are only updated when shown.
+  std::pair<int,int> tabdex = GetDisplayWindow()->GetCurrentTabIndex();
+  for(unsigned int i = 0; i < fCanvasHandlers.size(); i++)
+    fCanvasHandlers[i].second->SetVisible(tabdex == fCanvasHandlers[i].first);
+
   // Execute the plotting actions from user event loop.
   PlotCanvas(*fCachedDataContainer);
   
   // See if we find a user class that describes this tab.
-  std::pair<int,int> tabdex = GetDisplayWindow()->GetCurrentTabIndex();
   for(unsigned int i = 0; i < fCanvasHandlers.size(); i++){
     if(tabdex == fCanvasHandlers[i].first){
       TRootEmbeddedCanvas* embed = GetDisplayWindow()->GetCurrentEmbeddedCanvas();
@@ -358,23 +574,66 @@ void TRootanaDisplay::UpdatePlotsAction(){
   }
     
   
+  // Update canvas and window sizes    
+  fMainWindow->ResetSize();
+
+  // Keep an average of the time it takes to redraw, for RedrawTimerAction()
+  double renderCost = GetTimeSec() - renderStart;
+  if(fRenderCost > 0)
+    fRenderCost = 0.8*fRenderCost + 0.2*renderCost;
+  else
+    fRenderCost = renderCost;
+
   // Set the display title
   char displayTitle[200];
-  if(IsOnline())
-    sprintf(displayTitle,"%s (online): run %i event %i",
+  if(IsOnline()){
+    sprintf(displayTitle,"%s (online): run %i event %i (redraw %.0f ms)",
 	    GetDisplayName().c_str(),GetCurrentRunNumber(),
-	    fCachedDataContainer->GetMidasData().GetSerialNumber());
-  else
+	    fCachedDataContainer->GetMidasData().GetSerialNumber(),
+	    1000.0*fRenderCost);
+  }else{
     sprintf(displayTitle,"%s (offline): run %i event %i",
 	    GetDisplayName().c_str(),GetCurrentRunNumber(),
 	    fCachedDataContainer->GetMidasData().GetSerialNumber());
-    
+    int back = (int)fEventHistory.size() - 1 - fHistoryPos;
+    if(fHistoryPos >= 0 && back > 0)
+      sprintf(displayTitle + strlen(displayTitle)," (%i back)",back);
+  }
+
   GetDisplayWindow()->GetMain()->SetWindowName(displayTitle);
+  
+}
 
+int TRootanaDisplay::RedrawTimerAction(){
 
-  // Update canvas and window sizes    
-  fMainWindow->ResetSize();
-  
+  // Time between redraws: at most fMaxFrameRate redraws per second, and
+  // no more than fRenderBudget of the time spent redrawing.
+  double period = 1.0/fMaxFrameRate;
+  if(fRenderBudget > 0 && fRenderCost/fRenderBudget > period)
+    period = fRenderCost/fRenderBudget;
+
+  double now = GetTimeSec();
+  if(fEventsSinceUpdate > 0 && !fMainWindow->IsDisplayPaused()
+     && now - fLastUpdateTime >= period){
+
+    // we have two modes; we can either update after X seconds or X events
+    bool update;
+    if(fUpdatingBasedSeconds)
+      update = now - fLastUpdateTime > fSecondsBeforeUpdating;
+    else
+      update = fEventsSinceUpdate >= fNumberSkipEventsOnline;
+
+    if(update){
+      UpdatePlotsAction();
+      fLastUpdateTime = now;
+      fEventsSinceUpdate = 0;
+    }
+  }
+
+  int msec = (int)(1000*period);
+  if(fUpdatingBasedSeconds && 1000*fSecondsBeforeUpdating < msec)
+    msec = (int)(1000*fSecondsBeforeUpdating);
+  return msec > 10 ? msec : 10;
 }
 
 void TRootanaDisplay::Reset(){
@@ -412,3 +671,181 @@ void TRootanaDisplay::QuitButtonAction()
   GetDisplayWindow()->CleanTBrowser();
     
 }
+
+
+
+/// _________________________________________________________________________
+/// Headless mode: the canvases are drawn and painted into memory on the
+/// analysis thread, which owns the ROOT graphics, and the bytes are
+/// written to files by a background thread.
+
+static std::mutex gHeadlessMutex;
+static std::condition_variable gHeadlessCond;
+static bool gHeadlessBusy = false;
+
+/// Write a file under a temporary name and rename it, so web pages never see half a file
+static void RenameRendered(const std::string& tmpname, const std::string& filename)
+{
+  if(rename(tmpname.c_str(), filename.c_str()) != 0)
+    printf("Cannot rename %s to %s, errno %d (%s)\n", tmpname.c_str(), filename.c_str(), errno, strerror(errno));
+}
+
+static void WriteRenderedFiles(std::vector<std::pair<std::string,std::string> > files)
+{
+  for(unsigned int i = 0; i < files.size(); i++){
+    const std::string& filename = files[i].first;
+    const std::string& data = files[i].second;
+
+    std::string tmpname = filename + ".tmp";
+    FILE* fp = fopen(tmpname.c_str(), "w");
+    if(!fp){
+      printf("Cannot write %s, errno %d (%s)\n", tmpname.c_str(), errno, strerror(errno));
+      continue;
+    }
+    fwrite(data.data(), 1, data.size(), fp);
+    fclose(fp);
+    RenameRendered(tmpname, filename);
+  }
+
+  std::lock_guard<std::mutex> lock(gHeadlessMutex);
+  gHeadlessBusy = false;
+  gHeadlessCond.notify_all();
+}
+
+static void WaitHeadlessWriter()
+{
+  std::unique_lock<std::mutex> lock(gHeadlessMutex);
+  while(gHeadlessBusy)
+    gHeadlessCond.wait(lock);
+}
+
+void TRootanaDisplay::UseHeadlessRendering(std::string directory, double period_sec, bool png, bool json){
+
+  fHeadless = true;
+  fHeadlessDir = directory;
+  if(fHeadlessDir == "")
+    fHeadlessDir = ".";
+  fHeadlessPeriod = period_sec;
+  fHeadlessPng = png;
+  fHeadlessJson = json;
+
+  // no X server needed
+  UseBatchMode();
+  EnableRootThreads();
+}
+
+void TRootanaDisplay::InitializeHeadless(){
+
+  mkdir(fHeadlessDir.c_str(), 0777);
+
+  // Let the user add all the canvases they want.
+  AddAllCanvases();
+
+  if(fCanvasHandlers.size() == 0){
+    std::cerr << "Error in TRootanaDisplay: you have not created any canvases; you must create at least one canvas. Exiting. " << std::endl;
+    exit(0);
+  }
+
+  // Nothing is shown between renderings, see RenderHeadless()
+  for(unsigned int i = 0; i < fCanvasHandlers.size(); i++)
+    fCanvasHandlers[i].second->SetVisible(false);
+
+#ifdef HAVE_THTTP_SERVER
+  if(GetTHttpServer()){
+    for(unsigned int i = 0; i < fHeadlessCanvases.size(); i++)
+      GetTHttpServer()->Register("/display", fHeadlessCanvases[i]);
+  }
+#endif
+
+  printf("Headless display: writing plots of %d tabs to %s every %.0f sec\n",
+         (int)fCanvasHandlers.size(), fHeadlessDir.c_str(), fHeadlessPeriod);
+}
+
+bool TRootanaDisplay::ProcessMidasEventHeadless(TDataContainer& dataContainer){
+
+  SetCachedDataContainer(dataContainer);
+
+  // Perform any histogram updating from user code.
+  UpdateHistograms(*fCachedDataContainer);
+  for(unsigned int i = 0; i < fCanvasHandlers.size(); i++)
+    fCanvasHandlers[i].second->UpdateCanvasHistograms(*fCachedDataContainer);
+
+  if(GetTimeSec() - fLastRenderTime >= fHeadlessPeriod)
+    RenderHeadless();
+
+  return true;
+}
+
+void TRootanaDisplay::RenderHeadless(){
+
+  if(!fCachedDataContainer)
+    return;
+
+  fLastRenderTime = GetTimeSec();
+
+  // the previous files are still being written: skip this time
+  {
+    std::lock_guard<std::mutex> lock(gHeadlessMutex);
+    if(gHeadlessBusy)
+      return;
+    gHeadlessBusy = true;
+  }
+
+  // Show what other threads filled into sharded histograms
+  TShardedHistogram::MergeAll();
+
+  for(unsigned int i = 0; i < fCanvasHandlers.size(); i++)
+    fCanvasHandlers[i].second->SetVisible(true);
+
+  // Execute the headless plotting actions from user event loop.
+  PlotCanvasHeadless(*fCachedDataContainer);
+
+  // Painting uses the ROOT graphics state, so it is done here; only
+  // writing the files is left to the writer thread.
+  std::vector<std::pair<std::string,std::string> > files;
+  for(unsigned int i = 0; i < fCanvasHandlers.size(); i++){
+    TCanvas* canvas = fHeadlessCanvases[i];
+    if(!fCanvasHandlers[i].second->PlotCanvasHeadless(*fCachedDataContainer, canvas))
+      continue;
+
+    std::string path = fHeadlessDir + "/" + fHeadlessNames[i];
+
+    if(fHeadlessPng){
+      // TImage::Create() returns NULL if ROOT has no libASImage
+      TImage* img = TImage::Create();
+      if(img){
+        img->FromPad(canvas);
+        char* buf = 0;
+        int size = 0;
+        img->GetImageBuffer(&buf, &size, TImage::kPng);
+        if(buf){
+          files.push_back(std::make_pair(path + ".png", std::string(buf, size)));
+          free(buf);
+        }
+        delete img;
+      }else{
+        printf("Headless display: cannot create a TImage, PNG files are not written\n");
+        fHeadlessPng = false;
+      }
+    }
+
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,0,0)
+    if(fHeadlessJson){
+      TString text = TBufferJSON::ConvertToJSON(canvas);
+      files.push_back(std::make_pair(path + ".json", std::string(text.Data(), text.Length())));
+    }
+#endif
+  }
+
+  for(unsigned int i = 0; i < fCanvasHandlers.size(); i++)
+    fCanvasHandlers[i].second->SetVisible(false);
+
+  if(files.empty()){
+    std::lock_guard<std::mutex> lock(gHeadlessMutex);
+    gHeadlessBusy = false;
+    return;
+  }
+
+  std::thread writer(WriteRenderedFiles, files);
+  writer.detach();
+}
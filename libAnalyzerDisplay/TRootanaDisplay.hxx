@@ -12,7 +12,11 @@
 #include "TCanvasHandleBase.hxx"
 #include "TInterestingEventManager.hxx"
 
+#include <deque>
+
 class TCanvasHandleBase;
+class TTimer;
+class TCanvas;
 
 /// This is an abstract base class for event displays.  
 /// Users need to define a class that derives from this class in order to 
@@ -69,6 +73,10 @@ public:
 
   /// Add a new canvas; user will interactively fill it.
   void AddSingleCanvas(std::string name, std::string subtab_name = std::string("")){
+    if(!fMainWindow){
+      std::cerr << "TRootanaDisplay: canvas " << name << " is not available in headless mode" << std::endl;
+      return;
+    }
     fMainWindow->AddCanvas(name,subtab_name);
   }
 
@@ -88,13 +96,33 @@ public:
   /// This method can be implemented by users to plotting of current canvas
   virtual void PlotCanvas(TDataContainer& dataContainer){};
 
+  /// Called instead of PlotCanvas() in headless mode, where there is no
+  /// display window; implement it if the plots need more than the canvases do.
+  /// Displays that fill per-event histograms in PlotCanvas() (for example
+  /// with TAnaManager::UpdateTransientPlots()) must fill them here too,
+  /// or these plots are empty in headless mode.
+  virtual void PlotCanvasHeadless(TDataContainer& dataContainer){};
+
   /// This method can be implemented by users to plotting of current canvas
   virtual void ResetHistograms(){};
 
   /// Method for when next button is pushed 
-  void NextButtonPushed(){
-    waitingForNextButton = false;
-    waitingForNextInterestingButton = true;
+  void NextButtonPushed();
+
+  /// Method for when prev button is pushed (offline): show the previous
+  /// event kept in the event history.
+  void PrevButtonPushed();
+
+  /// Method for when goto button is pushed (offline): show the event with
+  /// the serial number entered, from the event history if it is there,
+  /// else by reading forward through the file.
+  void GotoButtonPushed();
+
+  /// Number of past events kept offline for the prev and goto buttons (default 100).
+  /// Going back only redraws the plots: PlotCanvas() is called with the old
+  /// event, UpdateHistograms() is not.
+  void SetEventHistorySize(int size){
+    fEventHistorySize = size > 1 ? size : 1;
   }
 
   /// Method for when next interesting button is pushed 
@@ -148,17 +176,48 @@ public:
     fUpdatingBasedSeconds = updateBasedSeconds;
   }
 
+  /// Online, the plots of the current tab are redrawn from a timer rather than
+  /// after processing an event: at most maxFrameRate times per second, and
+  /// less often if redrawing would take more than renderBudget of the time.
+  void SetOnlineFrameRate(double maxFrameRate, double renderBudget = 0.25){
+    fMaxFrameRate = maxFrameRate;
+    fRenderBudget = renderBudget;
+  }
+
+  /// Called by the redraw timer in online mode; returns the msec till the next call.
+  int RedrawTimerAction();
+
+  /// Headless mode, without GUI or X server: every period_sec the canvases of all
+  /// tabs are drawn offscreen and written to directory as <tab>.png and/or
+  /// <tab>.json (ROOT JSON, for JSROOT web pages) by a background thread, and
+  /// they are registered with the THttpServer, if there is one.
+  /// Only canvases added as TCanvasHandleBase that implement PlotCanvasHeadless()
+  /// are rendered; PlotCanvas() is not called, PlotCanvasHeadless() of the
+  /// display is called instead (GetDisplayWindow() returns NULL), so move
+  /// histogram filling from PlotCanvas() into a function both call.
+  /// Call in the constructor of the display program; also option -B<directory>.
+  void UseHeadlessRendering(std::string directory, double period_sec = 10.0, bool png = true, bool json = false);
+
   /// Get Display name
   std::string GetDisplayName(){return fDisplayName;}
   /// Set Display name
   void SetDisplayName(std::string name){fDisplayName = name;}
   
   void InitializeRAD(){
-    InitializeMainWindow();
+    if(fHeadless)
+      InitializeHeadless();
+    else
+      InitializeMainWindow();
   }
 
   bool CheckOptionRAD(std::string option){
-    if(option.find("-s") != std::string::npos){
+    if(option.find("-B") == 0){
+      UseHeadlessRendering(option.substr(2), fHeadlessPeriod, fHeadlessPng, fHeadlessJson);
+      return true;
+    } else if(option == "-J"){
+      fHeadlessJson = true;
+      return true;
+    } else if(option.find("-s") != std::string::npos){
       std::string sub = option.substr(2);
       fNumberSkipEventsOffline = atoi(sub.c_str());
       printf("Will process %i events before plotting first event.\n",fNumberSkipEventsOffline);
@@ -173,6 +232,8 @@ public:
   void UsageRAD(){
     printf("\t-sYYY: will process YYY events before displaying (for display programs)\n");
     printf("\t-S: will process all events of a run before displaying (for display programs)\n");
+    printf("\t-B<dir>: headless mode, write the plots to PNG files in <dir> instead of showing them (for display programs)\n");
+    printf("\t-J: with -B, also write the plots as ROOT JSON files (for display programs)\n");
   }
 
 private:
@@ -180,6 +241,28 @@ private:
   /// Method to initialize the Main display window.
   void InitializeMainWindow();
 
+  /// Set up the offscreen canvases for headless mode.
+  void InitializeHeadless();
+
+  /// Draw all canvases offscreen and hand them to the writer thread.
+  void RenderHeadless();
+
+  /// Headless rendering, see UseHeadlessRendering()
+  bool fHeadless;
+  std::string fHeadlessDir;
+  double fHeadlessPeriod;
+  bool fHeadlessPng;
+  bool fHeadlessJson;
+  double fLastRenderTime;
+
+  /// Offscreen canvas and file name for each of fCanvasHandlers, in headless mode
+  std::vector<TCanvas*> fHeadlessCanvases; //!
+  std::vector<std::string> fHeadlessNames;
+
+  /// Wait for the user while paused: block in the ROOT event loop until a GUI,
+  /// timer or socket event has been handled, or at most timeout_sec (< 0: no limit).
+  void WaitForGuiEvent(double timeout_sec);
+
   // Variable to keep track of waiting for next event button 
   bool waitingForNextButton; 
 
@@ -200,6 +283,21 @@ private:
 
   double fLastUpdateTime;
 
+  /// Events processed since the plots were last redrawn (online)
+  int fEventsSinceUpdate;
+
+  /// Maximum online redraws per second
+  double fMaxFrameRate;
+
+  /// Maximum fraction of the time spent redrawing online
+  double fRenderBudget;
+
+  /// Average time to redraw the plots, in seconds
+  double fRenderCost;
+
+  /// Timer for redrawing the plots online
+  TTimer* fRedrawTimer; //!
+
   // Variable to keep track of number of processed events.
   int fNumberProcessed;
 
@@ -220,6 +318,9 @@ private:
   
   /// Process each offline midas event
   bool ProcessMidasEventOffline(TDataContainer& dataContainer);
+
+  /// Process each midas event in headless mode
+  bool ProcessMidasEventHeadless(TDataContainer& dataContainer);
   
   /// Called before the first event of a file is read, but you should prefer
   /// Initialize() for general initialization.  This method will be called
@@ -238,10 +339,28 @@ private:
   /// Set the cached copy of midas dataContainer.
   /// !!! This is very questionable!  Caching each dataContainer might add a considerable overhead
   /// to the processing!
-  void SetCachedDataContainer(TDataContainer& dataContainer){
-    if(fCachedDataContainer) delete fCachedDataContainer;
-    fCachedDataContainer = new TDataContainer(dataContainer);
-  }
+  /// Offline, the copies are kept in the event history.
+  void SetCachedDataContainer(TDataContainer& dataContainer);
+
+  /// The last events, offline; the newest is at the back.
+  std::deque<TDataContainer*> fEventHistory; //!
+  unsigned int fEventHistorySize;
+
+  /// Position in fEventHistory of the event shown
+  int fHistoryPos;
+
+  /// Serial number of the event we are reading forward to, or -1
+  int fGotoSerial;
+
+  /// Event ID of the event we are reading forward to (serial numbers are
+  /// counted per event ID), -1 for any
+  int fGotoEventId;
+
+  /// Is event the one asked for with the goto button?
+  bool IsGotoEvent(TDataContainer* event, int serial, int eventId);
+
+  /// Show an event of the history
+  void ShowHistoryEvent(int pos);
 
   /// Display name
   std::string fDisplayName;
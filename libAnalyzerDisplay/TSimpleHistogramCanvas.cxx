@@ -40,6 +40,7 @@ TSimpleHistogramCanvas::~TSimpleHistogramCanvas(){
 void TSimpleHistogramCanvas::ResetCanvasHistograms(){
   if(fHisto)fHisto->Reset();
   for(unsigned int i = 0; i < fExtraHistos.size(); i++) fExtraHistos[i]->Reset();
+  ForceRedraw();
 }
   
 /// Update the histograms for this canvas.
@@ -49,11 +50,51 @@ void TSimpleHistogramCanvas::UpdateCanvasHistograms(TDataContainer& dataContaine
 
 
 
+// Graphs have no entry count: use the number of points and their sum
+static void AddGraphKey(std::vector<double>& key, TGraph* graph){
+  double sum = 0;
+  for(int i = 0; i < graph->GetN(); i++)
+    sum += graph->GetX()[i] + graph->GetY()[i];
+  key.push_back(graph->GetN());
+  key.push_back(sum);
+}
+
 /// Plot the histograms for this canvas
 void TSimpleHistogramCanvas::PlotCanvas(TDataContainer& dataContainer, TRootEmbeddedCanvas *embedCanvas){
 
+  // Skip drawing if none of the histograms and graphs changed since last time.
+  if(!IsChanged(MakeKey()))
+    return;
 
   TCanvas* c1 = embedCanvas->GetCanvas();
+  DrawPlots(c1);
+  c1->Update();
+}
+
+bool TSimpleHistogramCanvas::PlotCanvasHeadless(TDataContainer& dataContainer, TCanvas* canvas){
+
+  if(!IsChanged(MakeKey()))
+    return false;
+
+  DrawPlots(canvas);
+  return true;
+}
+
+std::vector<double> TSimpleHistogramCanvas::MakeKey(){
+  std::vector<double> key;
+  if(fHisto)
+    AddHistogramKey(key, fHisto);
+  if(fGraph)
+    AddGraphKey(key, fGraph);
+  for(unsigned int i = 0; i < fExtraHistos.size(); i++)
+    AddHistogramKey(key, fExtraHistos[i]);
+  for(unsigned int i = 0; i < fExtraGraphs.size(); i++)
+    AddGraphKey(key, fExtraGraphs[i]);
+  return key;
+}
+
+void TSimpleHistogramCanvas::DrawPlots(TCanvas* c1){
+
   c1->Clear();
 
   if(fHisto){
@@ -78,9 +119,6 @@ void TSimpleHistogramCanvas::PlotCanvas(TDataContainer& dataContainer, TRootEmbe
   }
   
   c1->Modified();
-  c1->Update();
-
-
 }
 
 
@@ -88,6 +126,7 @@ void TSimpleHistogramCanvas::PlotCanvas(TDataContainer& dataContainer, TRootEmbe
 /// Take actions at begin run
 void TSimpleHistogramCanvas::BeginRun(int transition,int run,int time){
   if(fHisto)fHisto->Reset();
+  ForceRedraw();
 };
 
 /// Take actions at end run  
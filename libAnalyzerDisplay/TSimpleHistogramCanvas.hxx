@@ -30,6 +30,9 @@ public:
   /// Plot the histograms for this canvas
   void PlotCanvas(TDataContainer& dataContainer, TRootEmbeddedCanvas *embedCanvas);
 
+  /// Plot the histograms without GUI, see TRootanaDisplay::UseHeadlessRendering()
+  bool PlotCanvasHeadless(TDataContainer& dataContainer, TCanvas* canvas);
+
   /// Take actions at begin run
   void BeginRun(int transition,int run,int time);
 
@@ -48,6 +51,12 @@ public:
 
 private:
 
+  /// What the plots look like, for IsChanged()
+  std::vector<double> MakeKey();
+
+  /// Draw the plots on a canvas
+  void DrawPlots(TCanvas* c1);
+
   /// Pointer to the histogram 
   TH1* fHisto;
   /// Pointer to the graph 
@@ -0,0 +1,334 @@
+/********************************************************************\
+
+  Name:         TMidasReplay.cxx
+
+  Contents:     Stand-in for TMidasOnline, feeding events from a
+                MIDAS file through a simulated online data buffer
+
+\********************************************************************/
+
+#include "TMidasReplay.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "midasio.h"
+
+// MIDAS transition codes, same as TR_START and TR_STOP in midas.h
+static const int kTransitionStart = 1;
+static const int kTransitionStop  = 2;
+
+static double GetTimeNow()
+{
+  struct timeval tv;
+  gettimeofday(&tv,NULL);
+  return tv.tv_sec + 0.000001*tv.tv_usec;
+}
+
+TMidasReplay* TMidasReplay::gfReplay = NULL;
+
+TMidasReplay::TMidasReplay() // ctor
+{
+  fStartHandler  = 0;
+  fStopHandler   = 0;
+  fEventHandler  = 0;
+  fRunNumber     = 0;
+  fNumEvents     = 0;
+  fNumDelivered  = 0;
+  fNumDropped    = 0;
+  fSumLatency    = 0;
+  fMaxLatency    = 0;
+  fReader        = NULL;
+  fRate          = 0;
+  fSpeedup       = 0;
+  fBufferSize    = 32*1024*1024;
+  fBufferLevel   = 0;
+  fNext          = NULL;
+  fNextTime      = 0;
+  fStartTime     = 0;
+  fStartTimeStamp = 0;
+  fEndOfFile     = true;
+  fSecondTimeStamp = 0;
+  fSecondCount   = 0;
+  fPrevSecondCount = 0;
+}
+
+TMidasReplay::~TMidasReplay() // dtor
+{
+  disconnect();
+  assert(!"TMidasReplay::~TMidasReplay(): destruction of the TMidasReplay singleton is not permitted!");
+}
+
+TMidasReplay* TMidasReplay::instance()
+{
+  if (!gfReplay)
+    gfReplay = new TMidasReplay();
+
+  return gfReplay;
+}
+
+bool TMidasReplay::ReadNext()
+{
+  fNext = NULL;
+
+  while (1) {
+    TMidasEvent event;
+    if (!TMReadEvent(fReader, &event))
+      return false;
+
+    // log messages are not sent to the data buffers
+    if ((event.GetEventId() & 0xFFFF) == 0x8002)
+      continue;
+
+    fNumEvents++;
+
+    ReplayEvent* e = new ReplayEvent;
+    memcpy(&e->fHeader, event.GetEventHeader(), sizeof(TMidas_EVENT_HEADER));
+    e->fData.assign(event.GetData(), event.GetData() + event.GetDataSize());
+    e->fTime = 0;
+    fNext = e;
+
+    if (fSpeedup > 0) {
+      // MIDAS timestamps are in seconds: spread the events of each
+      // second evenly, using the event count of the previous second.
+      if (e->fHeader.fTimeStamp != fSecondTimeStamp) {
+        fPrevSecondCount = fSecondTimeStamp ? fSecondCount : 0;
+        fSecondTimeStamp = e->fHeader.fTimeStamp;
+        fSecondCount = 0;
+      }
+      double frac = 0;
+      if (fPrevSecondCount > 0)
+        frac = fSecondCount/(double)fPrevSecondCount;
+      if (frac > 0.999)
+        frac = 0.999;
+      fSecondCount++;
+      fNextTime = fStartTime + ((double)e->fHeader.fTimeStamp - fStartTimeStamp + frac)/fSpeedup;
+    }
+    else if (fRate > 0)
+      fNextTime = fStartTime + fNumEvents/fRate;
+    else
+      fNextTime = 0;
+
+    return true;
+  }
+}
+
+int TMidasReplay::connect(const char* filename)
+{
+  disconnect();
+
+  fReader = TMNewReader(filename);
+  if (fReader->fError) {
+    fprintf(stderr, "TMidasReplay::connect: Cannot open input file \"%s\"\n", filename);
+    delete fReader;
+    fReader = NULL;
+    return -1;
+  }
+
+  fFilename = filename;
+  fEndOfFile = false;
+  fNumEvents = 0;
+  fNumDelivered = 0;
+  fNumDropped = 0;
+  fSumLatency = 0;
+  fMaxLatency = 0;
+  fRunNumber = 0;
+
+  // The begin of run event is the state of the experiment when we "connect"
+  if (TMReadEvent(fReader, &fOdbEvent) && (fOdbEvent.GetEventId() & 0xFFFF) == 0x8000) {
+    fRunNumber = fOdbEvent.GetSerialNumber();
+    fStartTimeStamp = fOdbEvent.GetTimeStamp();
+  } else {
+    fprintf(stderr, "TMidasReplay::connect: File \"%s\" does not start with a begin of run event\n", filename);
+    disconnect();
+    return -1;
+  }
+
+  fStartTime = GetTimeNow();
+  fSecondTimeStamp = 0;
+  fSecondCount = 0;
+  fPrevSecondCount = 0;
+  if (!ReadNext())
+    fEndOfFile = true;
+
+  printf("Replaying file %s, run %d, ", filename, fRunNumber);
+  if (fSpeedup > 0)
+    printf("%g times real time", fSpeedup);
+  else if (fRate > 0)
+    printf("%g events/sec", fRate);
+  else
+    printf("as fast as possible");
+  printf(", buffer size %d bytes\n", fBufferSize);
+
+  return 0;
+}
+
+int TMidasReplay::disconnect()
+{
+  if (!fReader)
+    return 0;
+
+  printStats();
+
+  fReader->Close();
+  delete fReader;
+  fReader = NULL;
+
+  delete fNext;
+  fNext = NULL;
+  for (unsigned i=0; i<fBuffer.size(); i++)
+    delete fBuffer[i];
+  fBuffer.clear();
+  fBufferLevel = 0;
+  fEndOfFile = true;
+
+  return 0;
+}
+
+void TMidasReplay::setRate(double rate)
+{
+  fRate = rate;
+}
+
+void TMidasReplay::setRealTime(double speedup)
+{
+  fSpeedup = speedup;
+}
+
+void TMidasReplay::setBufferSize(int size)
+{
+  fBufferSize = size;
+}
+
+void TMidasReplay::Fill(double now)
+{
+  while (fNext && fNextTime <= now) {
+    int size = sizeof(TMidas_EVENT_HEADER) + fNext->fData.size();
+    bool transition = (fNext->fHeader.fEventId & 0xFFFF) == 0x8000 || (fNext->fHeader.fEventId & 0xFFFF) == 0x8001;
+
+    if (transition) {
+      // transitions do not go through the buffer, keep them in order with the events
+      size = 0;
+    } else if (fBufferLevel + size > fBufferSize) {
+      if (fRate <= 0 && fSpeedup <= 0 && size <= fBufferSize)
+        return; // as fast as possible: wait for the analyzer
+
+      // non-blocking event request: the event is lost for us
+      fNumDropped++;
+      delete fNext;
+      if (!ReadNext())
+        fEndOfFile = true;
+      continue;
+    }
+
+    // the event is "taken" now
+    fNext->fTime = now;
+    fNext->fHeader.fTimeStamp = (uint32_t)now;
+    fBuffer.push_back(fNext);
+    fBufferLevel += size;
+
+    if (!ReadNext())
+      fEndOfFile = true;
+  }
+}
+
+bool TMidasReplay::poll(int mdelay)
+{
+  if (!fReader)
+    return false;
+
+  double start = GetTimeNow();
+  double slice = (mdelay > 100 ? mdelay : 100)*0.001;
+
+  Fill(start);
+
+  if (fBuffer.empty()) {
+    if (fEndOfFile) {
+      printf("TMidasReplay::poll: end of file %s\n", fFilename.c_str());
+      disconnect();
+      return false;
+    }
+
+    // nothing to do until the next event is due
+    double wait = fNextTime - start;
+    if (wait > mdelay*0.001)
+      wait = mdelay*0.001;
+    if (wait > 0)
+      usleep((useconds_t)(wait*1e6));
+    return true;
+  }
+
+  while (!fBuffer.empty()) {
+    ReplayEvent* e = fBuffer.front();
+    fBuffer.pop_front();
+
+    int id = e->fHeader.fEventId & 0xFFFF;
+
+    if (id == 0x8000 || id == 0x8001) {
+      int run = e->fHeader.fSerialNumber;
+      int time = e->fHeader.fTimeStamp;
+      delete e;
+      if (id == 0x8000 && fStartHandler)
+        (*fStartHandler)(kTransitionStart,run,time);
+      if (id == 0x8001 && fStopHandler)
+        (*fStopHandler)(kTransitionStop,run,time);
+      return true;
+    }
+
+    fBufferLevel -= sizeof(TMidas_EVENT_HEADER) + e->fData.size();
+
+    if (fEventHandler)
+      (*fEventHandler)(&e->fHeader, e->fData.empty() ? NULL : &e->fData[0], e->fData.size());
+
+    double now = GetTimeNow();
+    double latency = now - e->fTime;
+    fSumLatency += latency;
+    if (latency > fMaxLatency)
+      fMaxLatency = latency;
+    fNumDelivered++;
+    delete e;
+
+    // give timers and transitions a chance
+    if (now - start > slice)
+      break;
+
+    Fill(now);
+  }
+
+  return true;
+}
+
+void TMidasReplay::setTransitionHandlers(TransitionHandler start,TransitionHandler stop)
+{
+  fStartHandler = start;
+  fStopHandler  = stop;
+}
+
+void TMidasReplay::setEventHandler(EventHandler handler)
+{
+  fEventHandler = handler;
+}
+
+int TMidasReplay::getBufferLevel()
+{
+  return fBufferLevel;
+}
+
+int TMidasReplay::getBufferSize()
+{
+  return fBufferSize;
+}
+
+void TMidasReplay::printStats()
+{
+  printf("TMidasReplay: %d events read, %d delivered, %d dropped (%.1f%%), latency mean %.3f ms, max %.3f ms, %.1f sec\n",
+         fNumEvents, fNumDelivered, fNumDropped,
+         fNumEvents ? 100.0*fNumDropped/fNumEvents : 0.0,
+         fNumDelivered ? 1000.0*fSumLatency/fNumDelivered : 0.0,
+         1000.0*fMaxLatency, GetTimeNow() - fStartTime);
+}
+
+//end
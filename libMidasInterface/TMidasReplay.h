@@ -0,0 +1,138 @@
+#ifndef TMidasReplay_hxx_seen
+#define TMidasReplay_hxx_seen
+/********************************************************************\
+
+  Name:         TMidasReplay.h
+
+  Contents:     Stand-in for TMidasOnline, feeding events from a
+                MIDAS file through a simulated online data buffer
+
+\********************************************************************/
+
+#include <string>
+#include <deque>
+#include <vector>
+
+#include "TMidasEvent.h"
+
+class TMReaderInterface;
+
+/// Replay a .mid file as if it was an online MIDAS data buffer.
+///
+/// Uses the same callbacks as TMidasOnline: the event handler is called
+/// from poll() for each event, the start and stop handlers for the begin
+/// and end of run events found in the file. Events are written into a
+/// buffer of getBufferSize() bytes at the requested rate; like a
+/// non-blocking MIDAS event request, events that do not fit into the
+/// buffer are dropped. With rate 0 events are written as fast as the
+/// analyzer takes them and nothing is dropped. Event timestamps are set to
+/// the time the event is written into the buffer, as if it was taken now.
+
+class TMidasReplay
+{
+public:
+
+  /// User handler for run state transition events
+  typedef void (*TransitionHandler)(int transition,int run_number,int trans_time);
+
+  /// User handler for data events
+  typedef void (*EventHandler)(const void*header,const void*data,int length);
+
+  TransitionHandler fStartHandler;
+  TransitionHandler fStopHandler;
+  EventHandler      fEventHandler;
+
+  /// Run number and ODB dump from the begin of run event at the start of the file
+  int         fRunNumber;
+  TMidasEvent fOdbEvent;
+
+  /// Statistics
+  int    fNumEvents;    ///< events read from the file
+  int    fNumDelivered; ///< events passed to the event handler
+  int    fNumDropped;   ///< events dropped because the buffer was full
+  double fSumLatency;   ///< sum of time between event written to buffer and delivered
+  double fMaxLatency;   ///< longest time between event written to buffer and delivered
+
+private:
+  /// One event in the simulated buffer
+  struct ReplayEvent {
+    TMidas_EVENT_HEADER fHeader;
+    std::vector<char>   fData;
+    double              fTime;   ///< time the event was written to the buffer
+  };
+
+  static TMidasReplay* gfReplay;
+
+  TMReaderInterface* fReader;
+  std::string fFilename;
+
+  double fRate;       ///< events per second, 0 = as fast as possible
+  double fSpeedup;    ///< if > 0, use event timestamps, this many times faster than real time
+  int    fBufferSize;
+  int    fBufferLevel;
+
+  std::deque<ReplayEvent*> fBuffer;  ///< events in the buffer
+  ReplayEvent* fNext;                ///< next event from the file, not yet in the buffer
+  double fNextTime;                  ///< time the next event is due
+  double fStartTime;
+  uint32_t fStartTimeStamp;
+  uint32_t fSecondTimeStamp;         ///< timestamp of the events being counted
+  int fSecondCount;                  ///< events so far with this timestamp
+  int fPrevSecondCount;              ///< events with the previous timestamp
+  bool fEndOfFile;
+
+  TMidasReplay(); ///< default constructor is private for singleton classes
+  virtual ~TMidasReplay();
+
+  /// Read the next event from the file into fNext
+  bool ReadNext();
+
+  /// Write all events that are due into the buffer
+  void Fill(double now);
+
+public:
+
+  /// TMidasReplay is a singleton class, like TMidasOnline.
+  static TMidasReplay* instance();
+
+  /// Open the file; reads the begin of run event (fRunNumber and fOdbEvent).
+  /// Returns 0 on success.
+  int connect(const char* filename);
+
+  /// Close the file and print the statistics
+  int disconnect();
+
+  /// Events per second written to the buffer, 0 = as fast as possible (default)
+  void setRate(double rate);
+
+  /// Write the events at the times given by their timestamps,
+  /// speedup times faster than real time; 0 to use setRate() instead.
+  /// MIDAS timestamps are in seconds, events within one second are spread
+  /// evenly using the number of events in the previous second.
+  void setRealTime(double speedup = 1.0);
+
+  /// Size of the simulated buffer, default 32 Mbytes
+  void setBufferSize(int size);
+
+  /// Deliver events and transitions, waiting at most mdelay ms for the next event.
+  /// Returns false after the end of the file.
+  bool poll(int mdelay);
+
+  /// Specify user handlers for run transitions
+  void setTransitionHandlers(TransitionHandler start,TransitionHandler stop);
+
+  /// Specify user handler for data events
+  void setEventHandler(EventHandler handler);
+
+  /// Get buffer level (ie the number of bytes in buffer)
+  int getBufferLevel();
+
+  /// Get buffer size
+  int getBufferSize();
+
+  /// Print the statistics
+  void printStats();
+};
+
+//end
+#endif
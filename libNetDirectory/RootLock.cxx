@@ -11,31 +11,85 @@
 
 #include "RootLock.h"
 
-#include <TSemaphore.h>
+#include <stdio.h>
+#include <sys/time.h>
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
 #include <TTimer.h>
-#include <TThread.h>
 
-static TSemaphore gRootSema(0); // wait by server, post by timer
-static TSemaphore gWaitSema(0); // post by server, wait by timer
-static TSemaphore gDoneSema(0); // post by server, wait by timer
+static std::mutex gMutex;
+static std::condition_variable gCond;
+static std::atomic<int> gPending(0); // network threads waiting in LockRoot()
+static bool gYielded = false; // owner thread is parked in YieldRoot()
+static bool gBusy = false;    // a network thread holds ROOT
+static int gQuota = 0;        // requests still to be served by this handoff
+static double gHoldStart = 0;
+static int gBatch = 0;
+static RootLockStats gStats;
 
 bool gDebugLockRoot = false;
 
+static double GetTime()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + 0.000001*tv.tv_usec;
+}
+
 void LockRoot()
 {
   if (gDebugLockRoot)
     printf("Try Lock ROOT!\n");
-  gWaitSema.Post();
-  gRootSema.Wait();
+
+  double t0 = GetTime();
+
+  gPending++;
+
+  std::unique_lock<std::mutex> lock(gMutex);
+
+  bool contended = gBusy;
+
+  while (!gYielded || gBusy || gQuota < 1)
+    gCond.wait(lock);
+
+  gBusy = true;
+  gQuota--;
+  gPending--;
+
+  double t1 = GetTime();
+  double wait = t1 - t0;
+
+  gHoldStart = t1;
+  gBatch++;
+  gStats.fNumRequests++;
+  if (contended)
+    gStats.fNumContended++;
+  gStats.fWaitSec += wait;
+  if (wait > gStats.fMaxWaitSec)
+    gStats.fMaxWaitSec = wait;
+
   if (gDebugLockRoot)
-    printf("Lock ROOT!\n");
+    printf("Lock ROOT, waited %.3f ms!\n", wait*1000.0);
 }
 
 void UnlockRoot()
 {
+  std::lock_guard<std::mutex> lock(gMutex);
+
+  double hold = GetTime() - gHoldStart;
+
+  gStats.fHoldSec += hold;
+  if (hold > gStats.fMaxHoldSec)
+    gStats.fMaxHoldSec = hold;
+
+  gBusy = false;
+  gCond.notify_all();
+
   if (gDebugLockRoot)
-    printf("Unlock ROOT!\n");
-  gDoneSema.Post();
+    printf("Unlock ROOT, held %.3f ms!\n", hold*1000.0);
 }
 
 LockRootGuard::LockRootGuard() // ctor
@@ -56,13 +110,70 @@ void LockRootGuard::Unlock()
   fLocked = false;
 }
 
+bool RootLockPending()
+{
+  return gPending.load(std::memory_order_relaxed) > 0;
+}
+
+void YieldRoot()
+{
+  if (!RootLockPending())
+    return;
+
+  std::unique_lock<std::mutex> lock(gMutex);
+
+  if (gDebugLockRoot)
+    printf("Yield root!\n");
+
+  gYielded = true;
+  gBatch = 0;
+  gQuota = gPending;
+  gCond.notify_all();
+
+  // serve everybody who was waiting when we got here, requests
+  // arriving later wait for the next event so the analysis
+  // cannot be starved by a busy client
+  while (gBusy || (gQuota > 0 && gPending > 0))
+    gCond.wait(lock);
+
+  gYielded = false;
+  gQuota = 0;
+
+  gStats.fNumYields++;
+  if (gBatch > gStats.fMaxBatch)
+    gStats.fMaxBatch = gBatch;
+
+  if (gDebugLockRoot)
+    printf("Recapture root, served %d requests!\n", gBatch);
+}
+
+void GetRootLockStats(RootLockStats* stats)
+{
+  std::lock_guard<std::mutex> lock(gMutex);
+  *stats = gStats;
+}
+
+void PrintRootLockStats()
+{
+  RootLockStats s;
+  GetRootLockStats(&s);
+
+  if (s.fNumRequests < 1)
+    return;
+
+  printf("RootLock: %d requests in %d handoffs (max batch %d), %d contended, wait avg %.3f max %.3f ms, hold avg %.3f max %.3f ms\n",
+         s.fNumRequests, s.fNumYields, s.fMaxBatch, s.fNumContended,
+         1000.0*s.fWaitSec/s.fNumRequests, 1000.0*s.fMaxWaitSec,
+         1000.0*s.fHoldSec/s.fNumRequests, 1000.0*s.fMaxHoldSec);
+}
+
 class ServerTimer : public TTimer
 {
 public:
 
   static ServerTimer* fgTimer;
 
-  static void StartServerTimer(int period_msec = 100)
+  static void StartServerTimer(int period_msec = 10)
   {
     if (!fgTimer)
       {
@@ -76,19 +187,7 @@ public:
     if (gDebugLockRoot)
       fprintf(stderr, "ServerTimer::Notify!!\n");
 
-    int notWaiting = gWaitSema.TryWait();
-    if (gDebugLockRoot)
-      printf("NotWaiting %d!\n", notWaiting);
-    if (!notWaiting)
-      {
-        if (gDebugLockRoot)
-          printf("Yeld root sema!\n");
-        gRootSema.Post();
-        TThread::Self()->Sleep(0, 1000000); // sleep in ns
-        gDoneSema.Wait();
-        if (gDebugLockRoot)
-          printf("Recapture root sema!\n");
-      }
+    YieldRoot();
 
     Reset();
     return kTRUE;
@@ -22,6 +22,30 @@ struct LockRootGuard
   void Unlock();
 };
 
-void StartLockRootTimer(int period_msec = 100);
+// The thread that owns ROOT (the analysis/GUI thread) hands it over
+// to the network threads by calling YieldRoot() between events,
+// all requests pending at that time are served before it returns.
+
+bool RootLockPending(); // true if a network thread is waiting for ROOT
+void YieldRoot(); // returns immediately if nothing is pending
+
+// YieldRoot() is also called from a TTimer so requests are served
+// while the analysis is idle
+void StartLockRootTimer(int period_msec = 10);
+
+struct RootLockStats
+{
+  int    fNumRequests;  // number of LockRoot() calls
+  int    fNumYields;    // number of handoffs by the owner thread
+  int    fNumContended; // requests that waited for another request
+  int    fMaxBatch;     // max requests served in one handoff
+  double fWaitSec;      // total time spent waiting in LockRoot()
+  double fMaxWaitSec;
+  double fHoldSec;      // total time ROOT was held by network threads
+  double fMaxHoldSec;
+};
+
+void GetRootLockStats(RootLockStats* stats);
+void PrintRootLockStats();
 
 // end file
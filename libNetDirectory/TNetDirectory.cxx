@@ -4,7 +4,9 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <sys/time.h>
 
 #include "TNetDirectory.h"
 
@@ -12,19 +14,94 @@
 #include "TMessage.h"
 #include "TClass.h"
 #include "TObjString.h"
+#include "TH1.h"
+#include "TKey.h"
+#include "TList.h"
+
+#include <map>
+#include <vector>
 
 static bool gVerbose = false;
+static double gCacheTTL = 1.0;
+static bool gPrefetch = false;
+
+static double GetTimeSec()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + 0.000001*tv.tv_usec;
+}
+
+// Message received inside another message, the server sends the
+// objects of "FindObjectDelta" and "GetObjects" replies this way
+
+class TEmbeddedMessage : public TMessage
+{
+public:
+  TEmbeddedMessage(char* buf, Int_t len) : TMessage(buf, len) {} // adopts buf
+};
+
+static void* ReadEmbeddedObject(TMessage* mr, TClass* type)
+{
+  Int_t len = 0;
+  mr->ReadInt(len);
+  if (len <= 0 || len > mr->BufferSize() - mr->Length())
+    return NULL;
+
+  char* buf = new char[len];
+  mr->ReadFastArray(buf, len);
+
+  TEmbeddedMessage m(buf, len);
+  return m.ReadObjectAny(type);
+}
 
 class TNetDirectoryConnection
 {
   TSocket* fSocket;
 
+  // Objects received with "FindObjectDelta" and "GetObjects",
+  // for histograms the server sends only bins changed since fRevision
+
+  struct CacheEntry
+  {
+    TObject* fObj;     // TH1 if fRevision is valid, owned by the cache
+    int      fEpoch;   // server instance the revision belongs to
+    int      fRevision;
+    double   fTime;    // when last received, 0 if not valid
+
+    CacheEntry() : fObj(NULL), fEpoch(0), fRevision(0), fTime(0) {}
+
+    void SetObject(TObject* obj)
+    {
+      if (fObj != obj)
+        delete fObj;
+      fObj = obj;
+    }
+  };
+
+  std::map<std::string, CacheEntry> fCache;
+  bool fNoDelta; // server does not know "FindObjectDelta"
+  bool fNoBatch; // server does not know "GetObjects"
+
 public:
 
   TNetDirectoryConnection(const char* host, int port)
   {
     fSocket = new TSocket(host, port);
     printf("Connected to %s:%d\n", host, port);
+    fNoDelta = false;
+    fNoBatch = false;
+  }
+
+  ~TNetDirectoryConnection()
+  {
+    std::map<std::string, CacheEntry>::iterator it = fCache.begin();
+    for (; it != fCache.end(); it++)
+      it->second.SetObject(NULL);
+    fCache.clear();
+
+    fSocket->Close();
+    delete fSocket;
   }
 
   int Reconnect()
@@ -47,6 +124,256 @@ public:
       printf("Request sent %d\n", s);
   }
 
+  static std::string DirName(const std::string& path)
+  {
+    size_t s = path.rfind('/');
+    if (s == std::string::npos)
+      return "";
+    return path.substr(0, s+1);
+  }
+
+  static TObject* CloneEntry(const CacheEntry& e)
+  {
+    // the caller owns the returned object
+    if (!e.fObj)
+      return NULL;
+    return e.fObj->Clone();
+  }
+
+  void Invalidate()
+  {
+    std::map<std::string, CacheEntry>::iterator it = fCache.begin();
+    for (; it != fCache.end(); it++)
+      it->second.fTime = 0;
+  }
+
+  TObject* FindObject(const std::string& path)
+  {
+    if (TNetDirectory::GetCacheTTL() > 0 && !fNoBatch)
+      {
+        double now = GetTimeSec();
+
+        std::map<std::string, CacheEntry>::iterator it = fCache.find(path);
+        if (it != fCache.end() && it->second.fTime > 0 && now - it->second.fTime < TNetDirectory::GetCacheTTL())
+          return CloneEntry(it->second);
+
+        // refresh everything we have from this directory in the same round trip
+
+        std::vector<std::string> paths;
+        paths.push_back(path);
+
+        std::string dir = DirName(path);
+        for (it = fCache.begin(); it != fCache.end(); it++)
+          if (it->first != path && DirName(it->first) == dir && now - it->second.fTime >= TNetDirectory::GetCacheTTL())
+            paths.push_back(it->first);
+
+        if (GetObjects(paths))
+          return CloneEntry(fCache[path]);
+      }
+
+    if (!fNoDelta)
+      {
+        CacheEntry& e = fCache[path];
+
+        char req[64];
+        sprintf(req, "FindObjectDelta %d %d ", e.fEpoch, e.fObj ? e.fRevision : 0);
+        Request((req + path).c_str());
+
+        TMessage *mr = 0;
+        int r = fSocket->Recv(mr);
+        if (r <= 0 || !mr) {
+          printf("Error reading from socket!\n");
+          return NULL;
+        }
+
+        if (mr->What() == kMESS_ANY) {
+          bool ok = ReadEntry(mr, e);
+          delete mr;
+          if (!ok)
+            return NULL;
+          return CloneEntry(e);
+        }
+
+        TObject *obj = (TObject*)mr->ReadObjectAny(mr->GetClass());
+        delete mr;
+
+        if (!(obj && obj->IsA() == TObjString::Class() && strcmp(obj->GetName(), "Unknown request") == 0))
+          return obj;
+
+        // old server
+        delete obj;
+        fNoDelta = true;
+      }
+
+    Request(("FindObjectByName " + path).c_str());
+    return ReadObject(TObject::Class());
+  }
+
+  bool GetObjects(const std::vector<std::string>& paths)
+  {
+    // keep requests well below the server request buffer size
+    const size_t kMaxRequest = 32*1024;
+
+    size_t i = 0;
+    while (i < paths.size())
+      {
+        std::vector<std::string> xpaths;
+        std::string req = "GetObjects\n";
+
+        for (; i < paths.size(); i++)
+          {
+            if (xpaths.size() > 0 && req.size() + paths[i].size() + 32 > kMaxRequest)
+              break;
+            CacheEntry& e = fCache[paths[i]];
+            char buf[64];
+            sprintf(buf, "%d %d ", e.fEpoch, e.fObj ? e.fRevision : 0);
+            req += buf;
+            req += paths[i];
+            req += "\n";
+            xpaths.push_back(paths[i]);
+          }
+
+        Request(req.c_str());
+
+        TMessage *mr = 0;
+        int r = fSocket->Recv(mr);
+        if (r <= 0 || !mr) {
+          printf("Error reading from socket!\n");
+          return false;
+        }
+
+        if (mr->What() != kMESS_ANY) {
+          TObject *obj = (TObject*)mr->ReadObjectAny(mr->GetClass());
+          delete mr;
+          if (obj && obj->IsA() == TObjString::Class() && strcmp(obj->GetName(), "Unknown request") == 0)
+            fNoBatch = true; // old server
+          delete obj;
+          return false;
+        }
+
+        double now = GetTimeSec();
+
+        Int_t count = 0;
+        mr->ReadInt(count);
+
+        if (count != (Int_t)xpaths.size()) {
+          printf("GetObjects: asked for %d objects, received %d!\n", (int)xpaths.size(), count);
+          delete mr;
+          return false;
+        }
+
+        for (int j=0; j<count; j++) {
+          CacheEntry& e = fCache[xpaths[j]];
+          if (!ReadEntry(mr, e)) {
+            delete mr;
+            return false;
+          }
+          e.fTime = now;
+        }
+
+        delete mr;
+      }
+
+    return true;
+  }
+
+  void Prefetch(const std::string& dir, const TList* keys)
+  {
+    if (!gPrefetch || TNetDirectory::GetCacheTTL() <= 0 || fNoBatch || !keys)
+      return;
+
+    std::vector<std::string> paths;
+
+    TIter next(keys);
+    while (1) {
+      TObject* obj = next();
+      if (!obj)
+        break;
+      if (obj->InheritsFrom(TKey::Class()) && strcmp(((TKey*)obj)->GetClassName(), "TDirectory") == 0)
+        continue;
+      if (dir.length() > 0)
+        paths.push_back(dir + "/" + obj->GetName());
+      else
+        paths.push_back(obj->GetName());
+    }
+
+    if (paths.size() > 0)
+      GetObjects(paths);
+  }
+
+  bool ReadEntry(TMessage* mr, CacheEntry& e)
+  {
+    Int_t kind = 0;
+    Int_t epoch = 0;
+    Int_t rev = 0;
+    mr->ReadInt(kind);
+    mr->ReadInt(epoch);
+    mr->ReadInt(rev);
+
+    if (kind == 0) { // full histogram
+      TH1* h = (TH1*)ReadEmbeddedObject(mr, TH1::Class());
+      if (h)
+        h->SetDirectory(0);
+      e.SetObject(h);
+      e.fEpoch = epoch;
+    } else if (kind == 1) { // changed bins
+      TH1* h = NULL;
+      if (e.fObj && e.fObj->InheritsFrom(TH1::Class()))
+        h = (TH1*)e.fObj;
+      if (!h || epoch != e.fEpoch) {
+        printf("Received histogram changes without a cached histogram!\n");
+        e.fRevision = 0;
+        return false;
+      }
+
+      Double_t entries = 0;
+      Int_t nstat = 0;
+      mr->ReadDouble(entries);
+      mr->ReadInt(nstat);
+      std::vector<Double_t> stats(nstat > TH1::kNstat ? nstat : TH1::kNstat);
+      mr->ReadFastArray(&stats[0], nstat);
+
+      Int_t hasSumw2 = 0;
+      mr->ReadInt(hasSumw2);
+      if (hasSumw2 && h->GetSumw2N() == 0)
+        h->Sumw2();
+
+      Int_t nranges = 0;
+      mr->ReadInt(nranges);
+
+      std::vector<Double_t> buf;
+      for (int i=0; i<nranges; i++) {
+        Int_t first = 0;
+        Int_t n = 0;
+        mr->ReadInt(first);
+        mr->ReadInt(n);
+        if (first < 0 || n < 0 || first + n > h->GetNcells()) {
+          printf("Received invalid histogram changes!\n");
+          e.fRevision = 0;
+          return false;
+        }
+        buf.resize(n);
+        mr->ReadFastArray(&buf[0], n);
+        for (int j=0; j<n; j++)
+          h->SetBinContent(first + j, buf[j]);
+        if (hasSumw2) {
+          TArrayD* sumw2 = h->GetSumw2();
+          mr->ReadFastArray(sumw2->fArray + first, n);
+        }
+      }
+
+      h->PutStats(&stats[0]);
+      h->SetEntries(entries);
+    } else if (kind == 3) { // not a histogram
+      TObject* obj = (TObject*)ReadEmbeddedObject(mr, TObject::Class());
+      e.SetObject(obj);
+      e.fEpoch = epoch;
+    }
+
+    e.fRevision = rev;
+    return true;
+  }
+
   TObject* ReadObject(TClass* type)
   {
     TMessage *mr = 0;
@@ -104,6 +431,7 @@ TNetDirectory::TNetDirectory(const char *remoteServerName, TDirectory* motherDir
       port = atoi(s+1);
     }
   fConn = new TNetDirectoryConnection(hostname, port);
+  fOwnConn = true;
   fPath = "";
 }
 
@@ -113,6 +441,7 @@ TNetDirectory::TNetDirectory(TNetDirectoryConnection* conn, const char* dirname,
   if (gVerbose)
     printf("TNetDirectory::ctor: conn %p, path [%s]\n", conn, path.c_str());
   fConn = conn;
+  fOwnConn = false;
   fPath = path;
 }
 
@@ -120,6 +449,9 @@ TNetDirectory::~TNetDirectory()
 {
   if (gVerbose)
     printf("TNetDirectory::dtor\n");
+  // subdirectories share the connection of the top directory
+  if (fOwnConn)
+    delete fConn;
   fConn = NULL;
 }
 
@@ -148,6 +480,23 @@ void TNetDirectory::ResetTH1(const char *name)
   fConn->Request(req.c_str());
   TObject *obj = fConn->ReadObject(TObject::Class());
   delete obj;
+
+  fConn->Invalidate();
+}
+
+void TNetDirectory::SetCacheTTL(double ttl_sec)
+{
+  gCacheTTL = ttl_sec;
+}
+
+double TNetDirectory::GetCacheTTL()
+{
+  return gCacheTTL;
+}
+
+void TNetDirectory::SetPrefetch(bool prefetch)
+{
+  gPrefetch = prefetch;
 }
 
 void        TNetDirectory::Append(TObject *obj, Bool_t replace)
@@ -182,16 +531,15 @@ TObject    *TNetDirectory::FindObject(const char *name) const
         }
     }
 
-  std::string req = "FindObjectByName ";
+  std::string path;
   if (fPath.length() > 0)
     {
-      req += fPath;
-      req += "/";
+      path += fPath;
+      path += "/";
     }
-  req += name;
+  path += name;
 
-  fConn->Request(req.c_str());
-  TObject *obj = fConn->ReadObject(TObject::Class());
+  TObject *obj = fConn->FindObject(path);
 
   if (obj && strcmp(obj->IsA()->GetName(), "TObjString") == 0)
     {
@@ -217,16 +565,15 @@ TObject    *TNetDirectory::Get(const char *namecycle)
   if (gVerbose)
     printf("TNetDirectory(%s)::Get(%s)\n", fPath.c_str(), namecycle);
 
-  std::string req = "FindObjectByName "; // "Get ";
+  std::string path;
   if (fPath.length() > 0)
     {
-      req += fPath;
-      req += "/";
+      path += fPath;
+      path += "/";
     }
-  req += namecycle;
+  path += namecycle;
 
-  fConn->Request(req.c_str());
-  TObject *obj = fConn->ReadObject(TObject::Class());
+  TObject *obj = fConn->FindObject(path);
 
   if (obj && strcmp(obj->IsA()->GetName(), "TObjString") == 0)
     {
@@ -271,6 +618,10 @@ TList      *TNetDirectory::GetListOfKeys() const
   if (keys == NULL)
     //    return fKeys;
     return NULL;
+
+  // the objects will most likely be asked for next, see SetPrefetch()
+  fConn->Prefetch(fPath, keys);
+
   //keys->Print();
   //keys->ls();
   return keys;
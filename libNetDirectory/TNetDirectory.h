@@ -34,6 +34,7 @@ class TNetDirectory : public TDirectory {
 
 protected:
    TNetDirectoryConnection* fConn; //! pointer to network connection
+   bool                     fOwnConn; //! top directory, deletes fConn
    std::string              fPath;
    std::deque<TNetDirectory*> fSubDirs;
 
@@ -55,6 +56,15 @@ public:
    // special operations for online data
    void ResetTH1(const char* name);
 
+   // objects are cached for ttl_sec, after that all stale objects from
+   // the same directory are refreshed in one request. 0 disables the cache.
+   static void   SetCacheTTL(double ttl_sec);
+   static double GetCacheTTL();
+
+   // GetListOfKeys() also fetches all the objects of the directory in one
+   // request, for programs that show them all next. Off by default.
+   static void   SetPrefetch(bool prefetch);
+
    virtual void        Append(TObject *obj, Bool_t replace);
    virtual void        Browse(TBrowser *b);
    virtual void        Clear(Option_t *option="");
@@ -10,7 +10,11 @@
 \********************************************************************/
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "netDirectoryServer.h"
 
@@ -41,11 +45,18 @@
 #include <TMessage.h>
 #include <TObjString.h>
 #include <TH1.h>
+#include <TProfile.h>
+#include <TProfile2D.h>
 #include <TCutG.h>
+#include <TTimer.h>
 
 #include <deque>
 #include <map>
 #include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
 
 #include "RootLock.h"
 
@@ -227,58 +238,496 @@ static TKey* MakeKey(TObject* obj, int cycle, TDirectory* dir, const char* name
  
 /*------------------------------------------------------------------*/
 
-static THREADTYPE root_server_thread(void *arg)
+static TObject* FindObjectByName(char* top, TObjString** xstr)
 /*
-  Serve histograms over TCP/IP socket link
+  Directories are returned as a TObjString "TDirectory name",
+  to be deleted by the caller
 */
 {
-   char request[2560];
+  char *s;
+  TObject *obj = TopLevel(top, &s);
 
-   TSocket *sock = (TSocket *) arg;
-   TMessage message(kMESS_OBJECT);
+  //printf("toplevel found %p for \'%s\' remaining \'%s\'\n", obj, top, s);
 
-   do {
+  if (obj && !s)
+    {
+      // they requested a top-level object. Give out a fake name
 
-      /* close connection if client has disconnected */
-      int rd = sock->Recv(request, sizeof(request));
-      if (rd <= 0)
+      char str[256];
+      sprintf(str, "TDirectory %s", obj->GetName());
+
+      for (unsigned int i=0; i<gExports.size(); i++)
         {
-          if (gVerbose)
-            fprintf(stderr, "TNetDirectory connection from %s closed\n", sock->GetInetAddress().GetHostName());
-          sock->Close();
-          delete sock;
-          return THREADRETURN;
+          const char* ename = gExports[i].c_str();
+          const char* xname = gExportNames[ename].c_str();
+
+          if (strcmp(xname, obj->GetName()) == 0)
+            {
+              sprintf(str, "TDirectory %s", ename);
+              break;
+            }
         }
 
+      obj = *xstr = new TObjString(str);
+    }
+  else if (obj)
+    {
+      obj = FollowPath(obj, s);
+    }
+
+  if (obj && obj->InheritsFrom(TDirectory::Class()))
+    {
+      char str[256];
+      sprintf(str, "TDirectory %s", obj->GetName());
+      obj = *xstr = new TObjString(str);
+    }
+  
+  if (obj && obj->InheritsFrom(TFolder::Class()))
+    {
+      char str[256];
+      sprintf(str, "TDirectory %s", obj->GetName());
+      obj = *xstr = new TObjString(str);
+    }
+  
+  if (obj && obj->InheritsFrom(TCollection::Class()))
+    {
+      char str[256];
+      sprintf(str, "TDirectory %s", obj->GetName());
+      obj = *xstr = new TObjString(str);
+    }
+  
+  if (gVerbose)
+    {
+      if (obj)
+        printf("Sending object %p name \'%s\' class \'%s\'\n", obj, obj->GetName(), obj->IsA()->GetName());
+      else
+        printf("Sending object %p\n", obj);
+      //obj->Print();
+    }
+
+  return obj;
+}
+
+/*------------------------------------------------------------------*/
+
+// Histogram revisions for "FindObjectDelta" and "GetObjects". For each
+// histogram we keep the contents last seen and the revision at which each
+// bin last changed, a client at revision "rev" is sent only the bins
+// changed after "rev". Revisions are global, so they never repeat for a
+// path, and the epoch tells clients that the server was restarted.
+// With snapshots, the revisions are updated once per NetDirectoryPublish()
+// and the replies are built from them without the ROOT lock, so a
+// revision is never modified once made, a new one replaces it.
+
+struct NetDirectoryRevision
+{
+  std::string fSignature;    // class and binning, a change forces a full resend
+  bool fProfile;             // per-bin entries and errors are not tracked, always sent in full
+  int fBaseRev;              // clients older than this get the full object
+  int fRevision;             // latest revision
+  double fEntries;
+  std::vector<double> fStats;
+  std::vector<double> fContents;
+  std::vector<double> fSumw2;
+  std::vector<int> fBinRev;  // revision of the last change of each bin
+  std::string fObject;       // the histogram as a FindObjectByName reply
+};
+
+typedef std::shared_ptr<const NetDirectoryRevision> NetDirectoryRevisionPtr;
+
+static int gRevision = 0;
+static int gEpoch = 0;
+static std::map<std::string, NetDirectoryRevisionPtr> gRevisions; // used with the ROOT lock held
+
+static const int kDeltaFull      = 0; // full object follows
+static const int kDeltaBins      = 1; // changed bin ranges follow
+static const int kDeltaUnchanged = 2; // nothing follows
+static const int kDeltaObject    = 3; // not a histogram, object follows (GetObjects)
+static const int kDeltaMaxGap    = 8; // merge ranges separated by fewer unchanged bins
+
+static std::string NormalizePath(const char* s)
+{
+  // "//rootana//hist/" becomes "rootana/hist"
+
+  std::string r;
+
+  while (*s == '/')
+    s++;
+
+  for (; *s; s++)
+    if (*s != '/' || (s[1] != '/' && s[1] != 0))
+      r += *s;
+
+  return r;
+}
+
+static std::string ObjectReply(TObject* obj)
+{
+  // same bytes as TSocket::Send() of the FindObjectByName reply
+  TMessage message(kMESS_OBJECT);
+  message.SetCompressionLevel(0);
+  message.WriteObject(obj);
+  message.SetLength();
+  return std::string(message.Buffer(), message.Length());
+}
+
+static std::string HistSignature(TH1* h)
+{
+  char buf[1024];
+  sprintf(buf, "%s %d %d %g %g %d %g %g %d %g %g",
+          h->IsA()->GetName(), h->GetNcells(),
+          h->GetXaxis()->GetNbins(), h->GetXaxis()->GetXmin(), h->GetXaxis()->GetXmax(),
+          h->GetYaxis()->GetNbins(), h->GetYaxis()->GetXmin(), h->GetYaxis()->GetXmax(),
+          h->GetZaxis()->GetNbins(), h->GetZaxis()->GetXmin(), h->GetZaxis()->GetXmax());
+  return buf;
+}
+
+static NetDirectoryRevisionPtr UpdateRevision(const std::string& path, TH1* h)
+/*
+  Compare the histogram with its last revision and make a new revision
+  if it changed, caller must hold the ROOT lock
+*/
+{
+  h->BufferEmpty();
+
+  int ncells = h->GetNcells();
+  const TArrayD* sumw2 = h->GetSumw2N() > 0 ? h->GetSumw2() : NULL;
+  std::string sig = HistSignature(h);
+  if (sumw2)
+    sig += " sumw2";
+
+  bool profile = h->InheritsFrom(TProfile::Class()) || h->InheritsFrom(TProfile2D::Class());
+
+  std::vector<double> stats(TH1::kNstat, 0);
+  h->GetStats(&stats[0]);
+  double entries = h->GetEntries();
+
+  NetDirectoryRevisionPtr old;
+  std::map<std::string, NetDirectoryRevisionPtr>::iterator it = gRevisions.find(path);
+  if (it != gRevisions.end())
+    old = it->second;
+
+  if (old && old->fSignature != sig)
+    old.reset();
+
+  // find the first changed bin, most histograms do not change between publishes
+
+  int ifirst = ncells;
+  if (old && !profile)
+    {
+      for (int i=0; i<ncells; i++)
+        if (h->GetBinContent(i) != old->fContents[i] || (sumw2 && sumw2->fArray[i] != old->fSumw2[i]))
+          {
+            ifirst = i;
+            break;
+          }
+
+      if (ifirst == ncells && entries == old->fEntries && stats == old->fStats)
+        return old;
+    }
+
+  NetDirectoryRevision* r = new NetDirectoryRevision;
+
+  r->fSignature = sig;
+  r->fProfile = profile;
+  r->fEntries = entries;
+  r->fStats.swap(stats);
+  r->fRevision = ++gRevision;
+  r->fContents.resize(ncells);
+  r->fSumw2.resize(sumw2 ? ncells : 0);
+
+  for (int i=0; i<ncells; i++)
+    r->fContents[i] = h->GetBinContent(i);
+  for (int i=0; sumw2 && i<ncells; i++)
+    r->fSumw2[i] = sumw2->fArray[i];
+
+  if (old && !profile)
+    {
+      r->fBaseRev = old->fBaseRev;
+      r->fBinRev = old->fBinRev;
+      for (int i=ifirst; i<ncells; i++)
+        if (r->fContents[i] != old->fContents[i] || (sumw2 && r->fSumw2[i] != old->fSumw2[i]))
+          r->fBinRev[i] = r->fRevision;
+    }
+  else
+    {
+      r->fBaseRev = r->fRevision;
+      r->fBinRev.assign(ncells, r->fBaseRev);
+    }
+
+  r->fObject = ObjectReply(h);
+
+  NetDirectoryRevisionPtr xr(r);
+  gRevisions[path] = xr;
+  return xr;
+}
+
+static void InitEpoch()
+{
+  // once, before the network threads start
+  gEpoch = (int)(time(NULL) ^ (getpid() << 16));
+}
+
+static int GetEpoch()
+{
+  return gEpoch;
+}
+
+static void WriteObjectReply(TMessage& message, const std::string& reply)
+{
+  // an object inside a kMESS_ANY reply, as the bytes of its own message
+  message.WriteInt(reply.size());
+  message.WriteFastArray(reply.data(), reply.size());
+}
+
+static void WriteDelta(TMessage& message, const std::string& path, const NetDirectoryRevision* r, int epoch, int rev)
+/*
+  Write the changes since revision "rev", uses no ROOT objects and
+  can be called without the ROOT lock
+*/
+{
+  if (epoch != GetEpoch())
+    rev = 0;
+
+  if (r->fProfile || rev < r->fBaseRev)
+    {
+      message.WriteInt(kDeltaFull);
+      message.WriteInt(GetEpoch());
+      message.WriteInt(r->fProfile ? 0 : r->fRevision);
+      WriteObjectReply(message, r->fObject);
+      return;
+    }
+
+  if (rev >= r->fRevision)
+    {
+      message.WriteInt(kDeltaUnchanged);
+      message.WriteInt(GetEpoch());
+      message.WriteInt(r->fRevision);
+      return;
+    }
+
+  message.WriteInt(kDeltaBins);
+  message.WriteInt(GetEpoch());
+  message.WriteInt(r->fRevision);
+
+  message.WriteDouble(r->fEntries);
+  message.WriteInt(r->fStats.size());
+  message.WriteFastArray(&r->fStats[0], r->fStats.size());
+
+  bool hasSumw2 = r->fSumw2.size() > 0;
+  message.WriteInt(hasSumw2);
+
+  // find ranges of changed bins
+
+  std::vector<int> first;
+  std::vector<int> last;
+
+  int ncells = r->fBinRev.size();
+  for (int i=0; i<ncells; i++)
+    {
+      if (r->fBinRev[i] <= rev)
+        continue;
+      if (!last.empty() && i - last.back() <= kDeltaMaxGap)
+        last.back() = i;
+      else
+        {
+          first.push_back(i);
+          last.push_back(i);
+        }
+    }
+
+  message.WriteInt(first.size());
+  for (unsigned i=0; i<first.size(); i++)
+    {
+      int n = last[i] - first[i] + 1;
+      message.WriteInt(first[i]);
+      message.WriteInt(n);
+      message.WriteFastArray(&r->fContents[first[i]], n);
+      if (hasSumw2)
+        message.WriteFastArray(&r->fSumw2[first[i]], n);
+    }
+
+  if (gVerbose)
+    printf("FindObjectDelta %s: revision %d -> %d, %d ranges\n", path.c_str(), rev, r->fRevision, (int)first.size());
+}
+
+static bool gSnapshotsEnabled = false;
+static std::atomic<int> gNumConnections(0);
+
+static const unsigned kMaxRevisions = 10000; // histograms with revisions, without snapshots
+static time_t gLastPrune = 0;
+
+static void PruneRevisions()
+/*
+  Without snapshots, forget the revisions of histograms that were
+  deleted or renamed, caller must hold the ROOT lock
+*/
+{
+  time_t now = time(NULL);
+  if (now - gLastPrune < 10 && gRevisions.size() < kMaxRevisions)
+    return;
+
+  gLastPrune = now;
+
+  std::map<std::string, NetDirectoryRevisionPtr>::iterator it = gRevisions.begin();
+  while (it != gRevisions.end())
+    {
+      std::vector<char> path(it->first.begin(), it->first.end());
+      path.push_back(0);
+
+      TObject* obj = FollowPath(&path[0]);
+
+      if (obj && obj->InheritsFrom(TH1::Class()))
+        it++;
+      else
+        gRevisions.erase(it++);
+    }
+
+  // still too many: start over, clients get the full histograms once
+  if (gRevisions.size() >= kMaxRevisions)
+    gRevisions.clear();
+}
+
+static NetDirectoryRevisionPtr GetRevision(const std::string& path, TH1* h)
+{
+  // with snapshots, the revisions are updated by NetDirectoryPublish()
+  if (gSnapshotsEnabled)
+    {
+      std::map<std::string, NetDirectoryRevisionPtr>::iterator it = gRevisions.find(path);
+      if (it != gRevisions.end())
+        return it->second;
+    }
+  else
+    PruneRevisions();
+
+  return UpdateRevision(path, h);
+}
+
+/*------------------------------------------------------------------*/
+
+static void HandleRequest(char* request, TMessage& message)
+/*
+  Build the reply to a request, caller must hold the ROOT lock
+*/
+{
+  message.SetCompressionLevel(0);
+
+  if (strcmp(request, "GetListOfKeys") == 0)
+    {
+      // enumerate top level exported directories
+
+      //printf("Top level exported directories are:\n");
+      TList* keys = new TList();
+      
+      for (unsigned int i=0; i<gExports.size(); i++)
+        {
+          const char* ename = gExports[i].c_str();
+          const char* xname = gExportNames[ename].c_str();
+
+          TObject* obj = FindTopLevelObject(xname);
+
+          if (!obj)
+            {
+              fprintf(stderr, "GetListOfKeys: Exported name \'%s\' cannot be found!\n", xname);
+              continue;
+            }
+
+          TKey* key = MakeKey(obj, 1, gROOT, ename);
+          keys->Add(key);
+        }
+      
       if (gVerbose)
-        printf("Request [%s] from %s\n", request, sock->GetInetAddress().GetHostName());
+        {
+          printf("Sending keys %p\n", keys);
+          keys->Print();
+        }
+
+      message.Reset(kMESS_OBJECT);
+      message.WriteObject(keys);
+      delete keys;
+    }
+  else if (strncmp(request, "GetListOfKeys ", 14) == 0)
+    {
 
-      if (strcmp(request, "GetListOfKeys") == 0)
+      char* dirname = request + 14;
+
+      TObject* obj = FollowPath(dirname);
+
+      if (obj && obj->InheritsFrom(TDirectory::Class()))
         {
-          // enumerate top level exported directories
+          TDirectory* dir = (TDirectory*)obj;
 
-          LockRootGuard lock;
+          //printf("Directory %p\n", dir);
+          //dir->Print();
           
-          //printf("Top level exported directories are:\n");
-          TList* keys = new TList();
+          TList* xkeys = dir->GetListOfKeys();
+          TList* keys = xkeys;
+          if (!keys)
+            keys = new TList();
+
+          //printf("Directory %p keys:\n", dir);
+          //keys->Print();
           
-          for (unsigned int i=0; i<gExports.size(); i++)
+          TList* objs = dir->GetList();
+
+          //printf("Directory %p objects:\n", dir);
+          //objs->Print();
+          
+          TIter next = objs;
+          while(1)
             {
-              const char* ename = gExports[i].c_str();
-              const char* xname = gExportNames[ename].c_str();
+              TObject *obj = next();
 
-              TObject* obj = FindTopLevelObject(xname);
+              //printf("object %p\n", obj);
 
-              if (!obj)
+              if (obj == NULL)
+                break;
+              
+              const char* name      = obj->GetName();
+              
+              if (!keys->FindObject(name))
                 {
-                  fprintf(stderr, "GetListOfKeys: Exported name \'%s\' cannot be found!\n", xname);
-                  continue;
+                  TKey* key = MakeKey(obj, 1, dir);
+                  keys->Add(key);
                 }
+            }
+
+          //printf("Sending keys %p\n", keys);
+          //keys->Print();
 
-              TKey* key = MakeKey(obj, 1, gROOT, ename);
-              keys->Add(key);
+          message.Reset(kMESS_OBJECT);
+          message.WriteObject(keys);
+          if (keys != xkeys)
+            delete keys;
+        }
+      else if (obj && obj->InheritsFrom(TFolder::Class()))
+        {
+          TFolder* folder = (TFolder*)obj;
+
+          //printf("Folder %p\n", folder);
+          //folder->Print();
+
+          TIterator *iterator = folder->GetListOfFolders()->MakeIterator();
+
+          TList* keys = new TList();
+
+          while (1)
+            {
+              TNamed *obj = (TNamed*)iterator->Next();
+              if (obj == NULL)
+                break;
+  
+              const char* name      = obj->GetName();
+              
+              if (!keys->FindObject(name))
+                {
+                  TKey* key = MakeKey(obj, 1, gROOT);
+                  keys->Add(key);
+                }
             }
           
+          delete iterator;
+
           if (gVerbose)
             {
               printf("Sending keys %p\n", keys);
@@ -288,279 +737,497 @@ static THREADTYPE root_server_thread(void *arg)
           message.Reset(kMESS_OBJECT);
           message.WriteObject(keys);
           delete keys;
-          lock.Unlock();
-          sock->Send(message);
         }
-      else if (strncmp(request, "GetListOfKeys ", 14) == 0)
+      else if (obj && obj->InheritsFrom(TCollection::Class()))
         {
-          LockRootGuard lock;
-
-          char* dirname = request + 14;
+          TCollection* collection = (TCollection*)obj;
 
-          TObject* obj = FollowPath(dirname);
+          //printf("Collection %p\n", collection);
+          //collection->Print();
 
-          if (obj && obj->InheritsFrom(TDirectory::Class()))
-            {
-              TDirectory* dir = (TDirectory*)obj;
-
-              //printf("Directory %p\n", dir);
-              //dir->Print();
-              
-              TList* xkeys = dir->GetListOfKeys();
-              TList* keys = xkeys;
-              if (!keys)
-                keys = new TList();
+          TIterator *iterator = collection->MakeIterator();
 
-              //printf("Directory %p keys:\n", dir);
-              //keys->Print();
-              
-              TList* objs = dir->GetList();
+          TList* keys = new TList();
 
-              //printf("Directory %p objects:\n", dir);
-              //objs->Print();
+          while (1)
+            {
+              TNamed *obj = (TNamed*)iterator->Next();
+              if (obj == NULL)
+                break;
+  
+              const char* name      = obj->GetName();
               
-              TIter next = objs;
-              while(1)
+              if (!keys->FindObject(name))
                 {
-                  TObject *obj = next();
-
-                  //printf("object %p\n", obj);
-
-                  if (obj == NULL)
-                    break;
-                  
-                  const char* name      = obj->GetName();
-                  
-                  if (!keys->FindObject(name))
-                    {
-                      TKey* key = MakeKey(obj, 1, dir);
-                      keys->Add(key);
-                    }
+                  TKey* key = MakeKey(obj, 1, gROOT);
+                  keys->Add(key);
                 }
-
-              //printf("Sending keys %p\n", keys);
-              //keys->Print();
-
-              message.Reset(kMESS_OBJECT);
-              message.WriteObject(keys);
-              if (keys != xkeys)
-                delete keys;
             }
-          else if (obj && obj->InheritsFrom(TFolder::Class()))
+          
+          delete iterator;
+
+          if (gVerbose)
             {
-              TFolder* folder = (TFolder*)obj;
+              printf("Sending keys %p\n", keys);
+              keys->Print();
+            }
 
-              //printf("Folder %p\n", folder);
-              //folder->Print();
+          message.Reset(kMESS_OBJECT);
+          message.WriteObject(keys);
+          delete keys;
+        }
+      else if (obj)
+        {
+          fprintf(stderr, "netDirectoryServer: ERROR: obj %p name %s, type %s is not a directory!\n", obj, obj->GetName(), obj->IsA()->GetName());
+          TObjString s("Not a directory");
+          message.Reset(kMESS_OBJECT);
+          message.WriteObject(&s);
+        }
+      else
+        {
+          fprintf(stderr, "netDirectoryServer: ERROR: obj %p not found\n", obj);
+          TObjString s("Not found");
+          message.Reset(kMESS_OBJECT);
+          message.WriteObject(&s);
+        }
+    }
+  else if (strncmp(request, "FindObjectByName ", 17) == 0)
+    {
+      TObjString *xstr = NULL; // fake directory name, deleted after sending
+      TObject *obj = FindObjectByName(request + 17, &xstr);
 
-              TIterator *iterator = folder->GetListOfFolders()->MakeIterator();
+      message.Reset(kMESS_OBJECT);
+      message.WriteObject(obj);
 
-              TList* keys = new TList();
+      if (xstr)
+        delete xstr;
+    }
+  else if (strncmp(request, "FindObjectDelta ", 16) == 0)
+    {
+      // "FindObjectDelta <epoch> <revision> <path>": histograms are sent
+      // as changes since the client revision, other objects as by FindObjectByName
 
-              while (1)
-                {
-                  TNamed *obj = (TNamed*)iterator->Next();
-                  if (obj == NULL)
-                    break;
-      
-                  const char* name      = obj->GetName();
-                  
-                  if (!keys->FindObject(name))
-                    {
-                      TKey* key = MakeKey(obj, 1, gROOT);
-                      keys->Add(key);
-                    }
-                }
-              
-              delete iterator;
+      char* s = request + 16;
+      int epoch = strtol(s, &s, 0);
+      int rev = strtol(s, &s, 0);
+      while (*s == ' ')
+        s++;
 
-              if (gVerbose)
-                {
-                  printf("Sending keys %p\n", keys);
-                  keys->Print();
-                }
+      std::string path = NormalizePath(s);
 
-              message.Reset(kMESS_OBJECT);
-              message.WriteObject(keys);
-              delete keys;
-            }
-          else if (obj && obj->InheritsFrom(TCollection::Class()))
-            {
-              TCollection* collection = (TCollection*)obj;
+      TObject *obj = FollowPath(s);
 
-              //printf("Collection %p\n", collection);
-              //collection->Print();
+      if (obj && obj->InheritsFrom(TH1::Class()))
+        {
+          NetDirectoryRevisionPtr r = GetRevision(path, (TH1*)obj);
+          message.Reset(kMESS_ANY);
+          WriteDelta(message, path, r.get(), epoch, rev);
+        }
+      else
+        {
+          gRevisions.erase(path);
+          std::string xreq = "FindObjectByName " + path;
+          std::vector<char> buf(xreq.begin(), xreq.end());
+          buf.push_back(0);
+          HandleRequest(&buf[0], message);
+        }
+    }
+  else if (strncmp(request, "GetObjects\n", 11) == 0)
+    {
+      // "GetObjects\n<epoch> <revision> <path>\n...": reply with all the
+      // objects in one compressed message, histograms as by FindObjectDelta
 
-              TIterator *iterator = collection->MakeIterator();
+      std::vector<char*> lines;
+      char* saveptr = NULL;
+      for (char* s = strtok_r(request + 11, "\n", &saveptr); s; s = strtok_r(NULL, "\n", &saveptr))
+        lines.push_back(s);
 
-              TList* keys = new TList();
+      message.Reset(kMESS_ANY);
+      message.SetCompressionLevel(1);
+      message.WriteInt(lines.size());
 
-              while (1)
-                {
-                  TNamed *obj = (TNamed*)iterator->Next();
-                  if (obj == NULL)
-                    break;
-      
-                  const char* name      = obj->GetName();
-                  
-                  if (!keys->FindObject(name))
-                    {
-                      TKey* key = MakeKey(obj, 1, gROOT);
-                      keys->Add(key);
-                    }
-                }
-              
-              delete iterator;
+      for (unsigned i=0; i<lines.size(); i++)
+        {
+          char* s = lines[i];
+          int epoch = strtol(s, &s, 0);
+          int rev = strtol(s, &s, 0);
+          while (*s == ' ')
+            s++;
 
-              if (gVerbose)
-                {
-                  printf("Sending keys %p\n", keys);
-                  keys->Print();
-                }
+          std::string path = NormalizePath(s);
 
-              message.Reset(kMESS_OBJECT);
-              message.WriteObject(keys);
-              delete keys;
-            }
-          else if (obj)
+          TObjString *xstr = NULL;
+          TObject *obj = FindObjectByName(s, &xstr);
+
+          if (obj && obj->InheritsFrom(TH1::Class()))
             {
-              fprintf(stderr, "netDirectoryServer: ERROR: obj %p name %s, type %s is not a directory!\n", obj, obj->GetName(), obj->IsA()->GetName());
-              TObjString s("Not a directory");
-              message.Reset(kMESS_OBJECT);
-              message.WriteObject(&s);
+              NetDirectoryRevisionPtr r = GetRevision(path, (TH1*)obj);
+              WriteDelta(message, path, r.get(), epoch, rev);
             }
           else
             {
-              fprintf(stderr, "netDirectoryServer: ERROR: obj %p not found\n", obj);
-              TObjString s("Not found");
-              message.Reset(kMESS_OBJECT);
-              message.WriteObject(&s);
+              gRevisions.erase(path);
+              message.WriteInt(kDeltaObject);
+              message.WriteInt(GetEpoch());
+              message.WriteInt(0);
+              WriteObjectReply(message, ObjectReply(obj));
             }
-              
-          lock.Unlock();
-          sock->Send(message);
-        }
-      else if (strncmp(request, "FindObjectByName ", 17) == 0)
-        {
-          LockRootGuard lock;
 
-          char* top  = request + 17;
+          if (xstr)
+            delete xstr;
+        }
 
-          char *s;
-          TObject *obj = TopLevel(top, &s);
+      if (gVerbose)
+        printf("GetObjects: sent %d objects\n", (int)lines.size());
+    }
+  else if (strncmp(request, "ResetTH1 ", 9) == 0)
+    {
+      char* path = request + 9;
 
-          //printf("toplevel found %p for \'%s\' remaining \'%s\'\n", obj, top, s);
+      if (strlen(path) > 1)
+        {
+          TObject *obj = FollowPath(path);
 
-          if (obj && !s)
+          if (obj)
+            ResetObject(obj);
+        }
+      else
+        {
+          for (unsigned int i=0; i<gExports.size(); i++)
             {
-              // they requested a top-level object. Give out a fake name
+              const char* ename = gExports[i].c_str();
+              const char* xname = gExportNames[ename].c_str();
 
-              char str[256];
-              sprintf(str, "TDirectory %s", obj->GetName());
+              TObject* obj = FindTopLevelObject(xname);
 
-              for (unsigned int i=0; i<gExports.size(); i++)
+              if (!obj)
                 {
-                  const char* ename = gExports[i].c_str();
-                  const char* xname = gExportNames[ename].c_str();
-
-                  if (strcmp(xname, obj->GetName()) == 0)
-                    {
-                      sprintf(str, "TDirectory %s", ename);
-                      break;
-                    }
+                  fprintf(stderr, "ResetTH1: Exported name \'%s\' cannot be found!\n", xname);
+                  continue;
                 }
 
-              obj = new TObjString(str); // FIXME: memory leak!
-            }
-          else if (obj)
-            {
-              obj = FollowPath(obj, s);
+              ResetObject(obj);
             }
+        }
+      
+      TObjString s("Success");
 
-          if (obj && obj->InheritsFrom(TDirectory::Class()))
-            {
-              char str[256];
-              sprintf(str, "TDirectory %s", obj->GetName());
-              obj = new TObjString(str);
-            }
-          
-          if (obj && obj->InheritsFrom(TFolder::Class()))
-            {
-              char str[256];
-              sprintf(str, "TDirectory %s", obj->GetName());
-              obj = new TObjString(str);
-            }
-          
-          if (obj && obj->InheritsFrom(TCollection::Class()))
-            {
-              char str[256];
-              sprintf(str, "TDirectory %s", obj->GetName());
-              obj = new TObjString(str);
-            }
-          
-          if (gVerbose)
-            {
-              if (obj)
-                printf("Sending object %p name \'%s\' class \'%s\'\n", obj, obj->GetName(), obj->IsA()->GetName());
-              else
-                printf("Sending object %p\n", obj);
-              //obj->Print();
-            }
+      message.Reset(kMESS_OBJECT);
+      message.WriteObject(&s);
+    }
+  else
+    {
+      fprintf(stderr, "netDirectoryServer: Received unknown request \"%s\"\n", request);
+      TObjString s("Unknown request");
+      message.Reset(kMESS_OBJECT);
+      message.WriteObject(&s);
+    }
+}
 
-          message.Reset(kMESS_OBJECT);
-          message.WriteObject(obj);
-          lock.Unlock();
+/*------------------------------------------------------------------*/
+
+// Snapshots of replies to read-only requests, built by the analysis
+// thread in NetDirectoryPublish() and served without the ROOT lock.
+// Only directory listings and histograms are kept; other objects (trees
+// in the output file...) can be large and are rarely asked for, they are
+// served under the ROOT lock. Histograms are kept as their revisions,
+// "FindObjectByName", "FindObjectDelta" and "GetObjects" replies are
+// made from them.
+// Nothing is published while no client is connected.
+
+struct NetDirectorySnapshot
+{
+  std::map<std::string,std::string> fReplies; // request -> reply message bytes
+  std::map<std::string,NetDirectoryRevisionPtr> fHists; // path -> histogram revision
+};
+
+static std::mutex gSnapshotMutex;
+static std::shared_ptr<const NetDirectorySnapshot> gSnapshot;
+
+static std::string NormalizeRequest(const char* request)
+{
+  // "FindObjectByName //rootana/hist" becomes "FindObjectByName rootana/hist"
+
+  const char* s = strchr(request, ' ');
+  if (!s)
+    return request;
+
+  return std::string(request, s - request + 1) + NormalizePath(s + 1);
+}
+
+static void SnapshotRequest(NetDirectorySnapshot* snap, TMessage& message, const std::string& request)
+{
+  std::vector<char> req(request.begin(), request.end());
+  req.push_back(0);
+
+  HandleRequest(&req[0], message);
+
+  message.SetLength(); // same as TSocket::Send()
+  snap->fReplies[request] = std::string(message.Buffer(), message.Length());
+}
+
+static void SnapshotObject(NetDirectorySnapshot* snap, TMessage& message, TObject* obj, const std::string& path)
+{
+  TCollection* list = NULL;
+
+  if (obj->InheritsFrom(TDirectory::Class()))
+    list = ((TDirectory*)obj)->GetList();
+  else if (obj->InheritsFrom(TFolder::Class()))
+    list = ((TFolder*)obj)->GetListOfFolders();
+  else if (obj->InheritsFrom(TCollection::Class()))
+    list = (TCollection*)obj;
+  else
+    {
+      if (obj->InheritsFrom(TH1::Class()))
+        snap->fHists[path] = UpdateRevision(path, (TH1*)obj);
+      return;
+    }
+
+  SnapshotRequest(snap, message, "FindObjectByName " + path);
+  SnapshotRequest(snap, message, "GetListOfKeys " + path);
+
+  if (!list)
+    return;
+
+  TIter next(list);
+  while (1)
+    {
+      TObject *xobj = next();
+      if (xobj == NULL)
+        break;
+      SnapshotObject(snap, message, xobj, path + "/" + xobj->GetName());
+    }
+}
+
+void NetDirectoryPublish()
+{
+  if (gNumConnections == 0)
+    {
+      // nobody to serve, drop the old snapshot
+      gRevisions.clear();
+      std::lock_guard<std::mutex> lock(gSnapshotMutex);
+      gSnapshot.reset();
+      return;
+    }
+
+  NetDirectorySnapshot* snap = new NetDirectorySnapshot;
+  TMessage message(kMESS_OBJECT);
+
+  SnapshotRequest(snap, message, "GetListOfKeys");
+
+  for (unsigned int i=0; i<gExports.size(); i++)
+    {
+      const char* ename = gExports[i].c_str();
+      const char* xname = gExportNames[ename].c_str();
+
+      TObject* obj = FindTopLevelObject(xname);
+
+      if (!obj)
+        continue;
+
+      SnapshotObject(snap, message, obj, ename);
+    }
+
+  // forget the histograms that were deleted or renamed
+  gRevisions = snap->fHists;
+
+  if (gVerbose)
+    printf("NetDirectoryPublish: snapshot of %d replies and %d histograms\n", (int)snap->fReplies.size(), (int)snap->fHists.size());
+
+  std::shared_ptr<const NetDirectorySnapshot> xsnap(snap);
+  std::lock_guard<std::mutex> lock(gSnapshotMutex);
+  gSnapshot.swap(xsnap);
+  // old snapshot is deleted when the last network thread is done with it
+}
+
+static bool ServeFromSnapshot(TSocket* sock, const char* request)
+{
+  std::shared_ptr<const NetDirectorySnapshot> snap;
+  {
+    std::lock_guard<std::mutex> lock(gSnapshotMutex);
+    snap = gSnapshot;
+  }
+
+  if (!snap)
+    return false;
+
+  if (strncmp(request, "FindObjectDelta ", 16) == 0)
+    {
+      char* s = (char*)request + 16;
+      int epoch = strtol(s, &s, 0);
+      int rev = strtol(s, &s, 0);
+      while (*s == ' ')
+        s++;
+
+      std::string path = NormalizePath(s);
+
+      std::map<std::string,NetDirectoryRevisionPtr>::const_iterator ih = snap->fHists.find(path);
+      if (ih != snap->fHists.end())
+        {
+          TMessage message(kMESS_ANY);
+          message.SetCompressionLevel(0);
+          WriteDelta(message, path, ih->second.get(), epoch, rev);
           sock->Send(message);
+          return true;
         }
-      else if (strncmp(request, "ResetTH1 ", 9) == 0)
-        {
-          LockRootGuard lock;
-          
-          char* path = request + 9;
 
-          if (strlen(path) > 1)
-            {
-              TObject *obj = FollowPath(path);
+      // not a histogram, same reply as FindObjectByName
+      std::map<std::string,std::string>::const_iterator it = snap->fReplies.find("FindObjectByName " + path);
+      if (it == snap->fReplies.end())
+        return false;
 
-              if (obj)
-                ResetObject(obj);
-            }
-          else
-            {
-              for (unsigned int i=0; i<gExports.size(); i++)
-                {
-                  const char* ename = gExports[i].c_str();
-                  const char* xname = gExportNames[ename].c_str();
+      sock->SendRaw(it->second.data(), it->second.size());
+      return true;
+    }
+
+  if (strncmp(request, "GetObjects\n", 11) == 0)
+    {
+      // same reply as HandleRequest(), if any object is not in the
+      // snapshot the whole request is served under the ROOT lock
 
-                  TObject* obj = FindTopLevelObject(xname);
+      std::vector<char> xrequest(request + 11, request + strlen(request) + 1);
+      std::vector<char*> lines;
+      char* saveptr = NULL;
+      for (char* s = strtok_r(&xrequest[0], "\n", &saveptr); s; s = strtok_r(NULL, "\n", &saveptr))
+        lines.push_back(s);
 
-                  if (!obj)
-                    {
-                      fprintf(stderr, "ResetTH1: Exported name \'%s\' cannot be found!\n", xname);
-                      continue;
-                    }
+      TMessage message(kMESS_ANY);
+      message.SetCompressionLevel(1);
+      message.WriteInt(lines.size());
 
-                  ResetObject(obj);
-                }
+      for (unsigned i=0; i<lines.size(); i++)
+        {
+          char* s = lines[i];
+          int epoch = strtol(s, &s, 0);
+          int rev = strtol(s, &s, 0);
+          while (*s == ' ')
+            s++;
+
+          std::string path = NormalizePath(s);
+
+          std::map<std::string,NetDirectoryRevisionPtr>::const_iterator ih = snap->fHists.find(path);
+          if (ih != snap->fHists.end())
+            {
+              WriteDelta(message, path, ih->second.get(), epoch, rev);
+              continue;
             }
-          
-          TObjString s("Success");
 
-          message.Reset(kMESS_OBJECT);
-          message.WriteObject(&s);
-          lock.Unlock();
-          sock->Send(message);
+          std::map<std::string,std::string>::const_iterator it = snap->fReplies.find("FindObjectByName " + path);
+          if (it == snap->fReplies.end())
+            return false;
+
+          message.WriteInt(kDeltaObject);
+          message.WriteInt(GetEpoch());
+          message.WriteInt(0);
+          WriteObjectReply(message, it->second);
         }
-      else
+
+      if (gVerbose)
+        printf("GetObjects: sent %d objects from snapshot\n", (int)lines.size());
+
+      sock->Send(message);
+      return true;
+    }
+
+  std::string xreq = NormalizeRequest(request);
+  const std::string* reply = NULL;
+
+  std::map<std::string,std::string>::const_iterator it = snap->fReplies.find(xreq);
+  if (it != snap->fReplies.end())
+    reply = &it->second;
+  else if (strncmp(xreq.c_str(), "FindObjectByName ", 17) == 0)
+    {
+      std::map<std::string,NetDirectoryRevisionPtr>::const_iterator ih = snap->fHists.find(xreq.substr(17));
+      if (ih != snap->fHists.end())
+        reply = &ih->second->fObject;
+    }
+
+  if (!reply)
+    return false;
+
+  if (gVerbose)
+    printf("Request [%s] served from snapshot\n", request);
+
+  sock->SendRaw(reply->data(), reply->size());
+  return true;
+}
+
+class SnapshotTimer : public TTimer
+{
+public:
+  SnapshotTimer(int period_msec)
+  {
+    Start(period_msec, kTRUE);
+  }
+
+  Bool_t Notify()
+  {
+    // runs in the main thread, same as the analysis
+    NetDirectoryPublish();
+    Reset();
+    return kTRUE;
+  }
+};
+
+void StartNetDirectorySnapshots(int period_msec)
+{
+  static SnapshotTimer* gSnapshotTimer = NULL;
+
+  if (gSnapshotTimer)
+    return;
+
+  gSnapshotsEnabled = true;
+  NetDirectoryPublish();
+  gSnapshotTimer = new SnapshotTimer(period_msec);
+}
+
+/*------------------------------------------------------------------*/
+
+static THREADTYPE root_server_thread(void *arg)
+/*
+  Serve histograms over TCP/IP socket link
+*/
+{
+   std::vector<char> xrequest(64*1024); // GetObjects requests can be long
+   char* request = &xrequest[0];
+
+   TSocket *sock = (TSocket *) arg;
+   TMessage message(kMESS_OBJECT);
+
+   gNumConnections++;
+
+   do {
+
+      /* close connection if client has disconnected */
+      int rd = sock->Recv(request, xrequest.size());
+      if (rd <= 0)
         {
-          fprintf(stderr, "netDirectoryServer: Received unknown request \"%s\"\n", request);
-          LockRootGuard lock;
-          TObjString s("Unknown request");
-          message.Reset(kMESS_OBJECT);
-          message.WriteObject(&s);
-          lock.Unlock();
-          sock->Send(message);
+          if (gVerbose)
+            fprintf(stderr, "TNetDirectory connection from %s closed\n", sock->GetInetAddress().GetHostName());
+          sock->Close();
+          delete sock;
+          if (--gNumConnections == 0)
+            {
+              // nobody to send changes to
+              LockRootGuard lock;
+              gRevisions.clear();
+            }
+          return THREADRETURN;
         }
+
+      if (gVerbose)
+        printf("Request [%s] from %s\n", request, sock->GetInetAddress().GetHostName());
+
+      if (ServeFromSnapshot(sock, request))
+        continue;
+
+      LockRootGuard lock;
+      HandleRequest(request, message);
+      // do not serve the histograms from before the reset
+      if (gSnapshotsEnabled && strncmp(request, "ResetTH1", 8) == 0)
+        NetDirectoryPublish();
+      lock.Unlock();
+      sock->Send(message);
    } while (1);
 
    return THREADRETURN;
@@ -682,6 +1349,7 @@ void StartNetDirectoryServer(int port, TDirectory* dir)
 
   gAlreadyRunning = true;
 
+  InitEpoch();
   StartLockRootTimer();
 
   static int pport = port;
@@ -14,4 +14,9 @@ void NetDirectoryExport(TDirectory* dir, const char* exportName);
 void NetDirectoryExport(TFolder* folder, const char* exportName);
 void NetDirectoryExport(TCollection* collection, const char* exportName);
 
+// serve read-only requests from snapshots published by the analysis thread,
+// network threads then do not need the ROOT lock for them
+void NetDirectoryPublish(); // call from the analysis thread
+void StartNetDirectorySnapshots(int period_msec = 1000); // publish periodically from a TTimer
+
 // end
@@ -12,6 +12,8 @@
 #include <string.h>
 #include <assert.h>
 
+#include <algorithm>
+
 #define MEMZERO(array) memset((array),0,sizeof(array))
 
 static uint8_t getUint8(const void* ptr, int offset)
@@ -171,23 +173,70 @@ void Alpha16Packet::Print() const
    printf("length: %d, bank length %d\n", length, bankLength);
 };
 
+Alpha16Waveform::Alpha16Waveform() // ctor
+{
+   bankPtr = NULL;
+   bankLen = 0;
+}
+
 void Alpha16Waveform::Unpack(const void* bkptr, int bklen8)
 {
    int nsamples = getUint16(bkptr, 28);
 
-   this->reserve(nsamples);
-   this->clear();
-   
+   bankPtr = NULL;
+   bankLen = 0;
+
+   this->resize(nsamples);
+
    //printf("Unpacking: "); Print();
+
+   // samples are big-endian, this loop is simple enough for the compiler to vectorize
+   const uint8_t* p = ((const uint8_t*)bkptr) + 30;
+   int16_t* w = this->data();
    for (int i=0; i<nsamples; i++) {
-      int16_t v = getUint16(bkptr, 30 + i*2);
-      //printf("sample %d: 0x%02x (%d)\n", i, v, v);
-      this->push_back(v);
+      w[i] = (int16_t)((p[2*i]<<8) | p[2*i+1]);
+      //printf("sample %d: 0x%02x (%d)\n", i, w[i], w[i]);
    }
 };
 
+void Alpha16Waveform::SetBank(const void* bkptr, int bklen8)
+{
+   this->clear();
+   bankPtr = bkptr;
+   bankLen = bklen8;
+}
+
+void Alpha16Waveform::UnpackBank()
+{
+   if (bankPtr)
+      Unpack(bankPtr, bankLen);
+}
+
+void Alpha16Waveform::Clear()
+{
+   this->clear();
+   bankPtr = NULL;
+   bankLen = 0;
+}
+
+int Alpha16Waveform::NumSamples() const
+{
+   if (bankPtr)
+      return getUint16(bankPtr, 28);
+   return this->size();
+}
+
+int16_t Alpha16Waveform::Sample(int i) const
+{
+   if (bankPtr)
+      return getUint16(bankPtr, 30 + i*2);
+   return (*this)[i];
+}
+
 Alpha16Event::Alpha16Event() // ctor
 {
+   MEMZERO(udpPresent);
+   MEMZERO(udpEventTs);
    Reset();
 }
 
@@ -196,12 +245,24 @@ void Alpha16Event::Reset()
    eventNo = 0;
    eventTime = 0;
    prevEventTime = 0;
-   MEMZERO(udpPresent);
-   MEMZERO(udpEventTs);
+   // only clear the channels we have, not all MAX_ALPHA16*NUM_CHAN_ALPHA16 of them
+   for (unsigned i=0; i<udpChan.size(); i++) {
+      int chan = udpChan[i];
+      udpPresent[chan] = false;
+      udpEventTs[chan] = 0;
+      waveform[chan].Clear();
+   }
+   udpChan.clear();
    numChan = 0;
    error    = false;
    complete = false;
 }
+
+const Alpha16Waveform& Alpha16Event::GetWaveform(int chan)
+{
+   waveform[chan].UnpackBank();
+   return waveform[chan];
+}
    
 Alpha16Event::~Alpha16Event() // dtor
 {
@@ -212,10 +273,27 @@ void Alpha16Event::Print() const
    printf("ALPHA16 event: %d, time %.0f (incr %.0f), channels: %d, error %d, complete %d\n", eventNo, eventTime, eventTime - prevEventTime, numChan, error, complete);
 }
 
+//static const int chanmap_top[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+static const int chanmap_top[] = { 7, 15, 6, 14, 5, 13, 4, 12, 3, 11, 2, 10, 1, 9, 0, 8 };
+static const int chanmap_bot[] = { 8, 0, 9, 1, 10, 2, 11, 3, 12, 4, 13, 5, 14, 6, 15, 7 };
+
 Alpha16EVB::Alpha16EVB() // ctor
 {
+   fConfLazyWaveform = false;
    Reset();
 }
+
+Alpha16EVB::~Alpha16EVB() // dtor
+{
+   for (unsigned i=0; i<fEventPool.size(); i++)
+      delete fEventPool[i];
+   fEventPool.clear();
+}
+
+void Alpha16EVB::SetLazyWaveform(bool enable)
+{
+   fConfLazyWaveform = enable;
+}
    
 void Alpha16EVB::Reset()
 {
@@ -225,6 +303,12 @@ void Alpha16EVB::Reset()
    MEMZERO(fFirstEventTs);
    fLastEventTs = 0;
    fConfModMap.clear();
+   fConfModIndex.clear();
+   fConfModTopBot.clear();
+   for (int i=0; i<NUM_CHAN_ALPHA16; i++) {
+      fConfChanIndexTop[i] = -1;
+      fConfChanIndexBot[i] = -1;
+   }
    fConfNumChan = 0;
    fConfNumSamples = 0;
 }
@@ -281,6 +365,43 @@ void Alpha16EVB::Configure(int runno)
    }
    
    fConfNumChan = NUM_CHAN_ALPHA16 * fConfModMap.size();
+
+   // build the inverse maps used by AddBank()
+
+   int maxmod = 0;
+   for (unsigned x=0; x<fConfModMap.size(); x++) {
+      int xmodule = fConfModMap[x];
+      if (xmodule < 0)
+         xmodule = -xmodule;
+      if (xmodule > maxmod)
+         maxmod = xmodule;
+   }
+
+   fConfModIndex.assign(maxmod+1, -1);
+   fConfModTopBot.assign(maxmod+1, 0);
+
+   for (unsigned x=0; x<fConfModMap.size(); x++) {
+      int xmodule = fConfModMap[x];
+      int top_bot = 1;
+      if (xmodule < 0) {
+         xmodule = -xmodule;
+         top_bot = -1;
+      }
+      if (fConfModIndex[xmodule] < 0) {
+         fConfModIndex[xmodule] = x;
+         fConfModTopBot[xmodule] = top_bot;
+      }
+   }
+
+   for (int i=0; i<NUM_CHAN_ALPHA16; i++) {
+      fConfChanIndexTop[i] = -1;
+      fConfChanIndexBot[i] = -1;
+   }
+
+   for (int i=NUM_CHAN_ALPHA16-1; i>=0; i--) {
+      fConfChanIndexTop[chanmap_top[i]] = i;
+      fConfChanIndexBot[chanmap_bot[i]] = i;
+   }
 }
 
 #if 0
@@ -301,25 +422,13 @@ bool Alpha16EVB::Match(const Alpha16Event* e, int imodule, uint32_t udpTs)
 }
 #endif
 
-//static const int chanmap_top[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
-static const int chanmap_top[] = { 7, 15, 6, 14, 5, 13, 4, 12, 3, 11, 2, 10, 1, 9, 0, 8 };
-static const int chanmap_bot[] = { 8, 0, 9, 1, 10, 2, 11, 3, 12, 4, 13, 5, 14, 6, 15, 7 };
-
 void Alpha16EVB::AddBank(Alpha16Event* e, int xmodule, const void* bkptr, int bklen)
 {
-   int ymodule = -1;
-   int top_bot = 0;
-   
-   for (unsigned x=0; x<fConfModMap.size(); x++)
-      if (fConfModMap[x] == xmodule) {
-         ymodule = x;
-         top_bot = 1;
-         break;
-      } else if (fConfModMap[x] == -xmodule) {
-         ymodule = x;
-         top_bot = -1;
-         break;
-      }
+   if (xmodule <= 0 || xmodule >= (int)fConfModIndex.size())
+      return;
+
+   int ymodule = fConfModIndex[xmodule];
+   int top_bot = fConfModTopBot[xmodule];
    
    if (ymodule < 0)
       return;
@@ -335,18 +444,10 @@ void Alpha16EVB::AddBank(Alpha16Event* e, int xmodule, const void* bkptr, int bk
    int ychan = -1; 
 
    if (top_bot < 0)
-      for (int i=0; i<16; i++)
-         if (chanmap_bot[i] == xchan) {
-            ychan = i;
-            break;
-         }
+      ychan = fConfChanIndexBot[xchan];
 
    if (top_bot > 0)
-      for (int i=0; i<16; i++)
-         if (chanmap_top[i] == xchan) {
-            ychan = i;
-            break;
-         }
+      ychan = fConfChanIndexTop[xchan];
 
    assert(ychan>=0);
 
@@ -359,20 +460,39 @@ void Alpha16EVB::AddBank(Alpha16Event* e, int xmodule, const void* bkptr, int bk
    }
    
    e->udpPacket[chan].Unpack(bkptr, bklen);
-   e->waveform[chan].Unpack(bkptr, bklen);
+   if (fConfLazyWaveform)
+      e->waveform[chan].SetBank(bkptr, bklen);
+   else
+      e->waveform[chan].Unpack(bkptr, bklen);
    e->udpPresent[chan] = true;
    e->udpEventTs[chan] = e->udpPacket[chan].eventTimestamp;
+   e->udpChan.push_back(chan);
    e->numChan++;
 }
 
 Alpha16Event* Alpha16EVB::NewEvent()
 {
-   Alpha16Event *e = new Alpha16Event();
+   Alpha16Event *e = NULL;
+   if (fEventPool.empty()) {
+      e = new Alpha16Event();
+   } else {
+      e = fEventPool.back();
+      fEventPool.pop_back();
+      e->Reset();
+   }
    fEventCount++;
    e->eventNo = fEventCount;
    return e;
 }
 
+void Alpha16EVB::ReleaseEvent(Alpha16Event* e)
+{
+   if (!e)
+      return;
+   e->Reset();
+   fEventPool.push_back(e);
+}
+
 const double TSCLK = 0.1; // GHz
 
 void Alpha16EVB::CheckEvent(Alpha16Event* e)
@@ -380,12 +500,16 @@ void Alpha16EVB::CheckEvent(Alpha16Event* e)
    int count = 0;
    unsigned num_samples = 0;
 
-   for (int i=0; i<MAX_ALPHA16 * NUM_CHAN_ALPHA16; i++) {
+   // look only at received channels, in channel order
+   std::sort(e->udpChan.begin(), e->udpChan.end());
+
+   for (unsigned j=0; j<e->udpChan.size(); j++) {
+      int i = e->udpChan[j];
       if (e->udpPresent[i]) {
          count++;
          if (num_samples == 0)
-            num_samples = e->waveform[i].size();
-         if (e->waveform[i].size() != num_samples) {
+            num_samples = e->waveform[i].NumSamples();
+         if ((unsigned)e->waveform[i].NumSamples() != num_samples) {
             // wrong number of ADC samples
             e->error = true;
          }
@@ -407,7 +531,8 @@ void Alpha16EVB::CheckEvent(Alpha16Event* e)
    if (!fHaveEventTs && e->complete) {
       fHaveEventTs = true;
       // set timestamp offsets from the first complete event
-      for (int i=0; i<MAX_ALPHA16 * NUM_CHAN_ALPHA16; i++) {
+      for (unsigned j=0; j<e->udpChan.size(); j++) {
+         int i = e->udpChan[j];
          if (e->udpPresent[i]) {
             fFirstEventTs[i] = e->udpEventTs[i];
             printf("XXX %d -> 0x%08x\n", i, fFirstEventTs[i]);
@@ -418,7 +543,8 @@ void Alpha16EVB::CheckEvent(Alpha16Event* e)
    if (fHaveEventTs && e->complete) {
       uint32_t ets = 0;
       // check timestamps
-      for (int i=0; i<MAX_ALPHA16 * NUM_CHAN_ALPHA16; i++) {
+      for (unsigned j=0; j<e->udpChan.size(); j++) {
+         int i = e->udpChan[j];
          if (e->udpPresent[i]) {
             uint32_t ts = e->udpEventTs[i] - fFirstEventTs[i];
             if (ets == 0)
@@ -44,7 +44,16 @@ typedef std::vector<int16_t> Alpha16WaveformVector;
 class Alpha16Waveform: public Alpha16WaveformVector
 {
  public:
+   const void* bankPtr; // bank data for on-demand unpacking, NULL if unpacked
+   int bankLen;
+
+   Alpha16Waveform(); // ctor
    void Unpack(const void* bkptr, int bklen8);
+   void SetBank(const void* bkptr, int bklen8); // keep pointer to bank data, unpack later
+   void UnpackBank(); // unpack the bank data from SetBank(), if not done yet
+   void Clear(); // clear samples and bank pointer, keep the storage
+   int  NumSamples() const; // number of samples, without unpacking
+   int16_t Sample(int i) const; // read one sample from bank data or unpacked samples
 };
 
 #define MAX_ALPHA16 32
@@ -63,6 +72,7 @@ struct Alpha16Event
    Alpha16Waveform waveform[MAX_ALPHA16*NUM_CHAN_ALPHA16];
 
    int  numChan;  // count of received channels
+   std::vector<int> udpChan; // list of received channels, in order of arrival
 
    bool error;    // event has an error
    bool complete; // event is complete
@@ -72,6 +82,8 @@ struct Alpha16Event
 
    void Reset();
    void Print() const;
+
+   const Alpha16Waveform& GetWaveform(int chan); // unpack waveform on demand
 };
 
 struct Alpha16EVB
@@ -85,10 +97,20 @@ struct Alpha16EVB
 
    int fConfNumChan;
    int fConfNumSamples;
+   bool fConfLazyWaveform; // keep waveforms as pointers to bank data, see SetLazyWaveform()
 
    std::vector<int> fConfModMap;
+
+   // inverse maps built by Configure()
+   std::vector<int> fConfModIndex;  // module id -> index in fConfModMap, -1 if not mapped
+   std::vector<int> fConfModTopBot; // module id -> +1 top, -1 bottom
+   int fConfChanIndexTop[NUM_CHAN_ALPHA16]; // adc channel -> channel index, top modules
+   int fConfChanIndexBot[NUM_CHAN_ALPHA16]; // adc channel -> channel index, bottom modules
    
+   std::vector<Alpha16Event*> fEventPool; // free events for reuse
+
    Alpha16EVB(); // ctor
+   ~Alpha16EVB(); // dtor
    
    void Reset();
    //void Print() const;
@@ -96,6 +118,8 @@ struct Alpha16EVB
    void Configure(int runno);
 
    Alpha16Event* NewEvent();
+   void ReleaseEvent(Alpha16Event* e); // return event to the pool, instead of "delete e"
+   void SetLazyWaveform(bool enable); // if enabled, bank data must stay valid until the event is released
    void AddBank(Alpha16Event* e, int imodule, const void* bkptr, int bklen);
    void CheckEvent(Alpha16Event* e);
 
@@ -9,9 +9,74 @@
 #include <time.h>
 #include <sys/time.h>
 
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
 #include "UnpackVF48A.h"
 
+struct VF48job
+{
+  int unit;
+  std::vector<uint32_t> data;
+  std::vector<VF48fragment> fragments;
+};
+
+struct VF48workers
+{
+  std::vector<std::thread> threads;
+  std::mutex mutex;
+  std::mutex pool_mutex;
+  std::condition_variable start;
+  std::condition_variable done;
+  int  generation;
+  bool shutdown;
+  int  running;
+  std::atomic<int> next; // next entry in units[]
+  std::vector<int> units; // units with pending jobs
+
+  VF48workers() : generation(0), shutdown(false), running(0), next(0) {} // ctor
+};
+
+void VF48channel::AllocSamples(int num_samples)
+{
+  if (num_samples <= maxSamples)
+    return;
+
+  if (num_samples > VF48_MAX_SAMPLES)
+    num_samples = VF48_MAX_SAMPLES;
+
+  // round up to even number, samples arrive in pairs
+  num_samples = (num_samples + 1) & ~1;
+
+  samples = (uint16_t*)realloc(samples, num_samples*sizeof(uint16_t));
+  assert(samples);
+  maxSamples = num_samples;
+}
+
 VF48module::VF48module(int i) // ctor  
+{
+  for (int j=0; j<VF48_MAX_CHANNELS; j++)
+    {
+      channels[j].samples    = NULL;
+      channels[j].maxSamples = 0;
+    }
+  Reset(i);
+}
+
+VF48module::~VF48module() // dtor
+{
+  for (int j=0; j<VF48_MAX_CHANNELS; j++)
+    if (channels[j].samples)
+      {
+        free(channels[j].samples);
+        channels[j].samples = NULL;
+        channels[j].maxSamples = 0;
+      }
+}
+
+void VF48module::Reset(int i)
 {
   unit = i;
   trigger = 0;
@@ -35,6 +100,8 @@ VF48module::VF48module(int i) // ctor
   for (int i=0; i<VF48_MAX_CHANNELS; i++)
     {
       channels[i].channel    = -1;
+      channels[i].time       =  0;
+      channels[i].charge     =  0;
       channels[i].numSamples =  0;
       channels[i].complete   =  false;
     }
@@ -58,6 +125,13 @@ void VF48module::PrintModule() const
 }
 
 VF48event::VF48event(int xeventNo) // ctor
+{
+  for (int i=0; i<VF48_MAX_MODULES; i++)
+    modules[i] = NULL;
+  Reset(xeventNo);
+}
+
+void VF48event::Reset(int xeventNo)
 {
   eventNo = xeventNo;
   timestamp = 0;
@@ -65,7 +139,7 @@ VF48event::VF48event(int xeventNo) // ctor
   error = 0;
   modulesMask = 0;
   for (int i=0; i<VF48_MAX_MODULES; i++)
-    modules[i] = NULL;
+    assert(modules[i] == NULL);
 }
 
 VF48event::~VF48event() // dtor
@@ -163,6 +237,15 @@ UnpackVF48::UnpackVF48() // ctor
    fEventNo = 0;
    fBadDataCount = 0;
 
+   fNumThreads = 0;
+   fNumJobs = 0;
+   fWorkers = NULL;
+
+   for (int i=0; i<VF48_MAX_MODULES; i++) {
+      wout[i] = NULL;
+      wbad[i] = 0;
+   }
+
    for (int i=0; i<VF48_MAX_MODULES; i++)
       for (int j=0; j<VF48_MAX_GROUPS; j++)
          wbuf[i][j] = NULL;
@@ -172,8 +255,14 @@ UnpackVF48::UnpackVF48() // ctor
 
 UnpackVF48::~UnpackVF48() // dtor
 {
+   StopWorkers();
+   for (unsigned i=0; i<fJobs.size(); i++)
+      delete fJobs[i];
+   fJobs.clear();
+   fNumJobs = 0;
    ResetEventBuffer();
    ResetStreamBuffer();
+   DeletePool();
    for (int i=0; i<VF48_MAX_MODULES; i++)
       for (int j=0; j<VF48_MAX_GROUPS; j++)
          if (wbuf[i][j]) {
@@ -265,21 +354,176 @@ void UnpackVF48::SetFlushIncompleteThreshold(int threshold)
 
 VF48event* UnpackVF48::FindEvent(int unit, double timestamp, bool dup)
 {
-   for (unsigned i=0; i<fBuffer.size(); i++) {
-      VF48event* e = fBuffer[i];
+   // look only at events inside the coincidence window,
+   // pick the oldest one, same as scanning fBuffer from the front.
+
+   VF48event* found = NULL;
+
+   std::multimap<double,VF48event*>::iterator it = fBufferIndex.lower_bound(timestamp - fCoinc);
+   for (; it != fBufferIndex.end() && it->first < timestamp + fCoinc; it++) {
+      VF48event* e = it->second;
       if (fabs(e->timestamp - timestamp) < fCoinc)
          if (e->modules[unit] == NULL || dup)
-            return e;
+            if (!found || e->eventNo < found->eventNo)
+               found = e;
    }
 
-   VF48event* e = new VF48event(++fEventNo);
+   if (found)
+      return found;
+
+   VF48event* e = NewEvent(++fEventNo);
    e->timestamp = timestamp;
    fBuffer.push_back(e);
+   fBufferIndex.insert(std::pair<double,VF48event*>(timestamp, e));
    return e;
 }
 
+void UnpackVF48::PopEvent()
+{
+   VF48event* e = fBuffer.front();
+   fBuffer.pop_front();
+
+   std::pair<std::multimap<double,VF48event*>::iterator,std::multimap<double,VF48event*>::iterator> r = fBufferIndex.equal_range(e->timestamp);
+   for (std::multimap<double,VF48event*>::iterator it = r.first; it != r.second; it++)
+      if (it->second == e) {
+         fBufferIndex.erase(it);
+         break;
+      }
+}
+
+VF48module* UnpackVF48::NewFragment(int unit, int group, double timestamp)
+{
+   // called from the worker threads
+   VF48module* m = NULL;
+   {
+      std::lock_guard<std::mutex> lock(fWorkers->pool_mutex);
+      m = NewModule(unit);
+   }
+   wout[unit]->push_back(VF48fragment(group, timestamp, m));
+   return m;
+}
+
+void UnpackVF48::MergeFragment(int unit, const VF48fragment& f)
+{
+   // do what UnpackEvent() does in serial mode, when it finds
+   // the module in the event buffer and unpacks the data into it.
+
+   VF48module* x = f.module;
+   VF48module* m = FindModule(unit, f.group, f.timestamp);
+
+   m->unit = unit;
+   m->trigger = x->trigger;
+
+   for (int i=0; i<VF48_MAX_GROUPS; i++) {
+      if (x->timestampGroupMask & (1<<i)) {
+         m->trigno[i] = x->trigno[i];
+         m->timestamp64[i] = x->timestamp64[i];
+         m->timestamps[i] = x->timestamps[i];
+      }
+      if (x->hitMask[i])
+         m->hitMask[i] = x->hitMask[i];
+      m->presentMask[i] |= x->presentMask[i];
+   }
+
+   if (x->timestampGroupMask)
+      m->tgroup = x->tgroup;
+
+   if (x->error)
+      m->error = x->error;
+
+   m->groupMask |= x->groupMask;
+   m->timestampGroupMask |= x->timestampGroupMask;
+   m->completeGroupMask |= x->completeGroupMask;
+
+   for (int i=0; i<VF48_MAX_CHANNELS; i++) {
+      VF48channel* xc = &x->channels[i];
+      VF48channel* mc = &m->channels[i];
+
+      if (xc->channel < 0)
+         continue;
+
+      if (mc->numSamples != 0) {
+         printf("*** Unit %d, group %d, trigger %d: Duplicate data for channel %d: already have %d samples\n", unit, f.group, x->trigger, i, mc->numSamples);
+         fBadDataCount++;
+         m->error = 1;
+      }
+
+      // swap the sample storage, the fragment goes back to the pool
+      uint16_t* samples = mc->samples;
+      int maxSamples = mc->maxSamples;
+
+      *mc = *xc;
+
+      xc->samples = samples;
+      xc->maxSamples = maxSamples;
+   }
+
+   ReleaseModule(x);
+
+   if (f.trailer)
+      if (m->completeGroupMask == fGroupEnabled[unit])
+         CompleteModule(m);
+}
+
+VF48event* UnpackVF48::NewEvent(int eventNo)
+{
+   if (fEventPool.empty())
+      return new VF48event(eventNo);
+
+   VF48event* e = fEventPool.back();
+   fEventPool.pop_back();
+   e->Reset(eventNo);
+   return e;
+}
+
+VF48module* UnpackVF48::NewModule(int unit)
+{
+   if (fModulePool.empty())
+      return new VF48module(unit);
+
+   VF48module* m = fModulePool.back();
+   fModulePool.pop_back();
+   m->Reset(unit);
+   return m;
+}
+
+void UnpackVF48::ReleaseModule(VF48module* m)
+{
+   fModulePool.push_back(m);
+}
+
+void UnpackVF48::ReleaseEvent(VF48event* e)
+{
+   if (!e)
+      return;
+
+   for (int i=0; i<VF48_MAX_MODULES; i++)
+      if (e->modules[i]) {
+         ReleaseModule(e->modules[i]);
+         e->modules[i] = NULL;
+      }
+
+   fEventPool.push_back(e);
+}
+
+void UnpackVF48::DeletePool()
+{
+   for (unsigned i=0; i<fEventPool.size(); i++)
+      delete fEventPool[i];
+   fEventPool.clear();
+
+   for (unsigned i=0; i<fModulePool.size(); i++)
+      delete fModulePool[i];
+   fModulePool.clear();
+}
+
 VF48event* UnpackVF48::GetEvent(bool flush)
 {
+   // finish unpacking of data queued by UnpackStream()
+
+   if (fNumJobs > 0)
+      RunJobs();
+
    // if buffer is empty, return nothing
 
    if (fBuffer.size() < 1)
@@ -295,7 +539,7 @@ VF48event* UnpackVF48::GetEvent(bool flush)
    // the end of file or end of run, return it
 
    if (e->complete || flush) {
-      fBuffer.pop_front();
+      PopEvent();
       return e;
    }
 
@@ -312,7 +556,7 @@ VF48event* UnpackVF48::GetEvent(bool flush)
          CompleteEvent(ee);
 
       if (ee->complete) {
-         fBuffer.pop_front();
+         PopEvent();
          return e;
       }
    }
@@ -328,7 +572,7 @@ VF48event* UnpackVF48::GetEvent(bool flush)
    // the user deal with it.
 
    if (fBuffer.size() > fFlushIncompleteThreshold) {
-      fBuffer.pop_front();
+      PopEvent();
       return e;
    }
       
@@ -340,6 +584,9 @@ VF48event* UnpackVF48::GetEvent(bool flush)
 
 void UnpackVF48::Reset()
 {
+  // discard data queued for parallel unpacking
+  fNumJobs = 0;
+
   ResetEventBuffer();
   ResetStreamBuffer();
 
@@ -404,8 +651,8 @@ void UnpackVF48::CompleteModule(VF48module* m)
           m->error = 1;
         }
 
-      if (m->channels[i].numSamples > VF48_MAX_SAMPLES)
-         m->channels[i].numSamples = VF48_MAX_SAMPLES;
+      if (m->channels[i].numSamples > m->channels[i].maxSamples)
+         m->channels[i].numSamples = m->channels[i].maxSamples;
     }
   
   uint32_t tn = m->trigno[m->tgroup];
@@ -485,8 +732,8 @@ void UnpackVF48::AddToEvent(VF48module* m)
 #endif
       // we are not adding this module to this event,
       // but somebody has to delete the module data.
-      // We do it here.
-      delete m;
+      // We return it to the pool here.
+      ReleaseModule(m);
       return;
     }
 
@@ -565,6 +812,8 @@ void UnpackVF48::ResetStreamBuffer()
   for (int i=0; i<VF48_MAX_MODULES; i++) {
     wgrp[i] = 0;
     wdiscarded[i] = 0;
+    wxi[i] = 0;
+    wxc[i] = 0;
     for (int j=0; j<VF48_MAX_GROUPS; j++) {
       wmax[i][j] = 0;
       wptr[i][j] = 0;
@@ -579,9 +828,10 @@ void UnpackVF48::ResetEventBuffer()
 
   for (unsigned i=0; i<fBuffer.size(); i++) {
      VF48event *e = fBuffer[i];
-     delete e;
+     ReleaseEvent(e);
   }
   fBuffer.clear();
+  fBufferIndex.clear();
 }
 
 VF48module* UnpackVF48::FindModule(int unit, int group, double timestamp)
@@ -595,12 +845,12 @@ VF48module* UnpackVF48::FindModule(int unit, int group, double timestamp)
     if (e->modules[unit])
       return e->modules[unit];
 
-    VF48module* m = new VF48module(unit);
+    VF48module* m = NewModule(unit);
     e->modules[unit] = m;
     return m;
   }
 
-  VF48module* m = new VF48module(unit);
+  VF48module* m = NewModule(unit);
   AddToEvent(m);
   return m;
 }
@@ -632,6 +882,8 @@ void UnpackVF48::UnpackEvent(int unit, int group, const uint32_t data[], int wco
 
   bool doexit = false;
 
+  int badDataCount = 0;
+
   VF48module* m = NULL;
 
   int chan = -1;
@@ -690,7 +942,7 @@ void UnpackVF48::UnpackEvent(int unit, int group, const uint32_t data[], int wco
             if (m)
               m->error = 1;
             
-            fBadDataCount++;
+            badDataCount++;
             printf("*** Unit %d, group %d, trigger %d: Unexpected data at %5d: 0x%08x, skipping to next event header\n", unit, group, headerTrigNo, i, w);
             
             //accept = false;
@@ -717,7 +969,7 @@ void UnpackVF48::UnpackEvent(int unit, int group, const uint32_t data[], int wco
              if (0 && trigNo > 1) {
                 if (trigNo != c->headerTrigNo+1) {
                    printf("*** Unit %d, group %d, trigger %d: Out of sequence trigger %d should be %d\n", unit, group, trigNo, trigNo, c->headerTrigNo+1);
-                   fBadDataCount++;
+                   badDataCount++;
                 }
              }
 #endif
@@ -725,7 +977,7 @@ void UnpackVF48::UnpackEvent(int unit, int group, const uint32_t data[], int wco
 	     headerTrigNo = trigNo;
 
 	     //printf("*** Unit %d, group %d, trigger %d: Event header for trigger %d without an event trailer for previous trigger %d, group %d\n", unit, group, trigNo, trigNo, c->headerTrigNo, c->group);
-	     //fBadDataCount++;
+	     //badDataCount++;
 
              break;
           }
@@ -742,7 +994,7 @@ void UnpackVF48::UnpackEvent(int unit, int group, const uint32_t data[], int wco
 		timestamp2 = ts;
               else {
                 printf("*** Unit %d, group %d, trigger %d: Unexpected timestamp count: %d\n", unit, group, headerTrigNo, timestampCount);
-		fBadDataCount++;
+		badDataCount++;
                 if (m)
                    m->error = 1;
 	      }
@@ -759,7 +1011,7 @@ void UnpackVF48::UnpackEvent(int unit, int group, const uint32_t data[], int wco
 
             if (group != 0) { // definitely new mode
                if (cgroup != 0) { // group number in 0xC header is always zero for new data
-                  fBadDataCount++;
+                  badDataCount++;
                   merror = 1;
                   printf("*** Unit %d, group %d, trigger %d: data at %5d: 0x%08x, Invalid cgroup number %d should be zero\n", unit, group, headerTrigNo, i, w, cgroup);
                }
@@ -767,7 +1019,7 @@ void UnpackVF48::UnpackEvent(int unit, int group, const uint32_t data[], int wco
 
             if (cgroup != 0) { // definitely old data
                if (group != 0) { // old data should always come from data buffer for group 0
-                  fBadDataCount++;
+                  badDataCount++;
                   merror = 1;
                   printf("*** Unit %d, group %d, trigger %d: data at %5d: 0x%08x, Invalid group number %d should be zero\n", unit, group, headerTrigNo, i, w, group);
                }
@@ -784,7 +1036,7 @@ void UnpackVF48::UnpackEvent(int unit, int group, const uint32_t data[], int wco
             if ((chan < 0) || (chan >= VF48_MAX_CHANNELS)) {
               printf("*** Unit %d, group %d, trigger %d: data at %5d: 0x%08x, Bad channel number %d\n", unit, group, headerTrigNo, i, w, chan);
               merror = 1;
-	      fBadDataCount++;
+	      badDataCount++;
 	      break;
 	    }
 
@@ -793,7 +1045,7 @@ void UnpackVF48::UnpackEvent(int unit, int group, const uint32_t data[], int wco
                   
               if (ts48 == 0 && headerTrigNo == 1 && ts_first[unit][group] != 0) {
                   printf("*** Unit %d, group %d, trigger %d: Group %d unexpected event counter and timestamp reset!\n", unit, group, headerTrigNo, group);
-		  fBadDataCount++;
+		  badDataCount++;
                   merror = 1;
 		  ts_first[unit][group] = 0;
               }
@@ -814,7 +1066,7 @@ void UnpackVF48::UnpackEvent(int unit, int group, const uint32_t data[], int wco
 	      if (ts48 == ts_last[unit][cgroup])
 		{
                   printf("*** Unit %d, group %d, trigger %d: Group %d has invalid timestamp %d, should be more than %d\n", unit, group, headerTrigNo, group, (int)ts48, (int)ts_last[unit][cgroup]);
-		  fBadDataCount++;
+		  badDataCount++;
                   merror = 1;
 		  ts48 = ts_last[unit][cgroup] + (int)(fCoinc*fFreq[unit])+1;
 		}
@@ -824,7 +1076,10 @@ void UnpackVF48::UnpackEvent(int unit, int group, const uint32_t data[], int wco
 	      double timestamp = (ts48 - ts_first[unit][group])/fFreq[unit];
 
 	      if (!m) {
-		m = FindModule(unit, group, timestamp);
+                if (wout[unit])
+                   m = NewFragment(unit, group, timestamp);
+                else
+                   m = FindModule(unit, group, timestamp);
 		
 		m->unit = unit;
 		m->trigger = headerTrigNo;
@@ -853,7 +1108,7 @@ void UnpackVF48::UnpackEvent(int unit, int group, const uint32_t data[], int wco
             if (m->channels[chan].numSamples != 0)
                {
                   printf("*** Unit %d, group %d, trigger %d: Duplicate data for channel %d: already have %d samples\n", unit, group, headerTrigNo, chan, m->channels[chan].numSamples);
-                  fBadDataCount++;
+                  badDataCount++;
                   m->error = 1;
                }
 
@@ -865,6 +1120,7 @@ void UnpackVF48::UnpackEvent(int unit, int group, const uint32_t data[], int wco
             m->channels[chan].complete   = false;
             m->channels[chan].numSamples = 0;
             m->channels[chan].channel    = chan;
+            m->channels[chan].AllocSamples(fNumSamples[unit]);
 
 	    m->completeGroupMask |= (1<<cgroup);
           }
@@ -878,7 +1134,7 @@ void UnpackVF48::UnpackEvent(int unit, int group, const uint32_t data[], int wco
 
                     if (m)
                        m->error = 1;
-                    fBadDataCount++;
+                    badDataCount++;
                     printf("*** Unit %d, group %d, trigger %d: Unexpected adc samples data at %5d: 0x%08x (no module %p or bad channel number %d)\n", unit, group, headerTrigNo, i, w, m, chan);
                     
                     //accept[unit] = false;
@@ -897,11 +1153,12 @@ void UnpackVF48::UnpackEvent(int unit, int group, const uint32_t data[], int wco
                  {
                     if (1)
                        {
-                          fBadDataCount++;
+                          badDataCount++;
                           m->error = 1;
                           
-                          static int xi = 0;
-                          static int xc = 0;
+                          // per unit, each unit is unpacked by one thread
+                          int& xi = wxi[unit];
+                          int& xc = wxc[unit];
                           
                           if (xi+1 != i)
                              {
@@ -918,6 +1175,9 @@ void UnpackVF48::UnpackEvent(int unit, int group, const uint32_t data[], int wco
                  }
               else if (cc->numSamples < VF48_MAX_SAMPLES-2)
                  {
+                    if (cc->numSamples+2 > cc->maxSamples)
+                       cc->AllocSamples(2*cc->maxSamples + 2);
+
                     cc->samples[cc->numSamples++] = sample1;
                     cc->samples[cc->numSamples++] = sample2;
 
@@ -926,7 +1186,7 @@ void UnpackVF48::UnpackEvent(int unit, int group, const uint32_t data[], int wco
               else
                  {
                    printf("*** Unit %d group %d channel %d has too many samples: %d\n", unit, group, chan, cc->numSamples);
-		   fBadDataCount++;
+		   badDataCount++;
 		   cc->numSamples += 2;
 		   m->error = 1;
                  }
@@ -941,7 +1201,7 @@ void UnpackVF48::UnpackEvent(int unit, int group, const uint32_t data[], int wco
 
                     if (m)
                        m->error = 1;
-                    fBadDataCount++;
+                    badDataCount++;
                     printf("*** Unit %d, group %d, trigger %d: Unexpected time data at %5d: 0x%08x (no module %p or bad channel number %d)\n", unit, group, headerTrigNo, i, w, m, chan);
                     
                     //accept[unit] = false;
@@ -968,7 +1228,7 @@ void UnpackVF48::UnpackEvent(int unit, int group, const uint32_t data[], int wco
 
                     if (m)
                        m->error = 1;
-                    fBadDataCount++;
+                    badDataCount++;
                     printf("*** Unit %d, group %d, trigger %d: Unexpected charge data at %5d: 0x%08x (no module %p or bad channel number %d)\n", unit, group, headerTrigNo, i, w, m, chan);
                     
                     //accept[unit] = false;
@@ -998,7 +1258,7 @@ void UnpackVF48::UnpackEvent(int unit, int group, const uint32_t data[], int wco
 
                     if (m)
                        m->error = 1;
-                    fBadDataCount++;
+                    badDataCount++;
                     printf("*** Unit %d, group %d, trigger %d: Unexpected event trailer at %5d: 0x%08x (no module %p or bad channel number %d)\n", unit, group, headerTrigNo, i, w, m, chan);
 
                     //DumpWords(data, wcount);
@@ -1024,11 +1284,15 @@ void UnpackVF48::UnpackEvent(int unit, int group, const uint32_t data[], int wco
               if (trigNo != (uint32_t)headerTrigNo)
                  {
                     printf("*** Unit %d, group %d, trigger %d: event trailer trigger mismatch: see %d, should be %d\n", unit, group, headerTrigNo, trigNo, m->trigger);
-                    fBadDataCount++;
+                    badDataCount++;
                     m->error = 1;
                  }
 
-              if (m->completeGroupMask == fGroupEnabled[unit]) {
+              if (wout[unit]) {
+                 // parallel unpacking, module is completed by MergeFragment()
+                 wout[unit]->back().trailer = true;
+                 m = NULL;
+              } else if (m->completeGroupMask == fGroupEnabled[unit]) {
                  CompleteModule(m);
 		 m = NULL;
               }
@@ -1037,6 +1301,11 @@ void UnpackVF48::UnpackEvent(int unit, int group, const uint32_t data[], int wco
         }
     }
   
+  if (wout[unit])
+     wbad[unit] += badDataCount;
+  else
+     fBadDataCount += badDataCount;
+
   if (doexit)
      exit(123);
 }
@@ -1060,16 +1329,30 @@ int UnpackVF48::NewGroup(int unit)
 
 void UnpackVF48::UnpackStream(int unit, const void* data, int size)
 {
-  int       size32 = size;
-  const uint32_t *data32 = (const uint32_t*)data;
-
   //printf("UnpackVF48: unit %d, size %d\n", unit, size);
 
-  bool doDump = false;
-
   assert(unit>=0);
   assert(unit<VF48_MAX_MODULES);
 
+  if (fNumThreads > 0) {
+    // parallel unpacking: keep a copy of the data,
+    // unpacking is done by RunJobs() from GetEvent()
+    if (fNumJobs >= fJobs.size())
+      fJobs.push_back(new VF48job);
+    VF48job* j = fJobs[fNumJobs++];
+    j->unit = unit;
+    j->data.assign((const uint32_t*)data, (const uint32_t*)data + size);
+    j->fragments.clear();
+    return;
+  }
+
+  DemuxStream(unit, (const uint32_t*)data, size);
+}
+
+void UnpackVF48::DemuxStream(int unit, const uint32_t* data32, int size32)
+{
+  bool doDump = false;
+
   int grp = NewGroup(unit);
 
   for (int i=0; i<size32; i++)
@@ -1158,5 +1441,142 @@ void UnpackVF48::UnpackStream(int unit, const void* data, int size)
   }
 }
 
-// end
+void UnpackVF48::SetNumThreads(int num_threads)
+{
+  if (num_threads < 0)
+    num_threads = 0;
+
+  if (num_threads == fNumThreads)
+    return;
+
+  // unpack whatever was queued with the old settings
+  if (fNumJobs > 0)
+    RunJobs();
+
+  StopWorkers();
+
+  fNumThreads = num_threads;
+
+  if (fNumThreads > 0)
+    StartWorkers(fNumThreads);
+}
+
+void UnpackVF48::StartWorkers(int num_threads)
+{
+  assert(fWorkers == NULL);
+  fWorkers = new VF48workers;
+  for (int i=0; i<num_threads; i++)
+    fWorkers->threads.push_back(std::thread(WorkerThread, this));
+}
+
+void UnpackVF48::StopWorkers()
+{
+  if (!fWorkers)
+    return;
+
+  {
+    std::lock_guard<std::mutex> lock(fWorkers->mutex);
+    fWorkers->shutdown = true;
+  }
+  fWorkers->start.notify_all();
+
+  for (unsigned i=0; i<fWorkers->threads.size(); i++)
+    fWorkers->threads[i].join();
+
+  delete fWorkers;
+  fWorkers = NULL;
+}
+
+void UnpackVF48::WorkerThread(UnpackVF48* u)
+{
+  VF48workers* w = u->fWorkers;
+  int generation = 0;
+
+  while (1) {
+    {
+      std::unique_lock<std::mutex> lock(w->mutex);
+      while (!w->shutdown && w->generation == generation)
+        w->start.wait(lock);
+      if (w->shutdown)
+        return;
+      generation = w->generation;
+    }
+
+    while (1) {
+      int i = w->next++;
+      if (i >= (int)w->units.size())
+        break;
+      u->UnpackJobs(w->units[i]);
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(w->mutex);
+      w->running--;
+      if (w->running == 0)
+        w->done.notify_all();
+    }
+  }
+}
 
+void UnpackVF48::UnpackJobs(int unit)
+{
+  // runs in a worker thread, all jobs for
+  // one unit are unpacked by the same thread, in order.
+
+  for (unsigned i=0; i<fNumJobs; i++) {
+    VF48job* j = fJobs[i];
+    if (j->unit != unit)
+      continue;
+    wout[unit] = &j->fragments;
+    DemuxStream(unit, j->data.data(), j->data.size());
+    wout[unit] = NULL;
+  }
+}
+
+void UnpackVF48::RunJobs()
+{
+  assert(fWorkers);
+
+  VF48workers* w = fWorkers;
+
+  uint32_t units = 0;
+  w->units.clear();
+  for (unsigned i=0; i<fNumJobs; i++) {
+    int unit = fJobs[i]->unit;
+    if (!(units & (1<<unit))) {
+      units |= (1<<unit);
+      w->units.push_back(unit);
+    }
+  }
+
+  // parse the data streams in the worker threads
+
+  {
+    std::unique_lock<std::mutex> lock(w->mutex);
+    w->next = 0;
+    w->running = w->threads.size();
+    w->generation++;
+    w->start.notify_all();
+    while (w->running > 0)
+      w->done.wait(lock);
+  }
+
+  // merge the fragments into events in the same
+  // order as the serial unpacker would have done it
+
+  for (unsigned i=0; i<fNumJobs; i++) {
+    VF48job* j = fJobs[i];
+    for (unsigned k=0; k<j->fragments.size(); k++)
+      MergeFragment(j->unit, j->fragments[k]);
+    j->fragments.clear();
+  }
+
+  for (int i=0; i<VF48_MAX_MODULES; i++) {
+    fBadDataCount += wbad[i];
+    wbad[i] = 0;
+  }
+
+  fNumJobs = 0;
+}
+
+// end
@@ -5,6 +5,8 @@
 
 #include <stdint.h>
 #include <deque>
+#include <vector>
+#include <map>
 
 #define VF48_MAX_MODULES   22
 #define VF48_MAX_GROUPS     6
@@ -18,7 +20,10 @@ struct VF48channel
   uint32_t charge;
   bool     complete;
   int numSamples;
-  uint16_t samples[VF48_MAX_SAMPLES];
+  uint16_t* samples;  // sample storage, allocated on demand
+  int maxSamples;     // allocated size of samples[]
+
+  void AllocSamples(int num_samples); // make room for at least num_samples samples
 };
 
 struct VF48module
@@ -41,8 +46,15 @@ struct VF48module
   VF48channel channels[VF48_MAX_CHANNELS];
 
   VF48module(int i); // ctor  
+  ~VF48module(); // dtor
+
+  void Reset(int i); // reset for reuse, keeps the sample storage
 
   void PrintModule() const;
+
+ private:
+  VF48module(const VF48module&); // not copyable, owns the sample storage
+  VF48module& operator=(const VF48module&);
 };
 
 struct VF48event
@@ -58,10 +70,25 @@ struct VF48event
 
   ~VF48event(); // dtor
 
+  void Reset(int eventNo); // reset for reuse, modules must be removed first
+
   void PrintSummary() const;
   void PrintEvent() const;
 };
 
+struct VF48fragment
+{
+  int         group;     // group that created the fragment
+  double      timestamp; // timestamp used to find the module in the event buffer
+  VF48module* module;    // data from this fragment only
+  bool        trailer;   // event trailer was seen
+
+  VF48fragment(int g, double ts, VF48module* m) : group(g), timestamp(ts), module(m), trailer(false) {} // ctor
+};
+
+struct VF48job;
+struct VF48workers;
+
 class UnpackVF48
 {
  public:
@@ -72,6 +99,7 @@ class UnpackVF48
 
   void UnpackStream(int module, const void* data_ptr, int data_size);
   VF48event* GetEvent(bool flush=false);
+  void ReleaseEvent(VF48event* e); // return event from GetEvent() to the pool, instead of "delete e"
 
   void SetNumModules(int num_modules);
   void SetModulesMask(uint32_t mask);
@@ -80,6 +108,8 @@ class UnpackVF48
 
   void SetDisasm(bool stream, bool structure, bool samples);
 
+  void SetNumThreads(int num_threads); // unpack modules in parallel, 0 is serial unpacking
+
   void SetCoincTime(double time_sec);
   void SetTimestampResync(bool enable);
   void SetTsFreq(int module, double ts_freq_hz);
@@ -88,6 +118,10 @@ class UnpackVF48
 
   double GetTsFreq(int module);
 
+  // pending event for a fragment of this module, a new event if none, public for libUnpack/tests/test_vf48index
+  VF48event*  FindEvent(int unit, double timestamp, bool dup = false);
+  void PopEvent(); // remove the oldest pending event from fBuffer and fBufferIndex
+
  public:
   int      fNumModules;
   uint32_t fModulesMask;
@@ -104,12 +138,21 @@ class UnpackVF48
 
   bool fTimestampResyncEnable;
 
+  int  fNumThreads;
+
   int  fEventNo;
   int  fBadDataCount;
 
   // buffer of pending events
   std::deque<VF48event*> fBuffer;
 
+  // pending events indexed by timestamp, for FindEvent()
+  std::multimap<double,VF48event*> fBufferIndex;
+
+  // pool of free events and modules for reuse
+  std::vector<VF48event*>  fEventPool;
+  std::vector<VF48module*> fModulePool;
+
   // buffer of stream data
   int       wgrp[VF48_MAX_MODULES];
   int       wmax[VF48_MAX_MODULES][VF48_MAX_GROUPS];
@@ -117,14 +160,35 @@ class UnpackVF48
   uint32_t *wbuf[VF48_MAX_MODULES][VF48_MAX_GROUPS];
   bool      wacc[VF48_MAX_MODULES][VF48_MAX_GROUPS];
   int       wdiscarded[VF48_MAX_MODULES];
+  int       wxi[VF48_MAX_MODULES]; // last out of sequence adc samples word
+  int       wxc[VF48_MAX_MODULES]; // out of sequence adc samples not printed
 
   // timestamps
   uint64_t  ts_first[VF48_MAX_MODULES][VF48_MAX_GROUPS];
   uint64_t  ts_last[VF48_MAX_MODULES][VF48_MAX_GROUPS];
 
+  // parallel unpacking
+  std::vector<VF48fragment>* wout[VF48_MAX_MODULES]; // output of the worker thread
+  int          wbad[VF48_MAX_MODULES]; // bad data count from the worker thread
+  std::vector<VF48job*> fJobs; // pending UnpackStream() calls, reused
+  unsigned     fNumJobs;
+  VF48workers* fWorkers;
+
  private:
+  void DemuxStream(int unit, const uint32_t* data32, int size32);
+  VF48module* NewFragment(int unit, int group, double timestamp);
+  void MergeFragment(int unit, const VF48fragment& f);
+  void UnpackJobs(int unit);
+  void RunJobs();
+  void StartWorkers(int num_threads);
+  void StopWorkers();
+  static void WorkerThread(UnpackVF48* u);
+
   void UnpackEvent(int module, int group, const uint32_t* data, int wcount);
-  VF48event*  FindEvent(int unit, double timestamp, bool dup = false);
+  VF48event*  NewEvent(int eventNo);
+  VF48module* NewModule(int unit);
+  void ReleaseModule(VF48module* m);
+  void DeletePool();
   VF48module* FindModule(int unit, int group, double timestamp);
   void AddToEvent(VF48module* m);
   void CompleteModule(VF48module* m);
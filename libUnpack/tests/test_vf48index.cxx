@@ -0,0 +1,189 @@
+//
+// test_vf48index.cxx --- benchmark and check of the UnpackVF48 pending event index
+//
+// Runs UnpackVF48::FindEvent() over 1M module fragments arriving out of
+// order, and checks that each fragment goes to the same event as with a
+// linear scan of the pending events (the old FindEvent()).
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#include "UnpackVF48A.h"
+
+static double GetTimeSec()
+{
+   struct timeval tv;
+   gettimeofday(&tv, NULL);
+   return tv.tv_sec + 0.000001*tv.tv_usec;
+}
+
+static int gCountFail = 0;
+
+static void report_fail(const char* text)
+{
+   printf("FAIL: %s\n", text);
+   gCountFail++;
+}
+
+struct Fragment
+{
+   int    pos;  // arrival order
+   int    unit;
+   double timestamp;
+};
+
+static bool ByArrival(const Fragment& a, const Fragment& b)
+{
+   return a.pos < b.pos;
+}
+
+struct RefEvent
+{
+   int      eventNo;
+   double   timestamp;
+   uint32_t mask;
+};
+
+// the event of each fragment with a linear scan of the pending events
+static void LinearScan(const std::vector<Fragment>& frags, int num_modules, double coinc, std::vector<int>& events, int* max_depth)
+{
+   uint32_t full = (1<<num_modules) - 1;
+   std::deque<RefEvent> buffer;
+   int eventNo = 0;
+
+   for (unsigned i=0; i<frags.size(); i++) {
+      const Fragment& f = frags[i];
+      RefEvent* e = NULL;
+      for (unsigned j=0; j<buffer.size(); j++)
+         if (fabs(buffer[j].timestamp - f.timestamp) < coinc && !(buffer[j].mask & (1<<f.unit))) {
+            e = &buffer[j];
+            break;
+         }
+
+      if (!e) {
+         RefEvent n;
+         n.eventNo = ++eventNo;
+         n.timestamp = f.timestamp;
+         n.mask = 0;
+         buffer.push_back(n);
+         e = &buffer.back();
+      }
+
+      e->mask |= 1<<f.unit;
+      events[i] = e->eventNo;
+
+      if ((int)buffer.size() > *max_depth)
+         *max_depth = buffer.size();
+
+      while (!buffer.empty() && buffer.front().mask == full)
+         buffer.pop_front();
+   }
+}
+
+// the same with UnpackVF48::FindEvent()
+static void Indexed(const std::vector<Fragment>& frags, int num_modules, double coinc, std::vector<int>& events)
+{
+   UnpackVF48 u;
+   u.SetNumModules(num_modules);
+   u.SetCoincTime(coinc);
+
+   // FindEvent() only looks whether a module is there
+   std::vector<VF48module*> dummy;
+   for (int i=0; i<num_modules; i++)
+      dummy.push_back(new VF48module(i));
+
+   uint32_t full = (1<<num_modules) - 1;
+
+   for (unsigned i=0; i<frags.size(); i++) {
+      const Fragment& f = frags[i];
+      VF48event* e = u.FindEvent(f.unit, f.timestamp);
+      e->modules[f.unit] = dummy[f.unit];
+      e->modulesMask |= 1<<f.unit;
+      events[i] = e->eventNo;
+
+      while (!u.fBuffer.empty() && u.fBuffer.front()->modulesMask == full) {
+         VF48event* x = u.fBuffer.front();
+         u.PopEvent();
+         for (int j=0; j<num_modules; j++)
+            x->modules[j] = NULL;
+         u.ReleaseEvent(x);
+      }
+   }
+
+   for (unsigned i=0; i<u.fBuffer.size(); i++)
+      for (int j=0; j<num_modules; j++)
+         u.fBuffer[i]->modules[j] = NULL;
+
+   for (int i=0; i<num_modules; i++)
+      delete dummy[i];
+}
+
+int main(int argc, char* argv[])
+{
+   int num_fragments = 1000000;
+   if (argc > 1)
+      num_fragments = atoi(argv[1]);
+
+   const int    num_modules = 8;
+   const double coinc       = 0.000100; // sec, the UnpackVF48 default
+   const double period      = 0.001;    // sec between triggers
+   const double jitter      = 0.000020; // sec, timestamp differences between modules
+   const int    max_delay   = 100;      // triggers a fragment can arrive late by
+
+   int num_events = num_fragments/num_modules;
+
+   srand(1);
+
+   std::vector<Fragment> frags;
+   for (int k=0; k<num_events; k++)
+      for (int m=0; m<num_modules; m++) {
+         Fragment f;
+         f.pos = (k + rand()%max_delay)*num_modules + m;
+         f.unit = m;
+         f.timestamp = k*period + jitter*(2.0*rand()/RAND_MAX - 1.0);
+         frags.push_back(f);
+      }
+
+   std::stable_sort(frags.begin(), frags.end(), ByArrival);
+
+   std::vector<int> indexed(frags.size());
+   std::vector<int> linear(frags.size());
+   int max_depth = 0;
+
+   double t0 = GetTimeSec();
+   Indexed(frags, num_modules, coinc, indexed);
+   double t1 = GetTimeSec();
+   LinearScan(frags, num_modules, coinc, linear, &max_depth);
+   double t2 = GetTimeSec();
+
+   printf("%d fragments of %d modules, up to %d pending events\n", (int)frags.size(), num_modules, max_depth);
+   printf("indexed FindEvent: %.3f sec, %.2f M fragments/sec\n", t1 - t0, frags.size()/(t1 - t0)/1e6);
+   printf("linear scan:       %.3f sec, %.2f M fragments/sec\n", t2 - t1, frags.size()/(t2 - t1)/1e6);
+
+   int mismatch = 0;
+   for (unsigned i=0; i<frags.size(); i++)
+      if (indexed[i] != linear[i]) {
+         if (mismatch < 10)
+            printf("fragment %d unit %d timestamp %.6f: indexed event %d, linear scan event %d\n", i, frags[i].unit, frags[i].timestamp, indexed[i], linear[i]);
+         mismatch++;
+      }
+
+   if (mismatch > 0)
+      report_fail("indexed FindEvent() does not match the linear scan");
+
+   if (gCountFail) {
+      printf("test_vf48index: %d failures\n", gCountFail);
+      return 1;
+   }
+
+   printf("test_vf48index: PASS\n");
+   return 0;
+}
+
+// end
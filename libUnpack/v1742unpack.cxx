@@ -7,22 +7,75 @@
 #define MEMZERO(array) memset((array), 0, sizeof(array))
 
 v1742event::v1742event() // ctor
+{
+   Reset();
+}
+
+void v1742event::Reset()
 {
    error = false;
    //event_count = 0;
    //geo = 0;
+   total_event_size = 0;
+   board_id = 0;
+   pattern = 0;
+   group_mask = 0;
+   event_counter = 0;
+   event_time_tag = 0;
+   MEMZERO(len);
+   MEMZERO(tr);
+   MEMZERO(freq);
+   MEMZERO(cell);
+   MEMZERO(trigger_time_tag);
+   MEMZERO(nsamples);
    MEMZERO(adc);
    MEMZERO(adc_tr);
    MEMZERO(adc_overflow);
    MEMZERO(adc_tr_overflow);
 }
 
+// unpack 12-bit samples packed 2 per 3 bytes, "nchan" channels interleaved
+
+static void Unpack12(const uint8_t* p, int nsamples, int nchan, int16_t* const out[], bool overflow[])
+{
+   for (int a=0; a<nchan; a+=2) {
+      int16_t* out0 = out[a];
+      int16_t* out1 = out[a+1];
+      const uint8_t* q = p + (a/2)*3;
+      int stride = nchan/2*3;
+      int zero0 = 0;
+      int zero1 = 0;
+      for (int s=0; s<nsamples; s++) {
+         int b0 = q[s*stride+0];
+         int b1 = q[s*stride+1];
+         int b2 = q[s*stride+2];
+         int v0 = b0 | ((b1&0xF)<<8);
+         int v1 = ((b1&0xF0)>>4) | (b2<<4);
+         out0[s] = v0;
+         out1[s] = v1;
+         zero0 |= (v0 == 0);
+         zero1 |= (v1 == 0);
+      }
+      if (zero0)
+         overflow[a] = true;
+      if (zero1)
+         overflow[a+1] = true;
+   }
+}
+
 v1742event* UnpackV1742(const char** data8, int* datalen, bool verbose)
+{
+   v1742event* e = new v1742event();
+   UnpackV1742(e, data8, datalen, verbose);
+   return e;
+}
+
+void UnpackV1742(v1742event* e, const char** data8, int* datalen, bool verbose)
 {
    const uint32_t *data = (const uint32_t*)(*data8);
    //int count = (*datalen)/4;
 
-   v1742event* e = new v1742event();
+   e->Reset();
 
    if (verbose) {
       printf("Header:\n");
@@ -57,71 +110,59 @@ v1742event* UnpackV1742(const char** data8, int* datalen, bool verbose)
       e->freq[i] = (g[0]>>16)&3;
       e->cell[i] = (g[0]>>20)&0x3ff;
 
+      // 8 channels of 12-bit samples in len 32-bit words
+      int ns = e->len[i]/3;
+      if (ns > 1024)
+         ns = 1024;
+      e->nsamples[i] = ns;
+
+      // short or truncated group: no samples, skip to the next group
+      if (ns <= 0) {
+         e->nsamples[i] = 0;
+         g += 1 + e->len[i] + (e->tr[i] ? e->len[i]/8 : 0);
+         e->trigger_time_tag[i] = g[0];
+         g += 1;
+         continue;
+      }
+
+      // storage is only reallocated if it grows
+      std::vector<int16_t>& gd = e->group_data[i];
+      gd.resize(8*ns + (e->tr[i] ? ns : 0));
+
+      for (int a=0; a<8; a++)
+         e->adc[i*8+a] = gd.data() + a*ns;
+
       g += 1;
       // g points to the data
       
       //for (int k=0; k<10; k++)
       //	printf("  adc data[k]: 0x%08x\n", g[k]);
       
-      int k=0;
-      
-      const uint8_t* p = (const uint8_t*)g;
-      int x = 0;
-      for (int s=0; s<1024; s++)
-         for (int a=0; a<8; a++) {
-            int v = 0;
-            if (x==0) {
-               v = (p[0]) | ((p[1]&0xF)<<8);
-               p += 1;
-               x = 1;
-            } else {
-               v = ((p[0]&0xF0)>>4) | ((p[1]&0xFF)<<4);
-               p += 2;
-               x = 0;
-            }
-            
-            //printf("group %d, channel %d, sample %d: value %6d (0x%03x)\n", i, a, s, v, v);
-            
-            e->adc[i*8+a][s] = v;
-            
-            if (v == 0)
-               e->adc_overflow[i*8+a] = true;
-            
-            k++;
-            //if (k > 10)
-            //abort();
-         }
+      Unpack12((const uint8_t*)g, ns, 8, e->adc + i*8, e->adc_overflow + i*8);
       
       g += e->len[i];
       
       if (e->tr[i]) {
          int trlen = e->len[i]/8;
-         
+
+         int16_t* out = gd.data() + 8*ns;
          const uint8_t* p = (const uint8_t*)g;
-         int x = 0;
-         for (int s=0; s<1024; s++) {
-            int v = 0;
-            if (x==0) {
-               v = (p[0]) | ((p[1]&0xF)<<8);
-               p += 1;
-               x = 1;
-            } else {
-               v = ((p[0]&0xF0)>>4) | ((p[1]&0xFF)<<4);
-               p += 2;
-               x = 0;
-            }
-	    
-            //printf("group %d, channel %d, sample %d: value %6d (0x%03x)\n", i, a, s, v, v);
-	    
-            e->adc_tr[i][s] = v;
-            
-            if (v == 0)
-               e->adc_tr_overflow[i] = true;
-	    
-            k++;
-            //if (k > 10)
-            //abort();
+         int zero = 0;
+         for (int s=0; s<ns; s+=2) {
+            int v0 = p[0] | ((p[1]&0xF)<<8);
+            int v1 = ((p[1]&0xF0)>>4) | (p[2]<<4);
+            out[s] = v0;
+            if (s+1 < ns)
+               out[s+1] = v1;
+            else
+               v1 = v0;
+            zero |= (v0 == 0) | (v1 == 0);
+            p += 3;
          }
+
+         e->adc_tr[i] = out;
+         if (zero)
+            e->adc_tr_overflow[i] = true;
          
          g += trlen;
       }
@@ -153,8 +194,6 @@ v1742event* UnpackV1742(const char** data8, int* datalen, bool verbose)
             printf("v1190unpack: unexpected data word 0x%08x\n", data[i]);
    }
 #endif
-
-   return e;
 }
 
 void v1742event::Print() const
@@ -1,5 +1,8 @@
 // v1742unpack.h
 
+#include <stdint.h>
+#include <vector>
+
 class v1742event
 {
  public:
@@ -18,17 +21,29 @@ class v1742event
   int cell[4]; // 10 bits, start cell index of DRS4 SCA
   int trigger_time_tag[4]; // maybe 30 bits
 
-  int adc[32][1024];
-  int adc_tr[4][1024];
+  int nsamples[4]; // number of samples in each group, len/3, 1024 for len 0xC00
+
+  int16_t* adc[32];   // adc[chan][sample], NULL if group is not present
+  int16_t* adc_tr[4]; // adc_tr[group][sample], NULL if group has no TR data
   
   bool adc_overflow[32];
   bool adc_tr_overflow[4];
 
  public:
   v1742event(); // ctor
+  void Reset(); // reset for reuse, keeps the sample storage
   void Print() const;
+
+ private:
+  std::vector<int16_t> group_data[4]; // sample storage for each group
+
+  v1742event(const v1742event&); // not copyable, adc[] points into group_data[]
+  v1742event& operator=(const v1742event&);
+
+  friend void UnpackV1742(v1742event* e, const char** data, int* datalen, bool verbose);
 };
 
 v1742event* UnpackV1742(const char** data, int* datalen, bool verbose);
+void UnpackV1742(v1742event* e, const char** data, int* datalen, bool verbose); // unpack into existing event
 
 // end
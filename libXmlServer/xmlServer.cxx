@@ -47,6 +47,22 @@
 #include <deque>
 #include <map>
 #include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
 
 class XLockRootGuard
 {
@@ -311,32 +327,264 @@ static void ResetObject(TObject* obj)
 
 /*------------------------------------------------------------------*/
 
-static void SendString(TSocket* sock, const char* str)
+struct XHttpRequest
+{
+   TSocket* fSock;
+   std::string fMethod;
+   std::string fUri;     // without the "?query" part
+   std::string fVersion;
+   std::map<std::string,std::string> fHeaders; // names in lower case
+   bool fKeepAlive;
+   bool fAcceptGzip;
+
+   const char* Header(const char* name) const
+   {
+      std::map<std::string,std::string>::const_iterator it = fHeaders.find(name);
+      if (it == fHeaders.end())
+         return NULL;
+      return it->second.c_str();
+   }
+};
+
+struct XConnection
+{
+   TSocket* fSock;
+   std::string fBuffer; // received bytes not yet parsed, may hold pipelined requests
+   time_t fLastActive;
+};
+
+static const int kMaxHeaderSize = 64*1024;
+static const int kMinGzipSize = 1024; // do not compress small replies
+
+/*------------------------------------------------------------------*/
+
+static int ParseRequest(XConnection* c, XHttpRequest* req)
+/*
+  Extract one complete request from the connection buffer.
+  Returns 1 if a request was parsed, 0 if more data is needed, -1 on error.
+*/
+{
+   std::string& buf = c->fBuffer;
+
+   size_t end = buf.find("\r\n\r\n");
+   size_t sep = 4;
+   if (end == std::string::npos) {
+      end = buf.find("\n\n");
+      sep = 2;
+   }
+
+   if (end == std::string::npos) {
+      if (buf.size() > (size_t)kMaxHeaderSize)
+         return -1;
+      return 0;
+   }
+
+   req->fSock = c->fSock;
+   req->fMethod = "";
+   req->fUri = "";
+   req->fVersion = "";
+   req->fHeaders.clear();
+
+   size_t pos = 0;
+   bool first = true;
+   while (pos < end) {
+      size_t eol = buf.find('\n', pos);
+      if (eol == std::string::npos || eol > end)
+         eol = end;
+      std::string line = buf.substr(pos, eol - pos);
+      pos = eol + 1;
+
+      if (!line.empty() && line[line.size()-1] == '\r')
+         line.resize(line.size()-1);
+
+      if (first) {
+         first = false;
+         size_t s1 = line.find(' ');
+         size_t s2 = line.rfind(' ');
+         if (s1 == std::string::npos || s2 == s1)
+            return -1;
+         req->fMethod = line.substr(0, s1);
+         req->fUri = line.substr(s1+1, s2-s1-1);
+         req->fVersion = line.substr(s2+1);
+         continue;
+      }
+
+      size_t colon = line.find(':');
+      if (colon == std::string::npos)
+         continue;
+
+      std::string name = line.substr(0, colon);
+      for (unsigned i=0; i<name.size(); i++)
+         name[i] = tolower(name[i]);
+
+      size_t v = colon + 1;
+      while (v < line.size() && line[v] == ' ')
+         v++;
+
+      req->fHeaders[name] = line.substr(v);
+   }
+
+   if (first)
+      return -1;
+
+   // skip the request body, we do not use it
+
+   size_t total = end + sep;
+   const char* clen = req->Header("content-length");
+   if (clen)
+      total += strtoul(clen, NULL, 0);
+
+   if (buf.size() < total)
+      return 0;
+
+   buf.erase(0, total);
+
+   size_t q = req->fUri.find('?');
+   if (q != std::string::npos)
+      req->fUri.resize(q);
+
+   const char* conn = req->Header("connection");
+   if (req->fVersion == "HTTP/1.0")
+      req->fKeepAlive = conn && strcasecmp(conn, "keep-alive") == 0;
+   else
+      req->fKeepAlive = !(conn && strcasecmp(conn, "close") == 0);
+
+   const char* enc = req->Header("accept-encoding");
+   req->fAcceptGzip = enc && strstr(enc, "gzip");
+
+   return 1;
+}
+
+/*------------------------------------------------------------------*/
+
+static std::string MakeEtag(const std::string& data)
+{
+   // FNV-1a hash of the reply contents
+   unsigned long long h = 14695981039346656037ULL;
+   for (size_t i=0; i<data.size(); i++) {
+      h ^= (unsigned char)data[i];
+      h *= 1099511628211ULL;
+   }
+   char buf[64];
+   sprintf(buf, "\"%016llx-%x\"", h, (unsigned)data.size());
+   return buf;
+}
+
+static bool Gzip(const std::string& in, std::string* out, int level)
+{
+#ifdef HAVE_LIBZ
+   z_stream zs;
+   memset(&zs, 0, sizeof(zs));
+
+   // windowBits 15+16 selects the gzip wrapper
+   if (deflateInit2(&zs, level, Z_DEFLATED, 15+16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+      return false;
+
+   out->resize(deflateBound(&zs, in.size()) + 32);
+
+   zs.next_in = (Bytef*)in.data();
+   zs.avail_in = in.size();
+   zs.next_out = (Bytef*)&(*out)[0];
+   zs.avail_out = out->size();
+
+   int status = deflate(&zs, Z_FINISH);
+   deflateEnd(&zs);
+
+   if (status != Z_STREAM_END)
+      return false;
+
+   out->resize(zs.total_out);
+   return out->size() < in.size();
+#else
+   return false;
+#endif
+}
+
+static const char* StatusText(int status)
 {
-   sock->SendRaw(str, strlen(str));
+   switch (status) {
+   case 200: return "OK";
+   case 304: return "Not Modified";
+   case 400: return "Bad Request";
+   case 404: return "Not Found";
+   case 501: return "Not Implemented";
+   default: return "Unknown";
+   }
 }
 
-static void SendHttpReply(TSocket* sock, const char* mimetype, const char* message)
+static void SendHttpReply(XHttpRequest* req, int status, const char* mimetype, const std::string& body, const std::string& etag, const std::string* gzbody)
+/*
+  Send status line, headers and body with a single write.
+  gzbody, if not NULL, is the gzip-compressed body.
+*/
 {
+   if (req->Header("if-none-match") && etag == req->Header("if-none-match"))
+      status = 304;
+
+   const std::string* content = &body;
+   if (status == 304)
+      content = NULL;
+   else if (gzbody)
+      content = gzbody;
+
    char buf[256];
-   int len = strlen(message);
-   SendString(sock, "HTTP/1.1 200 OK\n");
-   //SendString(sock, "Date: Tue, 15 May 2012 16:50:31 GMT\n");
-   SendString(sock, "Server: ROOTANA xmlServer\n");
-   sprintf(buf, "Content-Length: %d\n", len);
-   SendString(sock, buf);
-   //Connection: close\n
-   sprintf(buf, "Content-Type: %s\n", mimetype);
-   SendString(sock, buf);
-   //charset=iso-8859-1\n
-   SendString(sock, "\n");
-   SendString(sock, message);
-   printf("XmlServer: Reply content-length %d, content-type %s\n", len, mimetype);
+   std::string reply;
+   reply.reserve(256 + (content ? content->size() : 0));
+
+   sprintf(buf, "HTTP/1.1 %d %s\r\n", status, StatusText(status));
+   reply += buf;
+   reply += "Server: ROOTANA xmlServer\r\n";
+   if (!etag.empty()) {
+      reply += "ETag: ";
+      reply += etag;
+      reply += "\r\n";
+   }
+   if (req->fKeepAlive)
+      reply += "Connection: keep-alive\r\n";
+   else
+      reply += "Connection: close\r\n";
+   if (status != 304) {
+      sprintf(buf, "Content-Length: %d\r\n", (int)content->size());
+      reply += buf;
+      sprintf(buf, "Content-Type: %s\r\n", mimetype);
+      reply += buf;
+      if (gzbody)
+         reply += "Content-Encoding: gzip\r\n";
+      reply += "Vary: Accept-Encoding\r\n";
+   }
+   reply += "\r\n";
+   if (content)
+      reply += *content;
+
+   req->fSock->SendRaw(reply.data(), reply.size());
+
+   if (gVerbose)
+      printf("XmlServer: Reply status %d, content-length %d, content-type %s%s\n", status, content ? (int)content->size() : 0, mimetype, gzbody ? ", gzip" : "");
 }
 
-static void SendHttpReply(TSocket* sock, const char* mimetype, const std::string& str)
+static void SendHttpReply(XHttpRequest* req, const char* mimetype, const std::string& str)
 {
-   SendHttpReply(sock, mimetype, str.c_str());
+   std::string etag = MakeEtag(str);
+
+   std::string gz;
+   bool gzip = false;
+   if (req->fAcceptGzip && str.size() >= (size_t)kMinGzipSize)
+      if (!(req->Header("if-none-match") && etag == req->Header("if-none-match")))
+         gzip = Gzip(str, &gz, 1); // fast, these replies change all the time
+
+   SendHttpReply(req, 200, mimetype, str, etag, gzip ? &gz : NULL);
+}
+
+static void SendHttpError(XHttpRequest* req, int status, const char* text)
+{
+   std::string reply;
+   reply += "<!DOCTYPE HTML PUBLIC \"-//IETF//DTD HTML 2.0//EN\">\n<html><head>\n";
+   reply += "<title>" + std::string(StatusText(status)) + "</title>\n";
+   reply += "</head><body>\n";
+   reply += "<h1>" + std::string(StatusText(status)) + "</h1>\n";
+   reply += "<p>" + HtmlEncode(text) + "</p>\n";
+   reply += "</body></html>\n";
+   SendHttpReply(req, status, "text/html", reply, "", NULL);
 }
 
 /*------------------------------------------------------------------*/
@@ -441,538 +689,722 @@ std::string MakeHtmlEntry(const TObject* obj, const char* path)
    
 /*------------------------------------------------------------------*/
 
-static void SendFile(TSocket* sock, const char* filename, const char* mimetype)
+// Static files are read once and kept in memory together with their
+// gzip-compressed version, they are re-read if the file on disk changes.
+
+struct XStaticFile
+{
+   std::string fPath;
+   time_t      fMtime;
+   std::string fData;
+   std::string fGzData; // empty if compression does not help
+   std::string fEtag;
+};
+
+static std::mutex gFilesMutex;
+static std::map<std::string, std::shared_ptr<const XStaticFile> > gFiles;
+
+static std::shared_ptr<const XStaticFile> LoadFile(const char* filename)
 {
    std::string f = filename;
-   std::string reply;
-   FILE *fp = fopen(f.c_str(), "r");
-   if (!fp) {
+   struct stat st;
+   int status = stat(f.c_str(), &st);
+   if (status != 0 && getenv("HOME")) {
       std::string home = getenv("HOME");
       f = home + "/packages/rootana/libXmlServer/" + filename;
-      fp = fopen(f.c_str(), "r");
-   }
-   printf("sending file %s, fp %p\n", f.c_str(), fp);
-   if (fp) {
-      while (1) {
-         char buf[1024+1];
-         int rd = fread(buf, 1, sizeof(buf)-1, fp);
-         if (rd <= 0)
-            break;
-         buf[rd] = 0;
-         reply += buf;
-      }
-      fclose(fp);
+      status = stat(f.c_str(), &st);
    }
-   SendHttpReply(sock, mimetype, reply);
-}
 
-/*------------------------------------------------------------------*/
+   std::lock_guard<std::mutex> lock(gFilesMutex);
 
-static THREADTYPE xroot_server_thread(void *arg)
-/*
-  Serve histograms over TCP/IP socket link
-*/
-{
-   char request[2560];
+   std::shared_ptr<const XStaticFile>& cached = gFiles[filename];
 
-   TSocket *sock = (TSocket *) arg;
-   //TMessage message(kMESS_OBJECT);
+   if (status != 0) {
+      cached.reset();
+      return cached;
+   }
 
-   do {
+   if (cached && cached->fPath == f && cached->fMtime == st.st_mtime)
+      return cached;
 
-      /* close connection if client has disconnected */
-      int rd = sock->RecvRaw(request, sizeof(request), kDontBlock); // (ESendRecvOptions)-1);
+   FILE *fp = fopen(f.c_str(), "rb");
+   printf("XmlServer: loading file %s, fp %p\n", f.c_str(), fp);
+   if (!fp) {
+      cached.reset();
+      return cached;
+   }
+
+   XStaticFile* xf = new XStaticFile;
+   xf->fPath = f;
+   xf->fMtime = st.st_mtime;
+   while (1) {
+      char buf[16*1024];
+      int rd = fread(buf, 1, sizeof(buf), fp);
       if (rd <= 0)
-        {
-          if (gVerbose)
-            fprintf(stderr, "XmlServer: connection from %s closed\n", sock->GetInetAddress().GetHostName());
-          sock->Close();
-          delete sock;
-          return THREADRETURN;
-        }
+         break;
+      xf->fData.append(buf, rd);
+   }
+   fclose(fp);
 
-      if (1) {
-         char *p;
-         p = strchr(request, '\n');
-         if (p)
-            *p = 0;
-         
-         p = strchr(request, '\r');
-         if (p)
-            *p = 0;
-      }
-         
-      if (gVerbose)
-        printf("XmlServer: Request [%s] from %s\n", request, sock->GetInetAddress().GetHostName());
+   xf->fEtag = MakeEtag(xf->fData);
+   if (!Gzip(xf->fData, &xf->fGzData, 9))
+      xf->fGzData.clear();
 
-      if (0) {} 
-      else if (strstr(request, "GET / "))
-        {
-          // enumerate top level exported directories
+   cached.reset(xf);
+   return cached;
+}
 
-          XLockRootGuard lock;
-          
-          std::string reply;
+static void SendFile(XHttpRequest* req, const char* filename, const char* mimetype)
+{
+   std::shared_ptr<const XStaticFile> f = LoadFile(filename);
 
-          reply += "<!DOCTYPE HTML PUBLIC \"-//IETF//DTD HTML 2.0//EN\">\n<html><head>\n";
-          reply += HtmlTag("title", "Export list") + "\n";
-          reply += "</head><body>\n";
-          reply += HtmlTag("h1", "Export list") + "\n";
+   if (!f) {
+      SendHttpError(req, 404, filename);
+      return;
+   }
 
-          for (unsigned int i=0; i<gExports.size(); i++) {
-             const char* ename = gExports[i].c_str();
-             const char* xname = gExportNames[ename].c_str();
-             
-             TObject* obj = FindTopLevelObject(xname);
-             
-             if (obj) {
-                std::string s;
-                s += " ";
-                s += "<a href=\"";
-                s += UrlEncode(ename);
-                s += "\">";
-                s += ename;
-                s += "</a>\n";
-                s += "<a href=\"";
-                s += UrlEncode(ename);
-                s += ".xml";
-                s += "\">";
-                s += "XML</a>\n";
-                reply += HtmlTag("p", s) + "\n";
-             } else {
-                std::string s;
-                s += ename;
-                s += " (cannot be found. maybe deleted?)\n";
-                reply += HtmlTag("p", s) + "\n";
-             }
-          }
-          
-          lock.Unlock();
+   const std::string* gz = NULL;
+   if (req->fAcceptGzip && !f->fGzData.empty())
+      gz = &f->fGzData;
 
-          reply += "</body></html>\n";
-          SendHttpReply(sock, "text/html", reply);
-        }
-      //else if (strstr(request, "GET /plot.html "))
-      //  {
-      //    SendFile(sock, "plot.html", "text/html");
-      //  }
-      else if (strstr(request, "js/jquery.min.js "))
-        {
-          SendFile(sock, "jquery.min.js", "text/javascript");
-        }
-      else if (strstr(request, "js/highcharts.js "))
-        {
-          SendFile(sock, "highcharts.js", "text/javascript");
-        }
-      else if (strstr(request, "js/exporting.js "))
-        {
-          SendFile(sock, "exporting.js", "text/javascript");
-        }
-      else if (strstr(request, "GET /favicon.ico "))
-        {
-          std::string reply;
+   SendHttpReply(req, 200, mimetype, f->fData, f->fEtag, gz);
+}
 
-          reply += "<!DOCTYPE HTML PUBLIC \"-//IETF//DTD HTML 2.0//EN\">\n<html><head>\n";
-          reply += HtmlTag("title", "No favicon") + "\n";
-          reply += "</head><body>\n";
-          reply += HtmlTag("h1", "No favicon") + "\n";
-          reply += HtmlTag("p", "No favicon") + "\n";
-          reply += "</body></html>\n";
-          SendHttpReply(sock, "text/html", reply);
-        }
-      else if (strstr(request, "GET /index.xml "))
-        {
-          // enumerate top level exported directories
+/*------------------------------------------------------------------*/
 
-          XLockRootGuard lock;
+static void HandleRequest(XHttpRequest* req)
+/*
+  Serve one HTTP request
+*/
+{
+   if (gVerbose)
+      printf("XmlServer: Request [%s %s] from %s\n", req->fMethod.c_str(), req->fUri.c_str(), req->fSock->GetInetAddress().GetHostName());
 
-          std::string xml;
+   if (req->fMethod != "GET") {
+      fprintf(stderr, "XmlServer: Received unsupported request \"%s %s\"\n", req->fMethod.c_str(), req->fUri.c_str());
+      SendHttpError(req, 501, req->fMethod.c_str());
+      return;
+   }
 
-          xml += "<xml>\n";
-          xml += "<dir>\n";
-          
-          for (unsigned int i=0; i<gExports.size(); i++)
-            {
-              const char* ename = gExports[i].c_str();
-              const char* xname = gExportNames[ename].c_str();
+   const char* uri = req->fUri.c_str();
+   int urilen = req->fUri.size();
 
-              TObject* obj = FindTopLevelObject(xname);
+   if (0) {} 
+   else if (strcmp(uri, "/") == 0)
+     {
+       // enumerate top level exported directories
 
-              if (!obj) {
-                 xml += HtmlTag("subdir", HtmlTag("name", HtmlEncode(ename)) + "<deleted/>") + "\n";
-                 continue;
-              }
+       XLockRootGuard lock;
+       
+       std::string reply;
 
-              const char* cname = obj->ClassName();
+       reply += "<!DOCTYPE HTML PUBLIC \"-//IETF//DTD HTML 2.0//EN\">\n<html><head>\n";
+       reply += HtmlTag("title", "Export list") + "\n";
+       reply += "</head><body>\n";
+       reply += HtmlTag("h1", "Export list") + "\n";
 
-              xml += HtmlTag("subdir", HtmlTag("name", HtmlEncode(ename)) + HtmlTag("class", HtmlEncode(cname))) + "\n";
-            }
+       for (unsigned int i=0; i<gExports.size(); i++) {
+          const char* ename = gExports[i].c_str();
+          const char* xname = gExportNames[ename].c_str();
           
-          lock.Unlock();
-
-          xml += "</dir>\n";
-          xml += "</xml>\n";
-
-          SendHttpReply(sock, "application/xml", xml);
-        }
-      else if (strncmp(request, "GET /", 5) == 0)
-        {
-          XLockRootGuard lock;
-
-          char* dirname = request + 5;
-
-          char* x = strstr(dirname, " HTTP");
-          if (x)
-             *x = 0;
-
-          bool xmlOutput = false;
-
-          x = strstr(dirname, ".xml");
-          if (x) {
-             *x = 0;
-             xmlOutput = true;
+          TObject* obj = FindTopLevelObject(xname);
+          
+          if (obj) {
+             std::string s;
+             s += " ";
+             s += "<a href=\"";
+             s += UrlEncode(ename);
+             s += "\">";
+             s += ename;
+             s += "</a>\n";
+             s += "<a href=\"";
+             s += UrlEncode(ename);
+             s += ".xml";
+             s += "\">";
+             s += "XML</a>\n";
+             reply += HtmlTag("p", s) + "\n";
+          } else {
+             std::string s;
+             s += ename;
+             s += " (cannot be found. maybe deleted?)\n";
+             reply += HtmlTag("p", s) + "\n";
           }
+       }
+       
+       lock.Unlock();
+
+       reply += "</body></html>\n";
+       SendHttpReply(req, "text/html", reply);
+     }
+   //else if (strcmp(uri, "/plot.html") == 0)
+   //  {
+   //    SendFile(req, "plot.html", "text/html");
+   //  }
+   else if (urilen >= 16 && strcmp(uri + urilen - 16, "js/jquery.min.js") == 0)
+     {
+       SendFile(req, "jquery.min.js", "text/javascript");
+     }
+   else if (urilen >= 16 && strcmp(uri + urilen - 16, "js/highcharts.js") == 0)
+     {
+       SendFile(req, "highcharts.js", "text/javascript");
+     }
+   else if (urilen >= 15 && strcmp(uri + urilen - 15, "js/exporting.js") == 0)
+     {
+       SendFile(req, "exporting.js", "text/javascript");
+     }
+   else if (strcmp(uri, "/favicon.ico") == 0)
+     {
+       std::string reply;
+
+       reply += "<!DOCTYPE HTML PUBLIC \"-//IETF//DTD HTML 2.0//EN\">\n<html><head>\n";
+       reply += HtmlTag("title", "No favicon") + "\n";
+       reply += "</head><body>\n";
+       reply += HtmlTag("h1", "No favicon") + "\n";
+       reply += HtmlTag("p", "No favicon") + "\n";
+       reply += "</body></html>\n";
+       SendHttpReply(req, "text/html", reply);
+     }
+   else if (strcmp(uri, "/index.xml") == 0)
+     {
+       // enumerate top level exported directories
+
+       XLockRootGuard lock;
+
+       std::string xml;
+
+       xml += "<xml>\n";
+       xml += "<dir>\n";
+       
+       for (unsigned int i=0; i<gExports.size(); i++)
+         {
+           const char* ename = gExports[i].c_str();
+           const char* xname = gExportNames[ename].c_str();
+
+           TObject* obj = FindTopLevelObject(xname);
+
+           if (!obj) {
+              xml += HtmlTag("subdir", HtmlTag("name", HtmlEncode(ename)) + "<deleted/>") + "\n";
+              continue;
+           }
+
+           const char* cname = obj->ClassName();
+
+           xml += HtmlTag("subdir", HtmlTag("name", HtmlEncode(ename)) + HtmlTag("class", HtmlEncode(cname))) + "\n";
+         }
+       
+       lock.Unlock();
+
+       xml += "</dir>\n";
+       xml += "</xml>\n";
+
+       SendHttpReply(req, "application/xml", xml);
+     }
+   else if (uri[0] == '/')
+     {
+       std::vector<char> xuri(uri, uri + urilen + 1);
+       char* dirname = &xuri[1];
+
+       XLockRootGuard lock;
+
+       bool xmlOutput = false;
+
+       char* x = strstr(dirname, ".xml");
+       if (x) {
+          *x = 0;
+          xmlOutput = true;
+       }
+
+       std::string path;
+       path += "/";
+       path += dirname;
+
+       std::string xpath = HtmlDecode(dirname);
 
-          std::string path;
-          path += "/";
-          path += dirname;
+	  //printf("path [%s] dirname [%s] xpath [%s]\n", path.c_str(), dirname, xpath.c_str());
 
-          std::string xpath = HtmlDecode(dirname);
+       TObject* obj = FollowPath(dirname);
 
-	  //printf("path [%s] dirname [%s] xpath [%s]\n", path.c_str(), dirname, xpath.c_str());
+       if (!obj) {
+          std::string reply;
+          std::string buf;
+          
+          reply += "<!DOCTYPE HTML PUBLIC \"-//IETF//DTD HTML 2.0//EN\">\n<html><head>\n";
 
-          TObject* obj = FollowPath(dirname);
+          buf = "Not found ";
+          buf += xpath;
+          reply += HtmlTag("title", buf) + "\n";
+          reply += "</head><body>\n";
+          reply += HtmlTag("h1", buf) + "\n";
+          
+          reply += HtmlTag("p", "Object not found");
 
-          if (!obj) {
-             std::string reply;
-             std::string buf;
-             
-             reply += "<!DOCTYPE HTML PUBLIC \"-//IETF//DTD HTML 2.0//EN\">\n<html><head>\n";
+          reply += "</body></html>\n";
+          SendHttpReply(req, "text/html", reply);
 
-             buf = "Not found ";
-             buf += xpath;
-             reply += HtmlTag("title", buf) + "\n";
-             reply += "</head><body>\n";
-             reply += HtmlTag("h1", buf) + "\n";
-             
-             reply += HtmlTag("p", "Object not found");
+       } else if (obj && obj->InheritsFrom(TDirectory::Class())) {
+          TDirectory* dir = (TDirectory*)obj;
 
-             reply += "</body></html>\n";
-             SendHttpReply(sock, "text/html", reply);
+          std::string reply;
+          std::string buf;
+          std::string xml;
 
-          } else if (obj && obj->InheritsFrom(TDirectory::Class())) {
-             TDirectory* dir = (TDirectory*)obj;
+          xml += "<xml>\n";
+          xml += "<dir>\n";
+          
+          reply += "<!DOCTYPE HTML PUBLIC \"-//IETF//DTD HTML 2.0//EN\">\n<html><head>\n";
 
-             std::string reply;
-             std::string buf;
-             std::string xml;
+          buf = "Dir ";
+          buf += xpath;
+          reply += HtmlTag("title", buf) + "\n";
+          reply += "</head><body>\n";
+          reply += HtmlTag("h1", buf) + "\n";
 
-             xml += "<xml>\n";
-             xml += "<dir>\n";
-             
-             reply += "<!DOCTYPE HTML PUBLIC \"-//IETF//DTD HTML 2.0//EN\">\n<html><head>\n";
+          //printf("Directory %p\n", dir);
+          //dir->Print();
 
-             buf = "Dir ";
-             buf += xpath;
-             reply += HtmlTag("title", buf) + "\n";
-             reply += "</head><body>\n";
-             reply += HtmlTag("h1", buf) + "\n";
+          std::map<std::string, std::string> alist;
 
-             //printf("Directory %p\n", dir);
-             //dir->Print();
+          if (1) {
+             TList* keys = dir->GetListOfKeys();
 
-             std::map<std::string, std::string> alist;
+             //printf("Directory %p keys:\n", dir);
+             //keys->Print();
+          
+             TIter next = keys;
+             while(1) {
+                TObject *obj = next();
+                
+                //printf("object %p\n", obj);
+                
+                if (obj == NULL)
+                   break;
 
-             if (1) {
-                TList* keys = dir->GetListOfKeys();
+                std::string a = HtmlTag("p", MakeHtmlEntry(obj, path.c_str())) + "\n";
+                //alist[objname] = a;
+                reply += a;
+                
+                xml += MakeXmlEntry(obj);
+             }
+          }
 
-                //printf("Directory %p keys:\n", dir);
-                //keys->Print();
+          if (1) {
+             TList* objs = dir->GetList();
+          
+             //printf("Directory %p objects:\n", dir);
+             //objs->Print();
              
-                TIter next = keys;
-                while(1) {
+             TIter next = objs;
+             while(1)
+                {
                    TObject *obj = next();
                    
                    //printf("object %p\n", obj);
                    
                    if (obj == NULL)
                       break;
-
+                   
                    std::string a = HtmlTag("p", MakeHtmlEntry(obj, path.c_str())) + "\n";
                    //alist[objname] = a;
                    reply += a;
-                   
+
                    xml += MakeXmlEntry(obj);
                 }
-             }
-
-             if (1) {
-                TList* objs = dir->GetList();
+          }
              
-                //printf("Directory %p objects:\n", dir);
-                //objs->Print();
-                
-                TIter next = objs;
-                while(1)
-                   {
-                      TObject *obj = next();
-                      
-                      //printf("object %p\n", obj);
-                      
-                      if (obj == NULL)
-                         break;
-                      
-                      std::string a = HtmlTag("p", MakeHtmlEntry(obj, path.c_str())) + "\n";
-                      //alist[objname] = a;
-                      reply += a;
-
-                      xml += MakeXmlEntry(obj);
-                   }
+          lock.Unlock();
+          
+          if (1) {
+             std::map<std::string, std::string>::iterator iter = alist.begin();
+             for (; iter!=alist.end(); iter++) {
+                // iter->first is your key
+                // iter->second is it''s value
+                reply += iter->second;
              }
+          }
+           
+          reply += "</body></html>\n";
+
+          xml += "</dir></xml>\n";
+
+          if (xmlOutput)
+             SendHttpReply(req, "application/xml", xml);
+          else
+             SendHttpReply(req, "text/html", reply);
+          
+       } else if (obj && obj->InheritsFrom(TFolder::Class())) {
+          TFolder* folder = (TFolder*)obj;
+
+          //printf("Folder %p\n", folder);
+          //folder->Print();
+
+          std::string xml;
+
+          xml += "<xml>\n";
+          xml += "<dir>\n";
+          
+          std::string reply;
+          std::string buf;
+          
+          reply += "<!DOCTYPE HTML PUBLIC \"-//IETF//DTD HTML 2.0//EN\">\n<html><head>\n";
+
+          buf = "Folder ";
+          buf += xpath;
+          reply += HtmlTag("title", buf) + "\n";
+          reply += "</head><body>\n";
+          reply += HtmlTag("h1", buf) + "\n";
+          
+          TIterator *iterator = folder->GetListOfFolders()->MakeIterator();
+          
+          while (1)
+             {
+                TNamed *obj = (TNamed*)iterator->Next();
+                if (obj == NULL)
+                   break;
                 
-             lock.Unlock();
-             
-             if (1) {
-                std::map<std::string, std::string>::iterator iter = alist.begin();
-                for (; iter!=alist.end(); iter++) {
-                   // iter->first is your key
-                   // iter->second is it''s value
-                   reply += iter->second;
-                }
+                reply += HtmlTag("p", MakeHtmlEntry(obj, path.c_str())) + "\n";
+                xml += MakeXmlEntry(obj);
              }
-              
-             reply += "</body></html>\n";
-
-             xml += "</dir></xml>\n";
+          
+          delete iterator;
 
-             if (xmlOutput)
-                SendHttpReply(sock, "application/xml", xml);
-             else
-                SendHttpReply(sock, "text/html", reply);
-             
-          } else if (obj && obj->InheritsFrom(TFolder::Class())) {
-             TFolder* folder = (TFolder*)obj;
+          lock.Unlock();
 
-             //printf("Folder %p\n", folder);
-             //folder->Print();
+          xml += "</dir></xml>\n";
+          reply += "</body></html>\n";
 
-             std::string xml;
+          if (xmlOutput)
+             SendHttpReply(req, "application/xml", xml);
+          else
+             SendHttpReply(req, "text/html", reply);
 
-             xml += "<xml>\n";
-             xml += "<dir>\n";
-             
-             std::string reply;
-             std::string buf;
-             
-             reply += "<!DOCTYPE HTML PUBLIC \"-//IETF//DTD HTML 2.0//EN\">\n<html><head>\n";
+       } else if (obj && obj->InheritsFrom(TCollection::Class())) {
+          TCollection* collection = (TCollection*)obj;
+          
+          //printf("Collection %p\n", collection);
+          //collection->Print();
+          //printf("Entries %d\n", collection->GetEntries());
+          //printf("IsEmpty %d\n", collection->IsEmpty());
+          
+          std::string xml;
 
-             buf = "Folder ";
-             buf += xpath;
-             reply += HtmlTag("title", buf) + "\n";
-             reply += "</head><body>\n";
-             reply += HtmlTag("h1", buf) + "\n";
-             
-             TIterator *iterator = folder->GetListOfFolders()->MakeIterator();
-             
-             while (1)
-                {
-                   TNamed *obj = (TNamed*)iterator->Next();
-                   if (obj == NULL)
-                      break;
-                   
-                   reply += HtmlTag("p", MakeHtmlEntry(obj, path.c_str())) + "\n";
-                   xml += MakeXmlEntry(obj);
-                }
-             
-             delete iterator;
+          xml += "<xml>\n";
+          xml += "<dir>\n";
+          
+          std::string reply;
+          std::string buf;
+          
+          reply += "<!DOCTYPE HTML PUBLIC \"-//IETF//DTD HTML 2.0//EN\">\n<html><head>\n";
 
-             lock.Unlock();
+          buf = "Collection ";
+          buf += xpath;
+          reply += HtmlTag("title", buf) + "\n";
+          reply += "</head><body>\n";
+          reply += HtmlTag("h1", buf) + "\n";
+          
+          TIterator *iterator = collection->MakeIterator();
+          
+          while (1)
+             {
+                TNamed *obj = (TNamed*)iterator->Next();
+                if (obj == NULL)
+                   break;
+                
+                reply += HtmlTag("p", MakeHtmlEntry(obj, path.c_str())) + "\n";
+                xml += MakeXmlEntry(obj);
+             }
+          
+          delete iterator;
 
-             xml += "</dir></xml>\n";
-             reply += "</body></html>\n";
+          lock.Unlock();
+          
+          xml += "</dir></xml>\n";
+          reply += "</body></html>\n";
 
-             if (xmlOutput)
-                SendHttpReply(sock, "application/xml", xml);
-             else
-                SendHttpReply(sock, "text/html", reply);
+          if (xmlOutput)
+             SendHttpReply(req, "application/xml", xml);
+          else
+             SendHttpReply(req, "text/html", reply);
 
-          } else if (obj && obj->InheritsFrom(TCollection::Class())) {
-             TCollection* collection = (TCollection*)obj;
-             
-             //printf("Collection %p\n", collection);
-             //collection->Print();
-             //printf("Entries %d\n", collection->GetEntries());
-             //printf("IsEmpty %d\n", collection->IsEmpty());
-             
+       } else {
+          if (xmlOutput) {
              std::string xml;
-
+             xml += "<?xml version=\"1.0\" encoding=\"UTF-8\" ?>\n";
              xml += "<xml>\n";
-             xml += "<dir>\n";
-             
+             xml += "<ROOTobject>\n";
+             TString msg = TBufferXML::ConvertToXML(obj);
+             xml += msg;
+             xml += "</ROOTobject>\n";
+             xml += "</xml>\n";
+             lock.Unlock();
+             SendHttpReply(req, "application/xml", xml);
+          } else {
+             lock.Unlock();
+             SendFile(req, "plot.html", "text/html");
+             if (0) {
              std::string reply;
              std::string buf;
              
              reply += "<!DOCTYPE HTML PUBLIC \"-//IETF//DTD HTML 2.0//EN\">\n<html><head>\n";
-
-             buf = "Collection ";
+             
+             buf = "Object ";
              buf += xpath;
              reply += HtmlTag("title", buf) + "\n";
              reply += "</head><body>\n";
              reply += HtmlTag("h1", buf) + "\n";
              
-             TIterator *iterator = collection->MakeIterator();
+             reply += HtmlTag("p", obj->GetName());
+             reply += HtmlTag("p", obj->ClassName());
              
-             while (1)
-                {
-                   TNamed *obj = (TNamed*)iterator->Next();
-                   if (obj == NULL)
-                      break;
-                   
-                   reply += HtmlTag("p", MakeHtmlEntry(obj, path.c_str())) + "\n";
-                   xml += MakeXmlEntry(obj);
-                }
-             
-             delete iterator;
-
-             lock.Unlock();
-             
-             xml += "</dir></xml>\n";
              reply += "</body></html>\n";
-
-             if (xmlOutput)
-                SendHttpReply(sock, "application/xml", xml);
-             else
-                SendHttpReply(sock, "text/html", reply);
-
-          } else {
-             if (xmlOutput) {
-                std::string xml;
-                xml += "<?xml version=\"1.0\" encoding=\"UTF-8\" ?>\n";
-                xml += "<xml>\n";
-                xml += "<ROOTobject>\n";
-                TString msg = TBufferXML::ConvertToXML(obj);
-                xml += msg;
-                xml += "</ROOTobject>\n";
-                xml += "</xml>\n";
-                lock.Unlock();
-                SendHttpReply(sock, "application/xml", xml);
-             } else {
-                SendFile(sock, "plot.html", "text/html");
-                if (0) {
-                std::string reply;
-                std::string buf;
-                
-                reply += "<!DOCTYPE HTML PUBLIC \"-//IETF//DTD HTML 2.0//EN\">\n<html><head>\n";
-                
-                buf = "Object ";
-                buf += xpath;
-                reply += HtmlTag("title", buf) + "\n";
-                reply += "</head><body>\n";
-                reply += HtmlTag("h1", buf) + "\n";
-                
-                reply += HtmlTag("p", obj->GetName());
-                reply += HtmlTag("p", obj->ClassName());
-                
-                reply += "</body></html>\n";
-                SendHttpReply(sock, "text/html", reply);
-                }
+             SendHttpReply(req, "text/html", reply);
              }
           }
-        }
+       }
+     }
 #if 0
-      else if (strncmp(request, "ResetTH1 ", 9) == 0)
-        {
-          XLockRootGuard lock;
-          
-          char* path = request + 9;
+   else if (strncmp(request, "ResetTH1 ", 9) == 0)
+     {
+       XLockRootGuard lock;
+       
+       char* path = request + 9;
+
+       if (strlen(path) > 1)
+         {
+           TObject *obj = FollowPath(path);
+
+           if (obj)
+             ResetObject(obj);
+         }
+       else
+         {
+           for (unsigned int i=0; i<gExports.size(); i++)
+             {
+               const char* ename = gExports[i].c_str();
+               const char* xname = gExportNames[ename].c_str();
+
+               TObject* obj = FindTopLevelObject(xname);
+
+               if (!obj)
+                 {
+                   fprintf(stderr, "XmlServer: ResetTH1: Exported name \'%s\' cannot be found!\n", xname);
+                   continue;
+                 }
+
+               ResetObject(obj);
+             }
+         }
+       
+       //TObjString s("Success");
+
+       //message.Reset(kMESS_OBJECT);
+       //message.WriteObject(&s);
+       lock.Unlock();
+       //sock->Send(message);
+
+       const char *msg = "Success";
+       sock->SendRaw(msg, strlen(msg) + 1);
+     }
+#endif
+   else
+     {
+       fprintf(stderr, "XmlServer: Received unknown request \"%s\"\n", uri);
+
+       std::string reply;
+       reply += "<!DOCTYPE HTML PUBLIC \"-//IETF//DTD HTML 2.0//EN\">\n<html><head>\n";
+       reply += HtmlTag("title", "Unknown request") + "\n";
+       reply += "</head><body>\n";
+       reply += HtmlTag("h1", "Unknown request") + "\n";
+       reply += HtmlTag("p", HtmlEncode(uri)) + "\n";
+       reply += "</body></html>\n";
+       SendHttpReply(req, "text/html", reply);
+     }
+}
 
-          if (strlen(path) > 1)
-            {
-              TObject *obj = FollowPath(path);
+/*------------------------------------------------------------------*/
 
-              if (obj)
-                ResetObject(obj);
-            }
-          else
-            {
-              for (unsigned int i=0; i<gExports.size(); i++)
-                {
-                  const char* ename = gExports[i].c_str();
-                  const char* xname = gExportNames[ename].c_str();
+// Connections are served by a fixed pool of worker threads. Idle
+// keep-alive connections are watched by the listener thread with poll(),
+// a connection with data to read is queued for the next free worker,
+// which serves all complete requests in its buffer and hands it back.
 
-                  TObject* obj = FindTopLevelObject(xname);
+static int gNumThreads = 4;
+static const int kIdleTimeoutSec = 60;
 
-                  if (!obj)
-                    {
-                      fprintf(stderr, "XmlServer: ResetTH1: Exported name \'%s\' cannot be found!\n", xname);
-                      continue;
-                    }
+static std::mutex gQueueMutex;
+static std::condition_variable gQueueCond;
+static std::deque<XConnection*> gQueue;    // connections ready to read, for the workers
+static std::deque<XConnection*> gReturned; // keep-alive connections, back to the listener
+static int gWakeupPipe[2] = { -1, -1 };    // wakes up the listener poll()
 
-                  ResetObject(obj);
-                }
-            }
-          
-          //TObjString s("Success");
+static void CloseConnection(XConnection* c)
+{
+   if (gVerbose)
+      fprintf(stderr, "XmlServer: connection from %s closed\n", c->fSock->GetInetAddress().GetHostName());
+   c->fSock->Close();
+   delete c->fSock;
+   delete c;
+}
 
-          //message.Reset(kMESS_OBJECT);
-          //message.WriteObject(&s);
-          lock.Unlock();
-          //sock->Send(message);
+static bool ServeConnection(XConnection* c)
+/*
+  Read from the connection and serve all complete requests,
+  returns false if the connection should be closed.
+*/
+{
+   char buf[16*1024];
 
-          const char *msg = "Success";
-          sock->SendRaw(msg, strlen(msg) + 1);
-        }
-#endif
-      else
-        {
-          fprintf(stderr, "XmlServer: Received unknown request \"%s\"\n", request);
+   /* close connection if client has disconnected */
+   int rd = c->fSock->RecvRaw(buf, sizeof(buf), kDontBlock);
+   if (rd <= 0)
+      return false;
 
-          std::string reply;
-          reply += "<!DOCTYPE HTML PUBLIC \"-//IETF//DTD HTML 2.0//EN\">\n<html><head>\n";
-          reply += HtmlTag("title", "Unknown request") + "\n";
-          reply += "</head><body>\n";
-          reply += HtmlTag("h1", "Unknown request") + "\n";
-          reply += HtmlTag("p", request) + "\n";
-          reply += "</body></html>\n";
-          SendHttpReply(sock, "text/html", reply);
-        }
-   } while (1);
+   c->fBuffer.append(buf, rd);
+
+   while (1) {
+      XHttpRequest req;
+
+      int status = ParseRequest(c, &req);
+
+      if (status == 0)
+         return true; // wait for more data
+
+      if (status < 0) {
+         fprintf(stderr, "XmlServer: Bad request from %s\n", c->fSock->GetInetAddress().GetHostName());
+         req.fSock = c->fSock;
+         req.fKeepAlive = false;
+         SendHttpError(&req, 400, "Cannot parse request");
+         return false;
+      }
 
-   return THREADRETURN;
+      HandleRequest(&req);
+
+      if (!req.fKeepAlive)
+         return false;
+   }
 }
 
-/*------------------------------------------------------------------*/
+static void xworker_thread()
+{
+   while (1) {
+      XConnection* c = NULL;
+
+      {
+         std::unique_lock<std::mutex> lock(gQueueMutex);
+         while (gQueue.empty())
+            gQueueCond.wait(lock);
+         c = gQueue.front();
+         gQueue.pop_front();
+      }
+
+      if (!ServeConnection(c)) {
+         CloseConnection(c);
+         continue;
+      }
+
+      c->fLastActive = time(NULL);
+
+      {
+         std::lock_guard<std::mutex> lock(gQueueMutex);
+         gReturned.push_back(c);
+      }
+
+      char x = 0;
+      int wr = write(gWakeupPipe[1], &x, 1);
+      if (wr != 1)
+         perror("XmlServer: write(wakeup pipe)");
+   }
+}
 
 static THREADTYPE xsocket_listener(void *arg)
 {
-  // Server loop listening for incoming network connections on specified port.
-  // Starts a searver_thread for each connection.
+  // Server loop listening for incoming network connections on specified port
+  // and for requests on idle connections.
 
   int port = *(int *) arg;
   
-  fprintf(stderr, "XmlServer: Listening on port %d...\n", port);
+  fprintf(stderr, "XmlServer: Listening on port %d, %d worker threads...\n", port, gNumThreads);
   TServerSocket *lsock = new TServerSocket(port, kTRUE);
+
+  std::vector<XConnection*> idle;
+  std::vector<struct pollfd> fds;
   
   while (1)
     {
-      TSocket *sock = lsock->Accept();
-      
-      if (sock==NULL)
-        {
-          fprintf(stderr, "XmlServer: TSocket->Accept() error\n");
-          break;
-        }
+      fds.clear();
+
+      struct pollfd pfd;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+
+      pfd.fd = lsock->GetDescriptor();
+      fds.push_back(pfd);
+      pfd.fd = gWakeupPipe[0];
+      fds.push_back(pfd);
+      for (unsigned i=0; i<idle.size(); i++) {
+         pfd.fd = idle[i]->fSock->GetDescriptor();
+         fds.push_back(pfd);
+      }
+
+      int status = poll(&fds[0], fds.size(), 1000);
+
+      if (status < 0) {
+         if (errno == EINTR)
+            continue;
+         perror("XmlServer: poll()");
+         break;
+      }
+
+      time_t now = time(NULL);
+
+      std::vector<XConnection*> ready;
+      std::vector<XConnection*> xidle;
+
+      for (unsigned i=0; i<idle.size(); i++) {
+         XConnection* c = idle[i];
+         if (fds[i+2].revents)
+            ready.push_back(c);
+         else if (now - c->fLastActive > kIdleTimeoutSec)
+            CloseConnection(c);
+         else
+            xidle.push_back(c);
+      }
+
+      idle.swap(xidle);
+
+      if (fds[1].revents) {
+         char buf[256];
+         int rd = read(gWakeupPipe[0], buf, sizeof(buf));
+         if (rd < 0)
+            perror("XmlServer: read(wakeup pipe)");
+
+         std::lock_guard<std::mutex> lock(gQueueMutex);
+         idle.insert(idle.end(), gReturned.begin(), gReturned.end());
+         gReturned.clear();
+      }
+
+      if (fds[0].revents) {
+         TSocket *sock = lsock->Accept();
       
-      if (gVerbose)
-        fprintf(stderr, "XmlServer: connection from %s\n", sock->GetInetAddress().GetHostName());
+         if (sock==NULL)
+           {
+             fprintf(stderr, "XmlServer: TSocket->Accept() error\n");
+             break;
+           }
       
-#if 1
-      TThread *thread = new TThread("XmlServer", xroot_server_thread, sock);
-      thread->Run();
-#else
-      LPDWORD lpThreadId = 0;
-      CloseHandle(CreateThread(NULL, 1024, &xroot_server_thread, sock, 0, lpThreadId));
-#endif
+         if (gVerbose)
+           fprintf(stderr, "XmlServer: connection from %s\n", sock->GetInetAddress().GetHostName());
+
+         XConnection* c = new XConnection;
+         c->fSock = sock;
+         c->fLastActive = now;
+         idle.push_back(c);
+      }
+
+      if (!ready.empty()) {
+         std::lock_guard<std::mutex> lock(gQueueMutex);
+         gQueue.insert(gQueue.end(), ready.begin(), ready.end());
+         gQueueCond.notify_all();
+      }
     }
   
   return THREADRETURN;
@@ -985,6 +1417,12 @@ void XmlServer::SetVerbose(bool verbose)
   gVerbose = verbose;
 }
 
+void XmlServer::SetNumThreads(int num_threads)
+{
+  if (num_threads > 0)
+    gNumThreads = num_threads;
+}
+
 /*------------------------------------------------------------------*/
 
 void XmlServer::Export(TDirectory* dir, const char* exportName)
@@ -1049,6 +1487,16 @@ void XmlServer::Start(int port)
   //printf("Here!\n");
 
   static int pport = port;
+
+  if (pipe(gWakeupPipe) != 0)
+    {
+      perror("XmlServer: pipe()");
+      return;
+    }
+
+  for (int i=0; i<gNumThreads; i++)
+    std::thread(xworker_thread).detach();
+
 #if 1
   TThread *thread = new TThread("XmlServer", xsocket_listener, &pport);
   thread->Run();
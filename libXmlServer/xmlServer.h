@@ -13,6 +13,7 @@ class XmlServer
  public:
    void Start(int port);
    void SetVerbose(bool verbose);
+   void SetNumThreads(int num_threads); // size of the worker pool, call before Start()
    void Export(TDirectory* dir, const char* exportName);
    void Export(TFolder* folder, const char* exportName);
    void Export(TCollection* collection, const char* exportName);